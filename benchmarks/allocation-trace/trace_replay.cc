@@ -0,0 +1,161 @@
+#include "../timing.h"
+#include <algorithm>
+#include <compartment.h>
+#include <debug.hh>
+#include <iterator>
+#include <simulator.h>
+
+using Debug = ConditionalDebug<DEBUG_TRACEBENCH, "Allocation trace benchmark">;
+
+DECLARE_AND_DEFINE_ALLOCATOR_MANAGEMENT_CAPABILITY(tracebenchManagement);
+DECLARE_AND_DEFINE_ALLOCATOR_CAPABILITY(tracebenchClaims, 1000000);
+
+namespace
+{
+	/**
+	 * The kinds of operation in a trace.
+	 */
+	enum TraceKind : uint8_t
+	{
+		/// Allocate an object into a slot.
+		TraceAllocate,
+		/// Free the object in a slot.
+		TraceFree,
+		/// Claim the object in a slot with a second allocator capability.
+		TraceClaim,
+		/// Drop a claim made with `TraceClaim`.
+		TraceRelease,
+		/// Grow the object in a slot with `heap_reallocate`.
+		TraceReallocate,
+	};
+
+	/**
+	 * A single operation in a trace.
+	 */
+	struct TraceOperation
+	{
+		/// The kind of operation.
+		TraceKind kind;
+		/// The slot that holds the object that this operation refers to.
+		uint8_t slot;
+		/// The size of the allocation, for `TraceAllocate` and
+		/// `TraceReallocate`.
+		uint32_t size;
+	};
+
+	/// The number of slots that a trace may refer to.
+	constexpr size_t MaxSlots = 64;
+
+	/**
+	 * The trace to replay, generated from `trace.txt` by
+	 * `trace_to_header.py`.
+	 */
+	constexpr TraceOperation Trace[] = {
+#include "trace.inc"
+	};
+
+	/// The objects that the trace refers to, indexed by slot.
+	void *slots[MaxSlots];
+
+	/**
+	 * Snapshot of the heap state.  This is a global to keep it off the (small)
+	 * stack.
+	 */
+	HeapStatistics statistics;
+
+	/**
+	 * Replay a single operation.
+	 */
+	void replay(const TraceOperation &operation)
+	{
+		void *&object = slots[operation.slot];
+		switch (operation.kind)
+		{
+			case TraceAllocate:
+				object = malloc(operation.size);
+				Debug::Assert(object != nullptr,
+				              "Failed to allocate {} bytes",
+				              operation.size);
+				break;
+			case TraceFree:
+				free(object);
+				break;
+			case TraceClaim:
+				heap_claim(STATIC_SEALED_VALUE(tracebenchClaims), object);
+				break;
+			case TraceRelease:
+				heap_free(STATIC_SEALED_VALUE(tracebenchClaims), object);
+				break;
+			case TraceReallocate:
+			{
+				Timeout t{UnlimitedTimeout};
+				object =
+				  heap_reallocate(&t, MALLOC_CAPABILITY, object, operation.size);
+				Debug::Assert(object != nullptr,
+				              "Failed to reallocate to {} bytes",
+				              operation.size);
+				break;
+			}
+		}
+	}
+
+	/**
+	 * Returns the percentage of free memory that is not in the largest free
+	 * chunk in the most recent snapshot.
+	 */
+	size_t fragmentation()
+	{
+		if (statistics.freeSize == 0)
+		{
+			return 0;
+		}
+		return 100 - (statistics.largestFreeChunk * 100 / statistics.freeSize);
+	}
+} // namespace
+
+/**
+ * Replay an allocation trace.  The first pass is timed and reports throughput.
+ * The second pass takes a snapshot of the heap after every operation, to
+ * report the peak quarantine size and the worst fragmentation seen.
+ */
+void __cheri_compartment("tracebench") run()
+{
+	// Make sure sail doesn't print annoying log messages in the middle of the
+	// output the first time that allocation happens.
+	free(malloc(16));
+	heap_quarantine_empty();
+	MessageBuilder<ImplicitUARTOutput> out;
+	constexpr size_t                   Operations = std::size(Trace);
+
+	auto start = rdcycle();
+	for (const auto &operation : Trace)
+	{
+		replay(operation);
+	}
+	auto end = rdcycle();
+	out.format("#board\toperations\tcycles\tcycles per operation\n");
+	out.format(__XSTRING(BOARD) "\t{}\t{}\t{}\n",
+	           static_cast<int>(Operations),
+	           end - start,
+	           (end - start) / static_cast<int>(Operations));
+	heap_quarantine_empty();
+
+	size_t peakQuarantine       = 0;
+	size_t worstFragmentation   = 0;
+	auto   statisticsCapability = STATIC_SEALED_VALUE(tracebenchManagement);
+	for (const auto &operation : Trace)
+	{
+		replay(operation);
+		int ret = heap_stats_get(statisticsCapability, &statistics);
+		Debug::Assert(ret == 0, "Failed to read heap statistics: {}", ret);
+		peakQuarantine = std::max(peakQuarantine, statistics.quarantineSize);
+		worstFragmentation = std::max(worstFragmentation, fragmentation());
+	}
+	out.format("#board\tpeak quarantine\tworst fragmentation %\tfinal "
+	           "fragmentation %\n");
+	out.format(__XSTRING(BOARD) "\t{}\t{}\t{}\n",
+	           peakQuarantine,
+	           worstFragmentation,
+	           fragmentation());
+	simulation_exit(0);
+}
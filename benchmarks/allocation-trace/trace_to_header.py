@@ -0,0 +1,55 @@
+#!/usr/bin/env python3
+# Copyright Microsoft and CHERIoT Contributors.
+# SPDX-License-Identifier: MIT
+
+"""
+Convert a textual allocation trace into the array initialiser that the
+allocation trace benchmark replays.
+
+Each non-empty line of the input that does not start with `#` is one
+operation on a numbered slot:
+
+    a <slot> <size>   allocate <size> bytes into <slot>
+    f <slot>          free the object in <slot>
+    c <slot>          claim the object in <slot>
+    r <slot>          release (drop) a claim on the object in <slot>
+    g <slot> <size>   grow the object in <slot> to <size> bytes
+"""
+
+import sys
+
+Kinds = {'a': 'TraceAllocate', 'f': 'TraceFree', 'c': 'TraceClaim',
+         'r': 'TraceRelease', 'g': 'TraceReallocate'}
+MaxSlots = 64
+
+
+def fail(lineNumber, msg):
+    sys.stderr.write(f"line {lineNumber}: {msg}\n")
+    sys.exit(1)
+
+
+def convert(infile, outfile):
+    outfile.write("// Generated by trace_to_header.py, do not edit.\n")
+    for lineNumber, line in enumerate(infile, 1):
+        fields = line.split()
+        if not fields or fields[0].startswith('#'):
+            continue
+        kind = Kinds.get(fields[0])
+        if kind is None:
+            fail(lineNumber, f"unknown operation '{fields[0]}'")
+        expected = 3 if fields[0] in ('a', 'g') else 2
+        if len(fields) != expected:
+            fail(lineNumber, f"expected {expected} fields, got {len(fields)}")
+        slot = int(fields[1], 0)
+        if slot >= MaxSlots:
+            fail(lineNumber, f"slot {slot} is not less than {MaxSlots}")
+        size = int(fields[2], 0) if expected == 3 else 0
+        outfile.write(f"{{{kind}, {slot}, {size}}},\n")
+
+
+if __name__ == '__main__':
+    if len(sys.argv) != 3:
+        sys.stderr.write(f"usage: {sys.argv[0]} trace.txt trace.inc\n")
+        sys.exit(1)
+    with open(sys.argv[1]) as infile, open(sys.argv[2], 'w') as outfile:
+        convert(infile, outfile)
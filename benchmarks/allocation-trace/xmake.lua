@@ -0,0 +1,40 @@
+-- Copyright Microsoft and CHERIoT Contributors.
+-- SPDX-License-Identifier: MIT
+
+set_project("CHERIoT allocation trace replay benchmark");
+sdkdir = "../../sdk"
+includes(sdkdir)
+set_toolchains("cheriot-clang")
+
+-- Support libraries
+includes(path.join(sdkdir, "lib/freestanding"),
+         path.join(sdkdir, "lib/atomic"),
+         path.join(sdkdir, "lib/crt"))
+
+option("board")
+    set_default("sail")
+
+debugOption("tracebench");
+compartment("tracebench")
+    add_rules("cherimcu.component-debug")
+    -- Allow allocating an effectively unbounded amount of memory (more than exists)
+    add_defines("MALLOC_QUOTA=1000000")
+    add_defines("BOARD=" .. tostring(get_config("board")))
+    add_files("trace_replay.cc")
+
+-- Firmware image for the benchmark.
+firmware("allocation-trace-benchmark")
+    add_deps("crt", "freestanding", "atomic")
+    add_deps("tracebench")
+    on_load(function(target)
+        target:values_set("board", "$(board)")
+        target:values_set("threads", {
+            {
+                compartment = "tracebench",
+                priority = 1,
+                entry_point = "run",
+                stack_size = 0x400,
+                trusted_stack_frames = 4
+            },
+        }, {expand = false})
+    end)
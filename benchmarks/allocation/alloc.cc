@@ -1,13 +1,153 @@
 #include "../timing.h"
+#include <cheri.hh>
 #include <compartment.h>
 #include <debug.hh>
 #include <locks.hh>
 
 using Debug = ConditionalDebug<DEBUG_ALLOCBENCH, "Allocator benchmark">;
 
+DECLARE_AND_DEFINE_ALLOCATOR_MANAGEMENT_CAPABILITY(allocbenchManagement);
+DECLARE_AND_DEFINE_ALLOCATOR_CAPABILITY(claimHeap, 16384);
+
+namespace
+{
+	/**
+	 * Snapshot of the heap state.  This is a global to keep it off the (small)
+	 * stack.
+	 */
+	HeapStatistics statistics;
+
+	/**
+	 * Per-capability heap usage.  Also a global to keep it off the stack.
+	 */
+	constexpr size_t    QuotaStatisticsCount = 4;
+	HeapQuotaStatistics quotaStatistics[QuotaStatisticsCount];
+
+	/**
+	 * Print a snapshot of the heap state.
+	 */
+	void print_heap_statistics(MessageBuilder<ImplicitUARTOutput> &out)
+	{
+		int ret =
+		  heap_stats_get(STATIC_SEALED_VALUE(allocbenchManagement), &statistics);
+		if (ret != 0)
+		{
+			out.format("#heap statistics unavailable: {}\n", ret);
+			return;
+		}
+		out.format("#heap\ttotal\tfree\tquarantine\tlargest free\thazards\n");
+		out.format("#heap\t{}\t{}\t{}\t{}\t{}\n",
+		           statistics.totalSize,
+		           statistics.freeSize,
+		           statistics.quarantineSize,
+		           statistics.largestFreeChunk,
+		           statistics.hazardQuarantineOccupancy);
+		out.format("#allocations\tsucceeded\tpermanent\trevocation "
+		           "needed\tdeallocation needed\n");
+		out.format("#allocations\t{}\t{}\t{}\t{}\n",
+		           statistics.allocations,
+		           statistics.failuresPermanent,
+		           statistics.failuresRevocationNeeded,
+		           statistics.failuresDeallocationNeeded);
+		out.format("#revocation\tsweeps\tdeferred\tbytes reclaimed\n");
+		out.format("#revocation\t{}\t{}\t{}\n",
+		           statistics.revocationSweeps,
+		           statistics.revocationSweepsDeferred,
+		           statistics.revocationBytesReclaimed);
+		out.format("#sweep cycles\tlast\tmax\tmax pause\ttick size\n");
+		out.format("#sweep cycles\t{}\t{}\t{}\t{}\n",
+		           statistics.revocationLastSweepCycles,
+		           statistics.revocationMaxSweepCycles,
+		           statistics.revocationMaxPauseCycles,
+		           statistics.revocationTickSize);
+		for (size_t i = 0; i < HEAP_STATISTICS_SMALL_BINS; i++)
+		{
+			out.format("#small bin\t{}\t{} chunks\n",
+			           i,
+			           statistics.smallBinChunks[i]);
+		}
+		for (size_t i = 0; i < HEAP_STATISTICS_TREE_BINS; i++)
+		{
+			out.format("#tree bin\t{}\t{} chunks\t{} bytes\n",
+			           i,
+			           statistics.treeBinChunks[i],
+			           statistics.treeBinBytes[i]);
+		}
+		ssize_t quotas =
+		  heap_quota_statistics_get(STATIC_SEALED_VALUE(allocbenchManagement),
+		                            quotaStatistics,
+		                            QuotaStatisticsCount);
+		if (quotas < 0)
+		{
+			out.format("#quota statistics unavailable: {}\n", quotas);
+			return;
+		}
+		out.format("#quota\tidentifier\tcapability\tquota\tlive\tpeak\t"
+		           "allocations\n");
+		for (ssize_t i = 0; i < quotas; i++)
+		{
+			auto &quota = quotaStatistics[i];
+			out.format("#quota\t{}\t{}\t{}\t{}\t{}\t{}\n",
+			           quota.identifier,
+			           quota.capability,
+			           quota.quota,
+			           quota.liveBytes,
+			           quota.peakBytes,
+			           quota.allocations);
+			for (size_t j = 0; j < HEAP_QUOTA_HISTOGRAM_BUCKETS; j++)
+			{
+				if (quota.histogram[j] != 0)
+				{
+					out.format("#quota size\t{}\t{}\t{}\n",
+					           quota.identifier,
+					           8U << j,
+					           quota.histogram[j]);
+				}
+			}
+		}
+	}
+
+	/**
+	 * Claim `objects[i % count]` via a pointer `offset` bytes into the object,
+	 * `iterations` times, and print how long it takes.  Each claim on an
+	 * object other than the one most recently claimed misses the allocator's
+	 * claim cache.  Drops all of the claims before returning.
+	 */
+	void claim_benchmark(MessageBuilder<ImplicitUARTOutput> &out,
+	                     const char                         *name,
+	                     void                              **objects,
+	                     size_t                              count,
+	                     size_t                              offset)
+	{
+		const size_t Iterations = 256;
+		auto         start      = rdcycle();
+		for (size_t i = 0; i < Iterations; i++)
+		{
+			CHERI::Capability pointer{objects[i % count]};
+			pointer.address() += offset;
+			size_t claimed = heap_claim(STATIC_SEALED_VALUE(claimHeap), pointer);
+			Debug::Assert(claimed != 0, "Claim {} of {} failed", i, pointer);
+		}
+		auto end = rdcycle();
+		out.format(__XSTRING(BOARD) "\t{}\t{}\t{}\n",
+		           name,
+		           static_cast<int>(offset),
+		           (end - start) / Iterations);
+		for (size_t i = 0; i < Iterations; i++)
+		{
+			heap_free(STATIC_SEALED_VALUE(claimHeap), objects[i % count]);
+		}
+	}
+} // namespace
+
 /**
- * Try allocating 1 MiB of memory in allocation sizes ranging from 32 - 4096
- * bytes, report how long it takes.
+ * Try allocating 1 MiB of memory in allocation sizes ranging from 32 - 131072
+ * bytes, report how long it takes.  Then allocate and free batches of small
+ * (32 - 256 byte) objects, to measure the small-allocation path, and of large
+ * objects whose bounds require alignment.  Then measure
+ * the latency of claiming an object that the caller has already claimed, with
+ * and without hitting the allocator's claim cache.  Finally, print a snapshot
+ * of the heap statistics.
  */
 void __cheri_compartment("allocbench") run()
 {
@@ -38,4 +178,110 @@ void __cheri_compartment("allocbench") run()
 		heap_quarantine_empty();
 		Debug::log("Flushed quarantine");
 	}
+
+	// Small allocations, kept live in batches so that consecutive allocations
+	// cannot simply reuse the chunk that was just freed.  These are the sizes
+	// that the optional size-class caches (`allocator_size_classes` in the
+	// board description) are intended for.
+#ifdef CHERIOT_ALLOCATOR_SIZE_CLASSES
+	out.format("#size classes: " __XSTRING(CHERIOT_ALLOCATOR_SIZE_CLASSES) "\n");
+#else
+	out.format("#size classes: none\n");
+#endif
+	out.format("#board\tsize\tbatched time\n");
+	const size_t SmallMinimumSize = 32;
+	const size_t SmallMaximumSize = 256;
+	const size_t SmallStep        = 32;
+	const size_t BatchSize        = 16;
+	const size_t SmallTotalSize   = 128 * 1024;
+	void        *batch[BatchSize];
+	for (size_t size = SmallMinimumSize; size <= SmallMaximumSize;
+	     size += SmallStep)
+	{
+		size_t batches = SmallTotalSize / (size * BatchSize);
+		auto   start   = rdcycle();
+		for (size_t i = 0; i < batches; i++)
+		{
+			for (auto &ptr : batch)
+			{
+				ptr = malloc(size);
+				Debug::Assert(ptr != nullptr,
+				              "Allocation in batch {} of {} {}-byte batches "
+				              "failed.",
+				              i,
+				              batches,
+				              size);
+			}
+			for (auto *ptr : batch)
+			{
+				free(ptr);
+			}
+		}
+		auto end = rdcycle();
+		out.format(
+		  __XSTRING(BOARD) "\t{}\t{}\n", static_cast<int>(size), end - start);
+		heap_quarantine_empty();
+	}
+
+	// Large allocations that are not powers of two.  Above 4 KiB, capability
+	// bounds require alignment, so these need aligned chunks.  Freeing every
+	// other object in a batch leaves aligned holes that the next half-batch
+	// can reuse without padding.
+	out.format("#board\tsize\taligned time\n");
+	const size_t LargeSizes[]   = {4104, 6000, 9000, 16000};
+	const size_t LargeBatchSize = 4;
+	const size_t LargeRounds    = 8;
+	void        *largeBatch[LargeBatchSize];
+	for (size_t size : LargeSizes)
+	{
+		auto start = rdcycle();
+		for (size_t round = 0; round < LargeRounds; round++)
+		{
+			for (auto &ptr : largeBatch)
+			{
+				ptr = malloc(size);
+			}
+			for (size_t i = 0; i < LargeBatchSize; i += 2)
+			{
+				free(largeBatch[i]);
+				largeBatch[i] = malloc(size);
+			}
+			for (auto *ptr : largeBatch)
+			{
+				free(ptr);
+			}
+		}
+		auto end = rdcycle();
+		out.format(
+		  __XSTRING(BOARD) "\t{}\t{}\n", static_cast<int>(size), end - start);
+		heap_quarantine_empty();
+	}
+
+	// Repeated claims on long-lived objects.  Claiming a single object
+	// repeatedly hits the claim cache, alternating between two objects
+	// always misses it and so must find the start of the object in the
+	// revocation bitmap.  Claiming near the end of an object makes that
+	// search as long as possible.
+	const size_t ClaimObjectSize = 4096;
+	void        *claimObjects[2];
+	for (auto &object : claimObjects)
+	{
+		object = malloc(ClaimObjectSize);
+		Debug::Assert(object != nullptr, "Failed to allocate claim object");
+	}
+	out.format("#board\tclaim\toffset\tcycles per claim\n");
+	for (size_t offset : {size_t(0), ClaimObjectSize - 8})
+	{
+		claim_benchmark(out, "cached", claimObjects, 1, offset);
+		claim_benchmark(out, "uncached", claimObjects, 2, offset);
+	}
+	for (auto *object : claimObjects)
+	{
+		free(object);
+	}
+	heap_quarantine_empty();
+
+	// Report the state of the heap after the run, to show fragmentation and
+	// how often allocations had to wait.
+	print_heap_statistics(out);
 }
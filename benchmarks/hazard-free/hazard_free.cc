@@ -0,0 +1,103 @@
+#include "../timing.h"
+#include <compartment.h>
+#include <debug.hh>
+#include <simulator.h>
+#include <thread.h>
+
+using Debug = ConditionalDebug<DEBUG_HAZARD_FREE_BENCH, "Hazard free benchmark">;
+
+namespace
+{
+	/// The number of threads running the benchmark (see xmake.lua).
+	constexpr size_t Threads = 4;
+
+	/// The number of objects that each thread allocates and frees per round.
+	constexpr size_t BatchSize = 8;
+
+	/// The number of rounds that each thread runs.
+	constexpr size_t Rounds = 32;
+
+	/// The size of each object.
+	constexpr size_t ObjectSize = 64;
+
+	/// The number of threads that have not yet finished.
+	_Atomic(uint32_t) threadsRunning = Threads;
+} // namespace
+
+/**
+ * Each thread holds hazard pointers to two long-lived objects and then
+ * repeatedly allocates and frees batches of small objects.  Every free must
+ * check the freed object against every thread's hazard pointers, so this
+ * measures how the cost of a free scales with the number of threads that are
+ * holding ephemeral claims.
+ *
+ * Hazard pointers are guaranteed to survive only until the next
+ * cross-compartment call, so they are set again before each free and only the
+ * free itself is timed.
+ *
+ * Each round is then repeated with a single `heap_free_batch` call, which
+ * holds one hazard epoch for the whole batch and so builds the sorted hazard
+ * snapshot once, rather than scanning the hazard slots for each object.
+ */
+void __cheri_compartment("hazard_free_bench") run()
+{
+	MessageBuilder<ImplicitUARTOutput> out;
+	uint16_t                           threadID = thread_id_get();
+	Timeout                            t{UnlimitedTimeout};
+
+	void *held[2];
+	for (auto &object : held)
+	{
+		object = malloc(ObjectSize);
+		Debug::Assert(object != nullptr, "Failed to allocate held object");
+	}
+
+	void *batch[BatchSize];
+	int   cycles      = 0;
+	int   batchCycles = 0;
+	for (size_t round = 0; round < Rounds; round++)
+	{
+		for (auto &ptr : batch)
+		{
+			ptr = malloc(ObjectSize);
+			Debug::Assert(ptr != nullptr, "Allocation in round {} failed", round);
+		}
+		for (auto *ptr : batch)
+		{
+			int ret = heap_claim_fast(&t, held[0], held[1]);
+			Debug::Assert(ret == 0, "Failed to take hazard pointers: {}", ret);
+			auto start = rdcycle();
+			free(ptr);
+			cycles += rdcycle() - start;
+		}
+		ssize_t allocated = heap_allocate_batch(
+		  &t, MALLOC_CAPABILITY, ObjectSize, BatchSize, batch);
+		Debug::Assert(allocated == static_cast<ssize_t>(BatchSize),
+		              "Batch allocation in round {} returned {}",
+		              round,
+		              allocated);
+		int ret = heap_claim_fast(&t, held[0], held[1]);
+		Debug::Assert(ret == 0, "Failed to take hazard pointers: {}", ret);
+		auto start = rdcycle();
+		heap_free_batch(MALLOC_CAPABILITY, batch, BatchSize);
+		batchCycles += rdcycle() - start;
+	}
+	out.format("#board\tthreads\tthread\tcycles per free\t"
+	           "cycles per batched free\n");
+	out.format(__XSTRING(BOARD) "\t{}\t{}\t{}\t{}\n",
+	           static_cast<int>(Threads),
+	           threadID,
+	           cycles / static_cast<int>(Rounds * BatchSize),
+	           batchCycles / static_cast<int>(Rounds * BatchSize));
+
+	for (auto *object : held)
+	{
+		free(object);
+	}
+
+	// Last one out turns off the lights.
+	if (--threadsRunning == 0)
+	{
+		simulation_exit(0);
+	}
+}
@@ -0,0 +1,42 @@
+-- Copyright Microsoft and CHERIoT Contributors.
+-- SPDX-License-Identifier: MIT
+
+set_project("CHERIoT multi-thread free benchmark");
+sdkdir = "../../sdk"
+includes(sdkdir)
+set_toolchains("cheriot-clang")
+
+-- Support libraries
+includes(path.join(sdkdir, "lib/freestanding"),
+         path.join(sdkdir, "lib/atomic"),
+         path.join(sdkdir, "lib/crt"),
+         path.join(sdkdir, "lib/compartment_helpers"))
+
+option("board")
+    set_default("sail")
+
+debugOption("hazard_free_bench");
+compartment("hazard_free_bench")
+    add_rules("cherimcu.component-debug")
+    add_defines("MALLOC_QUOTA=1000000")
+    add_defines("BOARD=" .. tostring(get_config("board")))
+    add_files("hazard_free.cc")
+
+-- Firmware image for the benchmark.
+firmware("hazard-free-benchmark")
+    add_deps("crt", "freestanding", "atomic", "compartment_helpers")
+    add_deps("hazard_free_bench")
+    on_load(function(target)
+        target:values_set("board", "$(board)")
+        local threads = {}
+        for i = 1, 4 do
+            table.insert(threads, {
+                compartment = "hazard_free_bench",
+                priority = 1,
+                entry_point = "run",
+                stack_size = 0x400,
+                trusted_stack_frames = 4
+            })
+        end
+        target:values_set("threads", threads, {expand = false})
+    end)
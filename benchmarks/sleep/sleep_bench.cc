@@ -0,0 +1,114 @@
+#include "../timing.h"
+#include <compartment.h>
+#include <debug.hh>
+#include <futex.h>
+#include <simulator.h>
+#include <thread.h>
+
+using Debug = ConditionalDebug<DEBUG_SLEEP_BENCH, "Sleep benchmark">;
+
+namespace
+{
+	/// The largest number of sleeping threads (see xmake.lua).
+	constexpr uint32_t Sleepers = SLEEPERS;
+
+	/// The thread ID of the first sleeper (see xmake.lua).
+	constexpr uint16_t FirstSleeper = 2;
+
+	/// The number of sleeps to measure for each number of sleeping threads.
+	constexpr int Iterations = 16;
+
+	/**
+	 * The number of ticks that each sleeper sleeps for.  This is long enough
+	 * that none of them wakes during the benchmark.
+	 */
+	constexpr Ticks LongSleep = 1000000;
+
+	/// The number of sleepers that should now be asleep.
+	uint32_t activeSleepers;
+
+	/**
+	 * The cycle counter when the measuring thread started to sleep, or 0 if
+	 * the observer has recorded the latency for the last sleep.
+	 */
+	volatile int start;
+
+	/// The cycles from calling `thread_sleep` to running the next thread.
+	volatile int latency;
+} // namespace
+
+/**
+ * The highest-priority thread.  For each number of sleeping threads, this
+ * repeatedly sleeps for one tick and reports the average time between calling
+ * `thread_sleep` and the lowest-priority thread running.  This includes adding
+ * the measuring thread to the scheduler's timer queue, which already contains
+ * the sleepers with later expiry times.
+ */
+void __cheri_compartment("sleep_bench") measure()
+{
+	MessageBuilder<ImplicitUARTOutput> out;
+	out.format("#board\tsleeping threads\tcycles\n");
+	for (uint32_t sleepers = 0; sleepers <= Sleepers; sleepers++)
+	{
+		// Let one more sleeper go to sleep.
+		activeSleepers = sleepers;
+		futex_wake(&activeSleepers, UINT32_MAX);
+		Timeout settle{2};
+		thread_sleep(&settle);
+
+		int total = 0;
+		for (int i = 0; i < Iterations; i++)
+		{
+			latency = 0;
+			start   = rdcycle();
+			Timeout t{1};
+			thread_sleep(&t);
+			// If the observer did not run while we slept, `latency` is not a
+			// measurement of this sleep.
+			Debug::Invariant(start == 0,
+			                 "Observer did not run during sleep {} with {} "
+			                 "sleepers",
+			                 i,
+			                 sleepers);
+			total += latency;
+		}
+		out.format(
+		  __XSTRING(BOARD) "\t{}\t{}\n", sleepers, total / Iterations);
+	}
+	simulation_exit(0);
+}
+
+/**
+ * Each sleeper waits until the measuring thread allows it to sleep, then
+ * sleeps for a long time.  Each sleeper uses a different timeout so that the
+ * scheduler's timer queue holds distinct expiry times.
+ */
+void __cheri_compartment("sleep_bench") sleeper()
+{
+	uint32_t index = thread_id_get() - FirstSleeper;
+	uint32_t active;
+	while ((active = activeSleepers) <= index)
+	{
+		futex_wait(&activeSleepers, active);
+	}
+	Debug::log("Sleeper {} sleeping", index);
+	Timeout t{LongSleep + index};
+	thread_sleep(&t);
+}
+
+/**
+ * The lowest-priority thread runs whenever the measuring thread is asleep and
+ * records how long it took to get here.
+ */
+void __cheri_compartment("sleep_bench") observer()
+{
+	while (true)
+	{
+		int sleepStart = start;
+		if (sleepStart != 0)
+		{
+			latency = rdcycle() - sleepStart;
+			start   = 0;
+		}
+	}
+}
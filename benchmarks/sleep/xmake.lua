@@ -0,0 +1,69 @@
+-- Copyright Microsoft and CHERIoT Contributors.
+-- SPDX-License-Identifier: MIT
+
+set_project("CHERIoT thread sleep benchmark");
+sdkdir = "../../sdk"
+includes(sdkdir)
+set_toolchains("cheriot-clang")
+
+-- Support libraries
+includes(path.join(sdkdir, "lib/freestanding"),
+         path.join(sdkdir, "lib/atomic"),
+         path.join(sdkdir, "lib/crt"))
+
+option("board")
+    set_default("sail")
+
+-- The largest number of threads that sleep with long timeouts while the cost
+-- of `thread_sleep` is measured.  The benchmark reports the cost for every
+-- number of sleepers up to this.  Tens of sleepers are needed to see how the
+-- cost of inserting into the timer queue grows.
+option("sleepers")
+    set_default(32)
+    set_description("Maximum number of sleeping threads to measure with")
+    set_showmenu(true)
+
+sleepers = tonumber(get_config("sleepers"))
+
+debugOption("sleep_bench");
+compartment("sleep_bench")
+    add_rules("cherimcu.component-debug")
+    add_defines("BOARD=" .. tostring(get_config("board")))
+    add_defines("SLEEPERS=" .. tostring(sleepers))
+    add_files("sleep_bench.cc")
+
+-- Firmware image for the benchmark.
+firmware("sleep-benchmark")
+    add_deps("crt", "freestanding", "atomic")
+    add_deps("sleep_bench")
+    on_load(function(target)
+        target:values_set("board", "$(board)")
+        -- The measuring thread must be thread 1 and the sleepers must be
+        -- threads 2 to sleepers + 1.
+        local threads = {
+            {
+                compartment = "sleep_bench",
+                priority = 3,
+                entry_point = "measure",
+                stack_size = 0x400,
+                trusted_stack_frames = 4
+            }
+        }
+        for i = 1, sleepers do
+            table.insert(threads, {
+                compartment = "sleep_bench",
+                priority = 2,
+                entry_point = "sleeper",
+                stack_size = 0x200,
+                trusted_stack_frames = 4
+            })
+        end
+        table.insert(threads, {
+            compartment = "sleep_bench",
+            priority = 1,
+            entry_point = "observer",
+            stack_size = 0x200,
+            trusted_stack_frames = 2
+        })
+        target:values_set("threads", threads, {expand = false})
+    end)
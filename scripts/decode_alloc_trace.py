@@ -0,0 +1,106 @@
+#!/usr/bin/env python3
+# Copyright Microsoft and CHERIoT Contributors.
+# SPDX-License-Identifier: MIT
+
+"""
+Decode the allocator trace records that the allocator_trace compartment
+writes to the UART.  Each record is a line of the form `alloc-trace:<hex>`,
+where the hex string is a `struct HeapTraceRecord` (see stdlib.h).  Other
+lines in the log are ignored.
+
+By default, this prints one line per record.  With --replay, it instead
+writes the input format for benchmarks/allocation-trace/trace_to_header.py,
+assigning each live object a slot.
+"""
+
+import optparse, struct, sys
+
+Prefix = 'alloc-trace:'
+Record = struct.Struct('<BBHIII')
+Operations = ['allocate', 'free', 'claim', 'release', 'dropped', 'reallocate']
+MaxSlots = 64
+
+
+def records(infile):
+    for line in infile:
+        index = line.find(Prefix)
+        if index < 0:
+            continue
+        data = bytes.fromhex(line[index + len(Prefix):].strip())
+        if len(data) != Record.size:
+            sys.stderr.write(f"Warning: malformed record: {line}")
+            continue
+        yield Record.unpack(data)
+
+
+def operation_name(operation):
+    if operation < len(Operations):
+        return Operations[operation]
+    return f"unknown({operation})"
+
+
+def print_records(infile):
+    start = None
+    print("cycles\toperation\towner\tsize\taddress")
+    for (operation, _, owner, size, address, cycles) in records(infile):
+        if start is None:
+            start = cycles
+        # The cycle counter is truncated to 32 bits, report the time since
+        # the first record modulo that.
+        delta = (cycles - start) & 0xffffffff
+        print(f"{delta}\t{operation_name(operation)}\t{owner}\t{size}\t"
+              f"0x{address:08x}")
+
+
+def print_replay(infile):
+    # Map from address to [slot, outstanding claims, freed by owner]
+    live = {}
+    free_slots = list(range(MaxSlots - 1, -1, -1))
+
+    def retire(address):
+        slot, claims, freed = live[address]
+        if freed and claims == 0:
+            free_slots.append(slot)
+            del live[address]
+
+    for (operation, _, owner, size, address, cycles) in records(infile):
+        name = operation_name(operation)
+        if name == 'dropped':
+            print(f"# {size} records dropped here")
+        elif name == 'allocate':
+            if address == 0:
+                print(f"# failed {size}-byte allocation")
+            elif not free_slots:
+                sys.stderr.write("Warning: too many live objects, skipping "
+                                 f"allocation at 0x{address:08x}\n")
+            else:
+                slot = free_slots.pop()
+                live[address] = [slot, 0, False]
+                print(f"a {slot} {size}")
+        elif address in live:
+            # Objects allocated before the trace started are not replayed.
+            entry = live[address]
+            if name == 'reallocate':
+                print(f"g {entry[0]} {size}")
+            else:
+                print(f"{name[0]} {entry[0]}")
+            if name == 'claim':
+                entry[1] += 1
+            elif name == 'release':
+                entry[1] -= 1
+                retire(address)
+            elif name == 'free':
+                entry[2] = True
+                retire(address)
+
+
+if __name__ == '__main__':
+    parser = optparse.OptionParser(usage="%prog [options] uart.log")
+    parser.add_option('--replay', action='store_true', default=False,
+                      help="emit the allocation trace replay benchmark format")
+    (options, args) = parser.parse_args()
+    infile = open(args[0], 'r') if args else sys.stdin
+    if options.replay:
+        print_replay(infile)
+    else:
+        print_records(infile)
@@ -35,8 +35,11 @@ DIRECTORIES="sdk tests examples"
 # FreeRTOS-Compat headers follow FreeRTOS naming conventions and should be
 # excluded for now.  Eventually they should be included for everything except
 # the identifier naming checks.
-HEADERS=$(find ${DIRECTORIES} -name '*.h' -or -name '*.hh' | grep -v libc++ | grep -v third_party | grep -v 'std.*.h' | grep -v errno.h | grep -v strings.h | grep -v string.h | grep -v -assembly.h | grep -v cdefs.h | grep -v /riscv.h | grep -v inttypes.h | grep -v /cheri-builtins.h | grep -v c++-config | grep -v ctype.h | grep -v switcher.h | grep -v assert.h | grep -v /build/ | grep -v microvium | grep -v FreeRTOS-Compat)
-SOURCES=$(find ${DIRECTORIES} -name '*.cc' | grep -v /build/ | grep -v third_party | grep -v arith64.c)
+HEADERS=$(find ${DIRECTORIES} -name '*.h' -or -name '*.hh' | grep -v libc++ | grep -v third_party | grep -v 'std.*.h' | grep -v errno.h | grep -v strings.h | grep -v string.h | grep -v -assembly.h | grep -v cdefs.h | grep -v /riscv.h | grep -v inttypes.h | grep -v /cheri-builtins.h | grep -v c++-config | grep -v ctype.h | grep -v switcher.h | grep -v assert.h | grep -v /build/ | grep -v microvium | grep -v FreeRTOS-Compat | grep -v host-allocator)
+SOURCES=$(find ${DIRECTORIES} -name '*.cc' | grep -v /build/ | grep -v third_party | grep -v arith64.c | grep -v host-allocator)
+# The host allocator build is compiled for the host, not for CHERIoT, so it is
+# formatted but not checked with clang-tidy.
+HOST_FILES=$(find tests/host-allocator -name '*.h' -or -name '*.hh' -or -name '*.cc' | grep -v /build)
 
 echo Headers: ${HEADERS}
 echo Sources: ${SOURCES}
@@ -50,8 +53,8 @@ if [ $(find . -maxdepth 1 -name 'tidy.fail-*' -size +0 | wc -l) -gt 0 ] ; then
 	exit 1
 fi
 
-${CLANG_FORMAT} -i ${HEADERS} ${SOURCES}
-if git diff --exit-code ${HEADERS} ${SOURCES} ; then
+${CLANG_FORMAT} -i ${HEADERS} ${SOURCES} ${HOST_FILES}
+if git diff --exit-code ${HEADERS} ${SOURCES} ${HOST_FILES} ; then
 	exit 0
 fi
 echo clang-format applied changes
@@ -7,6 +7,7 @@
 #include "compartment-macros.h"
 #include "revoker.h"
 #include <algorithm>
+#include <array>
 #include <cdefs.h>
 #include <cheri.hh>
 #include <cheriot-atomic.hh>
@@ -15,6 +16,8 @@
 #include <ds/pointer.h>
 #include <ds/ring_buffer.h>
 #include <errno.h>
+#include <limits>
+#include <optional>
 #include <stddef.h>
 #include <stdint.h>
 #include <stdlib.h>
@@ -23,6 +26,7 @@
 #include <thread.h>
 
 extern Revocation::Revoker revoker;
+extern Revocation::Policy  revocationPolicy;
 using cheriot::atomic;
 using namespace CHERI;
 
@@ -57,6 +61,8 @@ using BIndex = uint32_t;
 using Binmap = uint32_t;
 static_assert(NSmallBins < utils::bytes2bits(sizeof(Binmap)));
 static_assert(NTreeBins < utils::bytes2bits(sizeof(Binmap)));
+static_assert(NSmallBins == HEAP_STATISTICS_SMALL_BINS);
+static_assert(NTreeBins == HEAP_STATISTICS_TREE_BINS);
 
 // Convert small size header into the actual size in bytes.
 static inline constexpr size_t head2size(SmallSize h)
@@ -100,7 +106,7 @@ static inline BIndex compute_tree_index(size_t s)
 	{
 		return NTreeBins - 1;
 	}
-	k          = utils::bytes2bits(sizeof(x)) - 1 - clz(x);
+	k          = utils::bytes2bits(sizeof(uint32_t)) - 1 - clz(x);
 	BIndex ret = (k << 1) + ((s >> (k + (TreeBinShift - 1)) & 1));
 	Debug::Assert(
 	  ret < NTreeBins, "Return value {} is out of range 0-{}", ret, NTreeBins);
@@ -507,6 +513,97 @@ static inline size_t pad_request(size_t req)
 	return ((req) + sizeof(MChunkHeader) + MallocAlignMask) & ~MallocAlignMask;
 }
 
+/**
+ * Body sizes served by the optional size-class caches.  These are set by the
+ * `allocator_size_classes` property in the board description.  If this is
+ * empty then every allocation goes directly to the bins.
+ */
+#ifdef CHERIOT_ALLOCATOR_SIZE_CLASSES
+constexpr std::array SizeClassBodySizes =
+  std::to_array<size_t>({CHERIOT_ALLOCATOR_SIZE_CLASSES});
+#else
+constexpr std::array<size_t, 0> SizeClassBodySizes{};
+#endif
+// the number of size classes
+constexpr size_t NSizeClasses = SizeClassBodySizes.size();
+static_assert(NSizeClasses < utils::bytes2bits(sizeof(Binmap)));
+static_assert(
+  std::ranges::all_of(SizeClassBodySizes,
+                      [](size_t s) {
+	                      return ((s & MallocAlignMask) == 0) &&
+	                             (s >= MallocAlignment) && (s <= MaxChunkSize);
+                      }),
+  "Size classes must be non-zero multiples of the allocation granule");
+
+/**
+ * When a size-class cache is empty, it is refilled by carving a span of
+ * roughly this many bytes from the bins into chunks of the class size.
+ */
+constexpr size_t SizeClassSpanSize = 512;
+
+// Chunk size (including header) for a size class
+static inline constexpr size_t size_class_chunk_size(BIndex i)
+{
+	return SizeClassBodySizes[i] + sizeof(MChunkHeader);
+}
+
+// Number of chunks carved out of the bins when refilling size class i.
+static inline constexpr size_t size_class_span_chunks(BIndex i)
+{
+	return std::max<size_t>(2, SizeClassSpanSize / size_class_chunk_size(i));
+}
+
+/**
+ * The maximum number of free chunks that a size-class cache may hold.  Chunks
+ * leaving quarantine when the cache is full return to the bins (and are
+ * consolidated with their neighbours) as normal.
+ */
+static inline constexpr size_t size_class_cache_limit(BIndex i)
+{
+	return 2 * size_class_span_chunks(i);
+}
+
+/**
+ * The default number of chunks that the allocator tries to move from
+ * quarantine back to the free bins each time that it frees or allocates.  This
+ * is set by the `allocator-quarantine-drain` build option and can be changed
+ * at run time with `heap_quarantine_drain_budget_set`.
+ */
+#ifndef CHERIOT_ALLOCATOR_QUARANTINE_DRAIN
+#	define CHERIOT_ALLOCATOR_QUARANTINE_DRAIN 4
+#endif
+constexpr size_t QuarantineDrainBudgetDefault =
+  CHERIOT_ALLOCATOR_QUARANTINE_DRAIN;
+
+/**
+ * If true, freed chunks are zeroed when they leave quarantine, rather than in
+ * `heap_free`.  This is set by the `allocator-deferred-zeroing` build option.
+ * It moves the cost of zeroing off the free path and onto quarantine
+ * draining, which often happens later, in bulk, or on an idle thread.
+ */
+#ifndef CHERIOT_ALLOCATOR_DEFERRED_ZEROING
+#	define CHERIOT_ALLOCATOR_DEFERRED_ZEROING false
+#endif
+constexpr bool DeferredZeroing = CHERIOT_ALLOCATOR_DEFERRED_ZEROING;
+/**
+ * Bounds for the quarantine drain budget.  At least 2 is needed for an easy
+ * argument that the allocator stays ahead of its quarantine.  The upper bound
+ * limits how long a single free can hold the allocator lock.
+ */
+constexpr size_t QuarantineDrainBudgetMin = 2;
+constexpr size_t QuarantineDrainBudgetMax = 128;
+static_assert((QuarantineDrainBudgetDefault >= QuarantineDrainBudgetMin) &&
+                (QuarantineDrainBudgetDefault <= QuarantineDrainBudgetMax),
+              "Quarantine drain budget is out of range");
+
+/**
+ * The maximum number of free tree chunks that `mspace_memalign` examines when
+ * looking for one that already contains a suitably aligned region, before it
+ * falls back to allocating enough space to align anywhere.  This bounds the
+ * time that the search holds the allocator lock.
+ */
+constexpr size_t AlignedSearchBudget = 16;
+
 /*
  * Chunk headers are also, sort of, a linked list encoding.  They're not a ring
  * and not exactly a typical list, in that the first and last nodes rely on "out
@@ -859,12 +956,41 @@ class MState
 	public:
 	CHERI::Capability<void> heapStart;
 
+	/**
+	 * The next dedicated arena.  Dedicated arenas are carved out of the shared
+	 * heap for allocator capabilities that request one, and are kept on a
+	 * list so that the allocator can find the arena that contains a pointer.
+	 * This is always null for the shared heap.
+	 */
+	MState *nextArena;
+
 	/**
 	 * Array of objects whose lifetime has been extended by hazard pointers,
 	 * but that have been freed.
 	 */
 	Capability<void *> hazardQuarantine;
 
+	/**
+	 * The valid hazard pointers, sorted by base address.  This is built by
+	 * `hazard_list_begin` while the hazard epoch is odd, which prevents
+	 * threads from publishing new hazard pointers, and so it is accurate
+	 * until the epoch is released.  This is the same size as the hazard
+	 * pointer region.
+	 */
+	Capability<void *> hazardSnapshot;
+
+	/**
+	 * The number of entries in `hazardSnapshot`.
+	 */
+	size_t hazardSnapshotCount = 0;
+
+	/**
+	 * True if `hazardSnapshot` was built under the currently held hazard
+	 * epoch.  If this is false, `hazard_pointer_check` scans the hazard slots
+	 * directly.
+	 */
+	bool hazardSnapshotValid = false;
+
 	using RingSentinel = ds::linked_list::Sentinel<ChunkFreeLink>;
 	/*
 	 * Rings for each small bin size.  Use smallbin_at() for access to
@@ -874,6 +1000,21 @@ class MState
 	/* Tree root nodes for each large bin */
 	TChunk *treebins[NTreeBins];
 
+	/*
+	 * Rings of cached free chunks for each size class.  Use
+	 * size_class_cache_at() for access to ensure proper CHERI bounds!
+	 *
+	 * Chunks in these caches are exactly the size of their class.  Their
+	 * headers remain marked as in use (with no owner) so that neighbouring
+	 * frees do not consolidate with them, which means that they can be handed
+	 * out again without touching the bins.  They have left quarantine, so
+	 * their bodies are zero (apart from the ring) and their shadow bits are
+	 * clear, just like chunks in the bins.
+	 */
+	std::array<RingSentinel, NSizeClasses> sizeClassCaches;
+	/// The number of chunks in each of the `sizeClassCaches`.
+	std::array<uint16_t, NSizeClasses> sizeClassCacheDepth;
+
 	/*
 	 * Chunks may be enqueued into quarantine in at most three different epochs.
 	 * The opening of a fourth epoch necessarily implies that the eldest of the
@@ -890,6 +1031,7 @@ class MState
 	static constexpr size_t QuarantineRings = 2;
 	RingSentinel            quarantinePendingChunks[QuarantineRings];
 	size_t                  quarantinePendingEpoch[QuarantineRings];
+	size_t                  quarantinePendingBytes[QuarantineRings];
 	ds::ring_buffer::Cursors<Debug, QuarantineRings, uint8_t>
 	  quarantinePendingRing;
 
@@ -920,6 +1062,46 @@ class MState
 	size_t heapFreeSize;
 	size_t heapQuarantineSize;
 
+	/**
+	 * Is a batch of frees in progress?  See `free_batch_begin`.
+	 */
+	bool freeBatchOpen;
+
+	/**
+	 * The number of chunks that have been put into quarantine in the current
+	 * batch of frees.
+	 */
+	size_t freeBatchCount;
+
+	/**
+	 * The maximum number of chunks moved out of quarantine by each free or
+	 * allocation.
+	 */
+	size_t quarantineDrainBudget;
+
+	/**
+	 * The longest time, in cycles, that any call to `mspace_qtbin_deqn` has
+	 * taken to dequeue at least one chunk.
+	 */
+	uint32_t quarantineDrainMaxCycles;
+
+	/**
+	 * Log2 histogram of the cycles taken by calls to `mspace_qtbin_deqn` that
+	 * dequeued at least one chunk.
+	 */
+	std::array<uint32_t, HEAP_QUARANTINE_DRAIN_HISTOGRAM_BUCKETS>
+	  quarantineDrainHistogram;
+
+	/**
+	 * The number of free chunks in each small bin and tree bin, and the total
+	 * size of the free chunks in each tree bin.  These are updated as chunks
+	 * are added to and removed from the bins, so that a statistics snapshot
+	 * does not need to walk the free lists.
+	 */
+	std::array<size_t, NSmallBins> smallbinChunks;
+	std::array<size_t, NTreeBins>  treebinChunks;
+	std::array<size_t, NTreeBins>  treebinBytes;
+
 	/**
 	 * The number of entries currently in the `hazardQuarantine` array.
 	 */
@@ -971,6 +1153,12 @@ class MState
 	{
 		return &treebins[i];
 	}
+	// Returns the cache head for size class i.
+	auto size_class_cache_at(BIndex i)
+	{
+		return rederive<RingSentinel>(
+		  CHERI::Capability{&sizeClassCaches[i]}.address());
+	}
 
 	// Mark the bit at smallbin index i.
 	void smallmap_mark(BIndex i)
@@ -1013,22 +1201,41 @@ class MState
 			smallbin_at(i)->reset();
 		}
 		// The treebins should be all nullptrs due to memset earlier.
+		for (BIndex i = 0; i < NSizeClasses; ++i)
+		{
+			size_class_cache_at(i)->reset();
+			sizeClassCacheDepth[i] = 0;
+		}
 
 		// Initialise quarantine
 		for (auto &quarantinePendingChunk : quarantinePendingChunks)
 		{
 			quarantinePendingChunk.reset();
 		}
+		for (auto &pendingBytes : quarantinePendingBytes)
+		{
+			pendingBytes = 0;
+		}
 		quarantinePendingRing.reset();
 		quarantineFinishedSentinel.reset();
 		heapQuarantineSize = 0;
+
+		quarantineDrainBudget    = QuarantineDrainBudgetDefault;
+		quarantineDrainMaxCycles = 0;
+		quarantineDrainHistogram.fill(0);
+
+		smallbinChunks.fill(0);
+		treebinChunks.fill(0);
+		treebinBytes.fill(0);
+		allocationOutcomes.fill(0);
 	}
 
 	/**
-	 * Begin hazard list manipulation.  Returns a guard object that must be
-	 * held until all hazard list manipulation is done.
+	 * Make the hazard epoch odd, which prevents other threads from publishing
+	 * new hazard pointers until `hazard_epoch_release` is called with the
+	 * returned value.  This must be called with the allocator lock held.
 	 */
-	[[nodiscard]] __always_inline auto hazard_list_begin()
+	static uint32_t hazard_epoch_acquire()
 	{
 		auto    *lockWord{MMIO_CAPABILITY(uint32_t, allocator_epoch)};
 		uint32_t epoch = *lockWord >> 16;
@@ -1041,18 +1248,62 @@ class MState
 		// CAS operations.
 		epoch++;
 		*lockWord = (epoch << 16) | thread_id_get();
-		epoch++;
+		return epoch + 1;
+	}
+
+	/**
+	 * Release the hazard epoch acquired with `hazard_epoch_acquire`.
+	 */
+	static void hazard_epoch_release(uint32_t epoch)
+	{
+		auto *lockWord{MMIO_CAPABILITY(uint32_t, allocator_epoch)};
+		*lockWord = (epoch << 16);
+	}
+
+	/**
+	 * Begin hazard list manipulation.  Returns a guard object that must be
+	 * held until all hazard list manipulation is done.
+	 *
+	 * If `buildSnapshot` is true, the hazard pointers are copied into a sorted
+	 * snapshot, which makes each `hazard_pointer_check` a binary search.
+	 * Building the snapshot walks every hazard slot, so this is worthwhile
+	 * only if more than one check will be made, which is the case when the
+	 * hazard quarantine is not empty.  Otherwise, the single check is a
+	 * linear scan of the hazard slots.
+	 *
+	 * Inside a free batch, the caller holds the hazard epoch for the whole
+	 * batch, so the snapshot is built once, on the first free, and reused.
+	 */
+	[[nodiscard]] __always_inline auto hazard_list_begin(bool buildSnapshot)
+	{
 		struct Guard
 		{
-			volatile uint32_t *lockWord;
-			uint32_t           epoch;
+			MState  *state;
+			bool     ownsEpoch;
+			uint32_t epoch;
 			__always_inline ~Guard()
 			{
-				// Release the epoch.
-				*lockWord = (epoch << 16);
+				if (ownsEpoch)
+				{
+					state->hazardSnapshotValid = false;
+					hazard_epoch_release(epoch);
+				}
 			}
 		};
-		return Guard{lockWord, epoch};
+		if (freeBatchOpen)
+		{
+			if (!hazardSnapshotValid)
+			{
+				hazard_snapshot_build();
+			}
+			return Guard{this, false, 0};
+		}
+		uint32_t epoch = hazard_epoch_acquire();
+		if (buildSnapshot)
+		{
+			hazard_snapshot_build();
+		}
+		return Guard{this, true, epoch};
 	}
 
 	/**
@@ -1113,6 +1364,58 @@ class MState
 	                                      AllocationFailureDeallocationNeeded,
 	                                      CHERI::Capability<void>>;
 
+	/**
+	 * The number of times that `mspace_dispatch` has returned each kind of
+	 * `AllocationResult`, indexed by the variant index.
+	 */
+	std::array<uint32_t, std::variant_size_v<AllocationResult>>
+	  allocationOutcomes;
+
+	/**
+	 * Add a snapshot of the state of this heap to `statistics`, so that the
+	 * caller can combine several arenas.  Sizes and counters are summed and
+	 * `largestFreeChunk` is the larger of the two.  This copies counters that
+	 * are maintained incrementally and so is cheap enough to do with the
+	 * allocator lock held.
+	 */
+	void statistics_add(HeapStatistics &statistics)
+	{
+		statistics.totalSize += heapTotalSize;
+		statistics.freeSize += heapFreeSize;
+		statistics.quarantineSize += heapQuarantineSize;
+		statistics.largestFreeChunk =
+		  std::max(statistics.largestFreeChunk, largest_free_chunk_size());
+		statistics.hazardQuarantineOccupancy += hazardQuarantineOccupancy;
+		for (size_t i = 0; i < smallbinChunks.size(); i++)
+		{
+			statistics.smallBinChunks[i] += smallbinChunks[i];
+		}
+		for (size_t i = 0; i < treebinChunks.size(); i++)
+		{
+			statistics.treeBinChunks[i] += treebinChunks[i];
+			statistics.treeBinBytes[i] += treebinBytes[i];
+		}
+		// Indexes are in the order of the `AllocationResult` variant.
+		statistics.failuresPermanent += allocationOutcomes[0];
+		statistics.failuresRevocationNeeded += allocationOutcomes[1];
+		statistics.failuresDeallocationNeeded += allocationOutcomes[2];
+		statistics.allocations += allocationOutcomes[3];
+	}
+
+	/**
+	 * Try to allocate `bytes` bytes, charging them to `quota` and recording
+	 * the outcome.  See `mspace_dispatch_internal` for details.
+	 */
+	AllocationResult mspace_dispatch(size_t   bytes,
+	                                 size_t  &quota,
+	                                 uint16_t identifier,
+	                                 bool     isSealed = false)
+	{
+		auto ret = mspace_dispatch_internal(bytes, quota, identifier, isSealed);
+		allocationOutcomes[ret.index()]++;
+		return ret;
+	}
+
 	/**
 	 * @brief Adjust size and alignment to ensure precise representability, and
 	 * paint the shadow bit for the header to detect valid free().
@@ -1128,14 +1431,14 @@ class MState
 	 *
 	 * @return User pointer if request can be satisfied, nullptr otherwise.
 	 */
-	AllocationResult mspace_dispatch(size_t   bytes,
-	                                 size_t  &quota,
-	                                 uint16_t identifier,
-	                                 bool     isSealed = false)
+	AllocationResult mspace_dispatch_internal(size_t   bytes,
+	                                          size_t  &quota,
+	                                          uint16_t identifier,
+	                                          bool     isSealed)
 	{
 		if (!hazard_quarantine_is_empty())
 		{
-			auto guard = hazard_list_begin();
+			auto guard = hazard_list_begin(true);
 			hazard_pointers_recheck();
 		}
 		size_t alignSize =
@@ -1260,6 +1563,120 @@ class MState
 		return bodySize;
 	}
 
+	/**
+	 * Try to grow the in-use `chunk` in place so that it can hold `bytes`
+	 * bytes, by absorbing (part of) the free chunk that follows it.  The
+	 * `quota` is charged for the additional space.
+	 *
+	 * Returns a capability to the whole of the grown object on success.
+	 * Returns nullptr and leaves the chunk unmodified if the successor is not
+	 * free or not large enough, if the grown object would not be precisely
+	 * representable at its current base, or if the quota is insufficient.
+	 */
+	CHERI::Capability<void>
+	mspace_grow_in_place(MChunkHeader &chunk, size_t bytes, size_t &quota)
+	{
+		size_t alignSize =
+		  (CHERI::representable_length(bytes) + MallocAlignMask) &
+		  ~MallocAlignMask;
+		if (alignSize == 0)
+		{
+			return nullptr;
+		}
+		CHERI::Capability<void> body{chunk.body()};
+		// The base can't move, so it must be sufficiently aligned for the new
+		// length.
+		if ((body.address() & ~CHERI::representable_alignment_mask(bytes)) != 0)
+		{
+			return nullptr;
+		}
+		size_t        nb       = pad_request(alignSize);
+		size_t        oldSize  = chunk.size_get();
+		MChunkHeader *next     = chunk.cell_next();
+		size_t        nextSize = next->size_get();
+		if (next->is_in_use() || (oldSize + nextSize < nb))
+		{
+			return nullptr;
+		}
+		size_t remainder = oldSize + nextSize - nb;
+		size_t newSize = (remainder >= MinChunkSize) ? nb : oldSize + nextSize;
+		if (newSize - oldSize > quota)
+		{
+			return nullptr;
+		}
+
+		/*
+		 * Absorb the successor.  Its body is zero apart from the free-list
+		 * metadata, which unlink_chunk() clears, and we clear its header, so
+		 * the new space in this object is entirely zero.
+		 */
+		unlink_chunk(MChunk::from_header(next), nextSize);
+		heapFreeSize -= nextSize;
+		ds::linked_list::unsafe_remove_link(&chunk, next);
+		next->clear();
+		// next is no longer a header. Clear the shadow bit.
+		revoker.shadow_paint_single(CHERI::Capability{next}.address(), false);
+		chunk.mark_in_use();
+
+		// Give back anything that we don't need.
+		if (remainder >= MinChunkSize)
+		{
+			mspace_free_internal(chunk.split(nb));
+		}
+		ok_in_use_chunk(&chunk);
+
+		quota -= chunk.size_get() - oldSize;
+		body.bounds() = chunk_body_size(chunk);
+		return body;
+	}
+
+	/**
+	 * Returns a capability to the hazard pointer region.  This may be walked
+	 * only while the hazard epoch is odd.
+	 */
+	static Capability<void *> hazard_pointers()
+	{
+		return const_cast<void **>(MMIO_CAPABILITY_WITH_PERMISSIONS(
+		  void *, hazard_pointers, true, true, true, false));
+	}
+
+	/**
+	 * Copy the valid hazard pointers into `hazardSnapshot`, sorted by base
+	 * address.  Most hazard slots are empty, so the snapshot is usually much
+	 * smaller than the hazard pointer region and each subsequent lookup is a
+	 * binary search, rather than a walk of every thread's hazard slots.
+	 *
+	 * This must be called after the hazard epoch has been made odd.
+	 */
+	void hazard_snapshot_build()
+	{
+		// It is now safe to walk the hazard list.
+		Capability<void *> hazards  = hazard_pointers();
+		size_t             pointers = hazards.length() / sizeof(void *);
+		size_t             count    = 0;
+		for (size_t i = 0; i < pointers; i++)
+		{
+			Capability<void> hazardPointer{hazards[i]};
+			if (!hazardPointer.is_valid())
+			{
+				continue;
+			}
+			// Insertion sort: there are at most two hazard pointers per
+			// thread and typically very few are in use.
+			size_t insert = count++;
+			while ((insert > 0) &&
+			       (Capability<void>{hazardSnapshot[insert - 1]}.base() >
+			        hazardPointer.base()))
+			{
+				hazardSnapshot[insert] = hazardSnapshot[insert - 1];
+				insert--;
+			}
+			hazardSnapshot[insert] = hazardPointer;
+		}
+		hazardSnapshotCount = count;
+		hazardSnapshotValid = true;
+	}
+
 	/**
 	 * Check whether `allocation` is in the hazard list.  Returns true if it is.
 	 *
@@ -1268,20 +1685,53 @@ class MState
 	 */
 	bool hazard_pointer_check(Capability<void> allocation)
 	{
-		// It is now safe to walk the hazard list.
-		Capability<void *> hazards =
-		  const_cast<void **>(MMIO_CAPABILITY_WITH_PERMISSIONS(
-		    void *, hazard_pointers, true, true, true, false));
-		size_t pointers = hazards.length() / sizeof(void *);
-		for (size_t i = 0; i < pointers; i++)
+		if (!hazardSnapshotValid)
 		{
-			Capability hazardPointer{hazards[i]};
-			if (hazardPointer.is_valid() &&
-			    hazardPointer.is_subset_of(allocation))
+			Capability<void *> hazards  = hazard_pointers();
+			size_t             pointers = hazards.length() / sizeof(void *);
+			for (size_t i = 0; i < pointers; i++)
 			{
-				Debug::log("Found hazard pointer for {} (thread: {})",
-				           allocation,
-				           ((i / 2) + 1));
+				Capability<void> hazardPointer{hazards[i]};
+				if (hazardPointer.is_valid() &&
+				    hazardPointer.is_subset_of(allocation))
+				{
+					Debug::log("Found hazard pointer for {} (thread: {})",
+					           allocation,
+					           ((i / 2) + 1));
+					return true;
+				}
+			}
+			return false;
+		}
+		ptraddr_t base = allocation.base();
+		ptraddr_t top  = allocation.top();
+		// Find the first hazard pointer that does not start below the
+		// allocation.  Any hazard pointer that is a subset of the allocation
+		// must be at or after this point.
+		size_t lower = 0;
+		size_t upper = hazardSnapshotCount;
+		while (lower < upper)
+		{
+			size_t middle = (lower + upper) / 2;
+			if (Capability<void>{hazardSnapshot[middle]}.base() < base)
+			{
+				lower = middle + 1;
+			}
+			else
+			{
+				upper = middle;
+			}
+		}
+		for (size_t i = lower; i < hazardSnapshotCount; i++)
+		{
+			Capability<void> hazardPointer{hazardSnapshot[i]};
+			if (hazardPointer.base() >= top)
+			{
+				break;
+			}
+			if (hazardPointer.is_subset_of(allocation))
+			{
+				Debug::log("Found hazard pointer for {}", allocation);
 				return true;
 			}
 		}
@@ -1358,7 +1808,9 @@ class MState
 			// Set the hazard epoch to odd so that no other threads can
 			// successfully add things to the hazard list until we're done.
 			// The epoch will be incremented to even at the end of this scope.
-			auto guard = hazard_list_begin();
+			// Each object in the hazard quarantine needs a check, in addition
+			// to this one, so a snapshot pays off only if there are some.
+			auto guard = hazard_list_begin(hazardQuarantineOccupancy > 0);
 
 			// Free any objects whose lifetimes were extended by hazards,
 			// skipping freeing this one to avoid a double free.
@@ -1401,7 +1853,18 @@ class MState
 		 */
 		auto epoch = revoker.system_epoch_get();
 
-		capaligned_zero(mem, bodySize);
+		/*
+		 * With deferred zeroing, the chunk is zeroed when it leaves
+		 * quarantine.  Nothing can use the stale contents in the meantime:
+		 * any capability that is loaded to this chunk will have its tag
+		 * cleared by the load barrier, and the revoker will scan the chunk
+		 * (and clear any capabilities in it that point to quarantined memory)
+		 * because it is still in use as far as the free lists are concerned.
+		 */
+		if constexpr (!DeferredZeroing)
+		{
+			capaligned_zero(mem, bodySize);
+		}
 
 		/*
 		 * We do not need to store lists for odd epochs (that is, things freed
@@ -1418,16 +1881,69 @@ class MState
 		heapQuarantineSize += chunk.size_get();
 
 		/*
-		 * Perhaps there has been some progress on revocation.  Dequeue 3 times.
-		 * 3 is chosen randomly. At least 2 is needed for easy argument that the
-		 * allocator stays ahead of its quarantine.
+		 * If this is part of a batch, the quarantine maintenance below is done
+		 * once at the end of the batch.
 		 */
-		mspace_qtbin_deqn(3);
+		if (freeBatchOpen)
+		{
+			freeBatchCount++;
+			return isDoubleFree ? -EINVAL : 0;
+		}
+
+		/*
+		 * Perhaps there has been some progress on revocation.  The budget is
+		 * at least 2, which gives an easy argument that the allocator stays
+		 * ahead of its quarantine.
+		 */
+		mspace_qtbin_deqn(quarantineDrainBudget);
 		mspace_bg_revoker_kick();
 
 		return isDoubleFree ? -EINVAL : 0;
 	}
 
+	/**
+	 * Begin a batch of frees.  `free_batch_end` must be called once all of
+	 * the frees in the batch are done.
+	 *
+	 * The caller must hold the hazard epoch, from `hazard_epoch_acquire`,
+	 * until the batch ends, so that the hazard snapshot built on the first
+	 * free in the batch stays accurate for the rest of it.
+	 *
+	 * While the batch is open, `mspace_free` puts chunks into quarantine but
+	 * does not try to dequeue anything or kick the revoker.  The caller does
+	 * that once, at the end of the batch, so a batch of frees causes at most
+	 * one revoker kick, however many arenas it touches.
+	 */
+	__always_inline void free_batch_begin()
+	{
+		Debug::Assert(!freeBatchOpen, "Nested free batches are not supported");
+		freeBatchOpen  = true;
+		freeBatchCount = 0;
+	}
+
+	/**
+	 * Finish a batch of frees started with `free_batch_begin`.  This does the
+	 * quarantine maintenance that `mspace_free` skipped.  We dequeue two chunks
+	 * for each chunk that the batch added to quarantine, which preserves the
+	 * argument that the allocator stays ahead of its quarantine.
+	 *
+	 * This does not kick the revoker.  It returns the urgency with which this
+	 * MState wants a sweep, if it added anything to quarantine, so that the
+	 * caller can issue a single kick for all of the arenas in the batch.
+	 */
+	std::optional<Revocation::SweepUrgency> free_batch_end()
+	{
+		freeBatchOpen       = false;
+		hazardSnapshotValid = false;
+		if (freeBatchCount == 0)
+		{
+			return std::nullopt;
+		}
+		mspace_qtbin_deqn(2 * freeBatchCount);
+		freeBatchCount = 0;
+		return bg_revoker_urgency();
+	}
+
 	/**
 	 * Given a pointer that is probably in an allocation, try to find the start
 	 * of that allocation.  Returns the header if this is a valid pointer into
@@ -1476,8 +1992,33 @@ class MState
 	 */
 	__always_inline bool quarantine_dequeue()
 	{
-		// 4 chosen by fair die roll.
-		return mspace_qtbin_deqn(4) > 0;
+		return quarantine_drain() > 0;
+	}
+
+	/**
+	 * Try to dequeue up to the drain budget's worth of objects from quarantine.
+	 *
+	 * Returns the number of objects dequeued.
+	 */
+	__always_inline int quarantine_drain()
+	{
+		return mspace_qtbin_deqn(quarantineDrainBudget);
+	}
+
+	/**
+	 * Set the number of chunks that each free or allocation tries to move out
+	 * of quarantine.  Returns 0 on success or -EINVAL if the budget is out of
+	 * range.
+	 */
+	int quarantine_drain_budget_set(size_t budget)
+	{
+		if ((budget < QuarantineDrainBudgetMin) ||
+		    (budget > QuarantineDrainBudgetMax))
+		{
+			return -EINVAL;
+		}
+		quarantineDrainBudget = budget;
+		return 0;
 	}
 
 	private:
@@ -1508,10 +2049,29 @@ class MState
 
 	static void capaligned_zero(void *start, size_t size)
 	{
-		capaligned_range_do(start, size, [](void **word) {
-			*word = nullptr;
-			return false;
-		});
+		Debug::Assert((size & (sizeof(void *) - 1)) == 0,
+		              "Cap range is not aligned");
+		void **word = static_cast<void **>(start);
+		void **end  = word + size / sizeof(void *);
+#ifdef __CHERI_PURE_CAPABILITY__
+		// Zero 32 bytes at a time, as the switcher's `zero_stack` does.  This
+		// is written in assembly so that the compiler does not turn it into
+		// a call to memset.  Host builds use the loop below for everything.
+		while (end - word >= 4)
+		{
+			__asm__ volatile("csc cnull, 0(%0)\n"
+			                 "csc cnull, 8(%0)\n"
+			                 "csc cnull, 16(%0)\n"
+			                 "csc cnull, 24(%0)\n" ::"C"(word)
+			                 : "memory");
+			word += 4;
+		}
+#endif
+		// Zero any tail of up to three capabilities.
+		while (word < end)
+		{
+			*word++ = nullptr;
+		}
 	}
 
 	/**
@@ -1884,6 +2444,40 @@ class MState
 	}
 
 	private:
+	/**
+	 * Tell the revoker that the chunk `p` is leaving the free lists and so may
+	 * come to hold capabilities that it must find.
+	 *
+	 * This is a template so that the call is dependent and is discarded,
+	 * rather than rejected, for revokers without a capability summary.
+	 */
+	template<typename R = Revocation::Revoker>
+	void capability_summary_add(MChunkHeader *p)
+	{
+		if constexpr (Revocation::SupportsCapabilitySummary<R>)
+		{
+			static_cast<R &>(revoker).capabilities_may_exist(
+			  CHERI::Capability{p}.address(),
+			  CHERI::Capability<MChunkHeader>{p->cell_next()}.address());
+		}
+	}
+
+	/**
+	 * Tell the revoker that the chunk `p` is entering the free lists.  Free
+	 * chunks are zero apart from their free-list metadata, which never points
+	 * to quarantined memory, so the revoker does not need to scan them.
+	 */
+	template<typename R = Revocation::Revoker>
+	void capability_summary_remove(MChunkHeader *p)
+	{
+		if constexpr (Revocation::SupportsCapabilitySummary<R>)
+		{
+			static_cast<R &>(revoker).capabilities_absent(
+			  CHERI::Capability{p}.address(),
+			  CHERI::Capability<MChunkHeader>{p->cell_next()}.address());
+		}
+	}
+
 	/*
 	 * Link a free chunk into a smallbin.
 	 *
@@ -1908,6 +2502,8 @@ class MState
 		 * generate redundant stores.
 		 */
 		bin->append_emplace(&(new (p->body()) MChunk())->ring);
+		smallbinChunks[i]++;
+		capability_summary_remove(p);
 	}
 
 	/// Unlink a chunk from a smallbin.
@@ -1955,6 +2551,8 @@ class MState
 		}
 
 		p->metadata_clear();
+		smallbinChunks[i]--;
+		capability_summary_add(pHeader);
 	}
 
 	// Unlink the first chunk from a smallbin.
@@ -1978,6 +2576,7 @@ class MState
 		}
 
 		p->metadata_clear();
+		smallbinChunks[i]--;
 
 		MChunkHeader *pHeader = MChunkHeader::from_body(p);
 		Debug::Assert(pHeader->size_get() == small_index2size(i),
@@ -1986,6 +2585,7 @@ class MState
 		              pHeader->size_get(),
 		              small_index2size(i));
 
+		capability_summary_add(pHeader);
 		return pHeader;
 	}
 
@@ -1999,6 +2599,9 @@ class MState
 		TChunk **head;
 		BIndex   i = compute_tree_index(s);
 		head       = treebin_at(i);
+		treebinChunks[i]++;
+		capability_summary_remove(xHeader);
+		treebinBytes[i] += s;
 
 		if (!is_treemap_marked(i))
 		{
@@ -2071,6 +2674,9 @@ class MState
 	{
 		TChunk *xp = x->parent;
 		TChunk *r;
+		treebinChunks[x->index]--;
+		treebinBytes[x->index] -= MChunkHeader::from_body(x)->size_get();
+		capability_summary_add(MChunkHeader::from_body(x));
 		if (!ds::linked_list::is_singleton(&x->mchunk.ring))
 		{
 			TChunk *f = TChunk::from_ring(x->mchunk.ring.cell_next());
@@ -2174,6 +2780,39 @@ class MState
 		x->metadata_clear();
 	}
 
+	/**
+	 * Returns the size of the largest free chunk in the bins (including its
+	 * header), or 0 if the bins are empty.  Chunks held in size-class caches
+	 * are not considered.
+	 *
+	 * In a tree bin, every chunk in a node's right subtree is larger than every
+	 * chunk in its left subtree, so the largest chunk is on the path that
+	 * prefers right children.  This walk is bounded by the depth of the tree.
+	 */
+	size_t largest_free_chunk_size()
+	{
+		if (treemap != 0)
+		{
+			BIndex i =
+			  utils::bytes2bits(sizeof(Binmap)) - 1 - __builtin_clz(treemap);
+			TChunk *t       = *treebin_at(i);
+			size_t  largest = 0;
+			while (t != nullptr)
+			{
+				largest =
+				  std::max(largest, MChunkHeader::from_body(t)->size_get());
+				t = (t->child[1] != nullptr) ? t->child[1] : t->child[0];
+			}
+			return largest;
+		}
+		if (smallmap != 0)
+		{
+			return small_index2size(utils::bytes2bits(sizeof(Binmap)) - 1 -
+			                        __builtin_clz(smallmap));
+		}
+		return 0;
+	}
+
 	/**
 	 * Throw p into the correct bin based on s.  Initializes the linkages of p.
 	 */
@@ -2348,6 +2987,71 @@ class MState
 		return tmalloc_smallest(t, nb);
 	}
 
+	/**
+	 * Look in the tree bins for a free chunk that can hold an `nb`-byte chunk
+	 * whose body is aligned to `alignment`, leaving either no leading space or
+	 * enough leading space to return to the free lists.  The fallback in
+	 * `mspace_memalign` needs a chunk of `nb + alignment + MinChunkSize`
+	 * bytes, which for large CHERI alignments can be much bigger than any
+	 * chunk that would do.
+	 *
+	 * Bins are searched from the smallest that could hold `nb` upwards,
+	 * examining at most `AlignedSearchBudget` chunks.  The returned chunk has
+	 * had its linkages cleared and is marked as in use, but has not been
+	 * split: the caller must trim it.
+	 */
+	MChunkHeader *tmalloc_aligned(size_t nb, size_t alignment)
+	{
+		// The leading space before an aligned body, following the same rules
+		// as mspace_memalign.
+		auto leadingPad = [&](MChunkHeader *header) {
+			size_t pad = -header->body().address() & (alignment - 1);
+			if ((pad != 0) && (pad < MinChunkSize))
+			{
+				pad += alignment;
+			}
+			return pad;
+		};
+		size_t  visited = 0;
+		TChunk *stack[AlignedSearchBudget];
+		Binmap  bins =
+		  ds::bits::above_or_least(idx2bit(compute_tree_index(nb))) & treemap;
+		for (; (bins != 0) && (visited < AlignedSearchBudget);
+		     bins &= bins - 1)
+		{
+			size_t depth   = 0;
+			stack[depth++] = *treebin_at(bit2idx(ds::bits::isolate_least(bins)));
+			while ((depth > 0) && (visited < AlignedSearchBudget))
+			{
+				TChunk *t = stack[--depth];
+				// Check the tree node and the ring of equal-sized chunks
+				// hanging off it.
+				TChunk *candidate = t;
+				do
+				{
+					auto header = MChunkHeader::from_body(candidate);
+					if (header->size_get() >= nb + leadingPad(header))
+					{
+						unlink_large_chunk(candidate);
+						header->mark_in_use();
+						return header;
+					}
+					visited++;
+					candidate =
+					  TChunk::from_ring(candidate->mchunk.ring.cell_next());
+				} while ((candidate != t) && (visited < AlignedSearchBudget));
+				for (TChunk *child : t->child)
+				{
+					if ((child != nullptr) && (depth < AlignedSearchBudget))
+					{
+						stack[depth++] = child;
+					}
+				}
+			}
+		}
+		return nullptr;
+	}
+
 	/**
 	 * @brief Allocate a small request from a tree bin. It should return a valid
 	 * chunk successfully as long as one tree exists, because all tree chunks
@@ -2452,6 +3156,8 @@ class MState
 		{
 			quarantine_finished_get()->append(qring->take_all());
 		}
+		revocationPolicy.reclaimed(quarantinePendingBytes[oldestPendingIx]);
+		quarantinePendingBytes[oldestPendingIx] = 0;
 
 		quarantinePendingRing.head_advance();
 	}
@@ -2483,44 +3189,71 @@ class MState
 			Debug::Assert(opened, "Failed to open epoch ring");
 
 			quarantinePendingEpoch[youngestPendingIx] = epoch;
+			quarantinePendingBytes[youngestPendingIx] = 0;
 		}
 
 		quarantine_pending_get(youngestPendingIx)
 		  ->append_emplace(&(new (header->body()) MChunk())->ring);
+		quarantinePendingBytes[youngestPendingIx] += header->size_get();
 	}
 
 	/**
-	 * @brief Start revocation if this MState has accumulated enough things in
-	 * quarantine or the free space is too low.
-	 * @param Force force start a revocation regardless of heuristics
-	 *
-	 * @return true if there are things in the quarantine
+	 * Returns the urgency with which this MState wants a revocation sweep, or
+	 * nothing if it has not accumulated enough in quarantine to need one and
+	 * its free space is not too low.
 	 */
-	template<bool Force = false>
-	bool mspace_bg_revoker_kick()
+	std::optional<Revocation::SweepUrgency> bg_revoker_urgency()
 	{
 		if (heapQuarantineSize == 0)
 		{
-			return 0;
+			return std::nullopt;
 		}
 		/*
 		 * Async revocation can run in the background, but sync revocation
 		 * blocks and we don't want it to sweep too early, so we have different
 		 * quarantine thresholds here.
 		 */
+		bool lowMemory = heapFreeSize < heapTotalSize / 8;
 		bool shouldKick;
 		if constexpr (Revocation::Revoker::IsAsynchronous)
 		{
-			shouldKick = heapQuarantineSize > heapFreeSize / 4 ||
-			             heapFreeSize < heapTotalSize / 8;
+			shouldKick = heapQuarantineSize > heapFreeSize / 4 || lowMemory;
 		}
 		else
 		{
 			shouldKick = heapQuarantineSize > heapFreeSize / 4 * 3;
 		}
-		if (Force || shouldKick)
+		if (!shouldKick)
+		{
+			return std::nullopt;
+		}
+		return lowMemory ? Revocation::SweepUrgency::LowMemory
+		                 : Revocation::SweepUrgency::Background;
+	}
+
+	/**
+	 * @brief Ask the revocation policy to start revocation if this MState has
+	 * accumulated enough things in quarantine or the free space is too low.
+	 * @param Force force start a revocation regardless of heuristics, because
+	 * an allocation is blocked on memory in quarantine
+	 *
+	 * @return true if there are things in the quarantine
+	 */
+	template<bool Force = false>
+	bool mspace_bg_revoker_kick()
+	{
+		if (heapQuarantineSize == 0)
+		{
+			return 0;
+		}
+		if (Force)
 		{
-			revoker.system_bg_revoker_kick();
+			revocationPolicy.kick(
+			  revoker, Revocation::SweepUrgency::AllocationBlocked);
+		}
+		else if (auto urgency = bg_revoker_urgency())
+		{
+			revocationPolicy.kick(revoker, *urgency);
 		}
 
 		return 1;
@@ -2533,8 +3266,9 @@ class MState
 	 */
 	int mspace_qtbin_deqn(size_t loops)
 	{
-		int  dequeued   = 0;
-		auto quarantine = quarantine_finished_get();
+		int      dequeued   = 0;
+		auto     quarantine = quarantine_finished_get();
+		uint64_t start      = rdcycle64();
 
 		for (size_t i = 0; i < loops; i++)
 		{
@@ -2558,13 +3292,22 @@ class MState
 			 * Detach from quarantine and zero the ring linkage; the rest of
 			 * this chunk, apart from its header, is also zero, thanks to the
 			 * capaligned_zero() done in mspace_free() before the chunk was
-			 * put into quarantine.  mspace_free_internal() will either rebuild
-			 * this cons cell, if it cannot consolidate backwards, or it will
-			 * discard the idea that this is a link cell at all by detaching
-			 * and clearing fore's header.
+			 * put into quarantine (or done here, with deferred zeroing).
+			 * mspace_free_internal() will either rebuild this cons cell, if it
+			 * cannot consolidate backwards, or it will discard the idea that
+			 * this is a link cell at all by detaching and clearing fore's
+			 * header.
 			 */
 			ds::linked_list::unsafe_remove(&fore->ring);
-			fore->metadata_clear();
+			if constexpr (DeferredZeroing)
+			{
+				capaligned_zero(fore,
+				                foreHeader->size_get() - sizeof(MChunkHeader));
+			}
+			else
+			{
+				fore->metadata_clear();
+			}
 
 			heapQuarantineSize -= foreHeader->size_get();
 
@@ -2572,12 +3315,36 @@ class MState
 			revoker.shadow_paint_range<false>(foreHeader->body().address(),
 			                                  foreHeader->cell_next());
 
-			mspace_free_internal(foreHeader);
+			if (!size_class_cache_push(foreHeader))
+			{
+				mspace_free_internal(foreHeader);
+			}
 			dequeued++;
 		}
+		if (dequeued > 0)
+		{
+			quarantine_drain_record(rdcycle64() - start);
+		}
 		return dequeued;
 	}
 
+	/**
+	 * Record the time taken by a call to `mspace_qtbin_deqn` in the worst-case
+	 * counter and the histogram.
+	 */
+	void quarantine_drain_record(uint64_t cycles)
+	{
+		uint32_t clamped = static_cast<uint32_t>(
+		  std::min<uint64_t>(cycles, std::numeric_limits<uint32_t>::max()));
+		quarantineDrainMaxCycles = std::max(quarantineDrainMaxCycles, clamped);
+		// Bucket i counts drains that took [2^i, 2^(i+1)) cycles, the last
+		// bucket also counts anything longer.
+		size_t bucket = utils::bytes2bits(sizeof(clamped)) - 1 -
+		                __builtin_clz(clamped | 1);
+		bucket = std::min(bucket, quarantineDrainHistogram.size() - 1);
+		quarantineDrainHistogram[bucket]++;
+	}
+
 	/**
 	 * Successful end to mspace_malloc()
 	 */
@@ -2611,17 +3378,210 @@ class MState
 		return p->body();
 	}
 
+	/**
+	 * Find the index of the size class whose chunks are exactly `nb` bytes.
+	 * Returns false if there is no such size class.
+	 */
+	static bool size_class_index(size_t nb, BIndex &index)
+	{
+		for (BIndex i = 0; i < NSizeClasses; i++)
+		{
+			if (size_class_chunk_size(i) == nb)
+			{
+				index = i;
+				return true;
+			}
+		}
+		return false;
+	}
+
+	/**
+	 * Add an in-use chunk of exactly the right size to the cache for size
+	 * class `i`.  Initializes the linkages of p.
+	 */
+	void size_class_cache_insert(BIndex i, MChunkHeader *p)
+	{
+		ok_in_use_chunk(p);
+		// Cached chunks have no owner, so heap_free_all will never find them.
+		p->ownerID        = 0;
+		p->isSealedObject = false;
+		size_class_cache_at(i)->append_emplace(
+		  &(new (p->body()) MChunk())->ring);
+		sizeClassCacheDepth[i]++;
+	}
+
+	/**
+	 * Put a chunk that has just left quarantine onto the cache for its size
+	 * class, if it has one and that cache is not full.  The chunk must still
+	 * be marked as in use and its shadow bits must be clear.
+	 *
+	 * Returns true if the chunk was cached, false if the caller must return it
+	 * to the bins.
+	 */
+	bool size_class_cache_push(MChunkHeader *p)
+	{
+		BIndex i;
+		if (!size_class_index(p->size_get(), i) ||
+		    (sizeClassCacheDepth[i] >= size_class_cache_limit(i)))
+		{
+			return false;
+		}
+		heapFreeSize += p->size_get();
+		size_class_cache_insert(i, p);
+		return true;
+	}
+
+	/**
+	 * Return a chunk that is counted as free but is marked as in use (either
+	 * from a size-class cache or left over from carving a span) to the bins.
+	 */
+	void size_class_chunk_release(MChunkHeader *p)
+	{
+		// mspace_free_internal will count this as free again.
+		heapFreeSize -= p->size_get();
+		mspace_free_internal(p);
+	}
+
+	/**
+	 * Refill the (empty) cache for size class `i` by carving a span out of the
+	 * bins.  Returns true if the cache is now non-empty.
+	 */
+	bool size_class_cache_refill(BIndex i)
+	{
+		size_t nb     = size_class_chunk_size(i);
+		size_t chunks = size_class_span_chunks(i);
+		auto   p      = mspace_malloc_bins(nb * chunks - sizeof(MChunkHeader));
+		if (p == nullptr)
+		{
+			return false;
+		}
+		/*
+		 * The span is in use and its body is zero, so each split produces a
+		 * new in-use header (with its shadow bit painted) and a zero body.
+		 * The span is still counted as free space: mspace_malloc_bins does
+		 * not touch heapFreeSize.
+		 */
+		for (size_t n = 1; n < chunks; n++)
+		{
+			auto r = p->split(nb);
+			size_class_cache_insert(i, p);
+			p = r;
+		}
+		/*
+		 * The bins may have given us up to MinChunkSize - MallocAlignment
+		 * more bytes than we asked for, in which case the last chunk is not
+		 * the right size for this cache.
+		 */
+		if (p->size_get() == nb)
+		{
+			size_class_cache_insert(i, p);
+		}
+		else
+		{
+			size_class_chunk_release(p);
+		}
+		return true;
+	}
+
+	/**
+	 * Take a chunk of exactly `nb` bytes from a size-class cache, refilling
+	 * the cache if necessary.  Returns nullptr if `nb` is not the chunk size
+	 * for any size class or if the cache could not be refilled.
+	 *
+	 * The chunk holding the returned memory has had its linkages cleared.
+	 */
+	MChunkHeader *size_class_take(size_t nb)
+	{
+		BIndex i;
+		if (!size_class_index(nb, i))
+		{
+			return nullptr;
+		}
+		auto cache = size_class_cache_at(i);
+		if (cache->is_empty() && !size_class_cache_refill(i))
+		{
+			return nullptr;
+		}
+		MChunk *p = MChunk::from_ring(cache->unsafe_take_first());
+		sizeClassCacheDepth[i]--;
+		p->metadata_clear();
+		auto pHeader = MChunkHeader::from_body(p);
+		ok_malloced_chunk(pHeader, nb);
+		return pHeader;
+	}
+
+	/**
+	 * Return every chunk in the size-class caches to the bins so that they
+	 * can be consolidated.  This is used when an allocation fails, in case the
+	 * caches are holding on to memory that would satisfy it.
+	 *
+	 * Returns true if any chunks were released.
+	 */
+	bool size_class_caches_flush()
+	{
+		bool released = false;
+		for (BIndex i = 0; i < NSizeClasses; i++)
+		{
+			auto cache = size_class_cache_at(i);
+			while (!cache->is_empty())
+			{
+				MChunk *p = MChunk::from_ring(cache->unsafe_take_first());
+				p->metadata_clear();
+				size_class_chunk_release(MChunkHeader::from_body(p));
+				released = true;
+			}
+			sizeClassCacheDepth[i] = 0;
+		}
+		return released;
+	}
+
 	/**
 	 * This is the only function that takes memory from the free list. All other
 	 * wrappers that take memory must call this in the end.
 	 */
 	MChunkHeader *mspace_malloc_internal(size_t bytes)
 	{
-		size_t nb;
-
 		/* Move O(1) nodes from quarantine, if any are available */
 		quarantine_dequeue();
 
+		if constexpr (NSizeClasses > 0)
+		{
+			size_t nb = (bytes < MinRequest) ? MinChunkSize : pad_request(bytes);
+			if (auto p = size_class_take(nb))
+			{
+				return p;
+			}
+		}
+
+		auto p = mspace_malloc_bins(bytes);
+
+		if constexpr (NSizeClasses > 0)
+		{
+			if ((p == nullptr) && size_class_caches_flush())
+			{
+				p = mspace_malloc_bins(bytes);
+			}
+		}
+
+		if (p == nullptr)
+		{
+			/*
+			 * Exhausted all allocation options. Force start a revocation or
+			 * continue with synchronous revocation.
+			 */
+			mspace_bg_revoker_kick<true>();
+		}
+		return p;
+	}
+
+	/**
+	 * Take memory from the small bins or the tree bins.  Only
+	 * mspace_malloc_internal and the size-class caches should call this.
+	 */
+	MChunkHeader *mspace_malloc_bins(size_t bytes)
+	{
+		size_t nb;
+
 		if (bytes <= MaxSmallRequest)
 		{
 			BIndex idx;
@@ -2675,11 +3635,6 @@ class MState
 			}
 		}
 
-		/*
-		 * Exhausted all allocation options. Force start a revocation or
-		 * continue with synchronous revocation.
-		 */
-		mspace_bg_revoker_kick<true>();
 		return nullptr;
 	}
 
@@ -2709,11 +3664,21 @@ class MState
 		}
 
 		/*
-		 * Strategy: find a spot within that chunk that meets the alignment
+		 * Strategy: find a chunk that contains a spot that meets the alignment
 		 * request, and then possibly free the leading and trailing space.
-		 * Call malloc with worst case padding to hit alignment.
+		 * First look for a free chunk that is already big enough once aligned.
+		 * If there isn't one, call malloc with worst case padding to hit
+		 * alignment.
 		 */
-		auto p = mspace_malloc_internal(nb + alignment + MinChunkSize);
+		MChunkHeader *p = nullptr;
+		if (treemap != 0)
+		{
+			p = tmalloc_aligned(nb, alignment);
+		}
+		if (p == nullptr)
+		{
+			p = mspace_malloc_internal(nb + alignment + MinChunkSize);
+		}
 		if (p == nullptr)
 		{
 			return p;
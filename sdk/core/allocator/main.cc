@@ -20,6 +20,7 @@
 using namespace CHERI;
 
 Revocation::Revoker revoker;
+Revocation::Policy  revocationPolicy;
 namespace
 {
 	/**
@@ -35,16 +36,33 @@ namespace
 		size_t quota;
 		/// A unique identifier for this pool.
 		uint16_t identifier;
+		/// Flags from `AllocatorCapabilityFlags`.
+		uint16_t flags;
+		/// The dedicated arena for this capability, if it has one.
+		MState *arena;
+		/**
+		 * The chunk most recently claimed with this capability.  This
+		 * capability holds a claim on this chunk for as long as it is cached,
+		 * so the chunk cannot be freed and the cache cannot become stale.
+		 */
+		MChunkHeader *claimCache;
 	};
 
 	static_assert(sizeof(PrivateAllocatorCapabilityState) <=
 	              sizeof(AllocatorCapabilityState));
 	static_assert(alignof(PrivateAllocatorCapabilityState) <=
 	              alignof(AllocatorCapabilityState));
+	static_assert(offsetof(PrivateAllocatorCapabilityState, flags) ==
+	              offsetof(AllocatorCapabilityState, flags));
 
 	// the global memory space
 	MState *gm;
 
+	/**
+	 * The list of dedicated arenas, linked through `MState::nextArena`.
+	 */
+	MState *dedicatedArenas;
+
 	/**
 	 * A global lock for the allocator.  This is acquired in public API
 	 * functions, all internal functions should assume that it is held. If
@@ -53,6 +71,18 @@ namespace
 	 */
 	FlagLockPriorityInherited lock;
 
+	/**
+	 * Returns the size of the hazard quarantine that each memory space needs.
+	 * This is the same size as the hazard pointer region, so that every hazard
+	 * pointer can refer to a distinct freed object.
+	 */
+	size_t hazard_quarantine_size()
+	{
+		return Capability{MMIO_CAPABILITY_WITH_PERMISSIONS(
+		                    void *, hazard_pointers, true, true, true, false)}
+		  .length();
+	}
+
 	/**
 	 * @brief Take a memory region and initialise a memory space for it. The
 	 * MState structure will be placed at the beginning and the rest used as the
@@ -87,27 +117,29 @@ namespace
 
 		Capability m{tbase.cast<MState>()};
 
-		size_t hazardQuarantineSize =
-		  Capability{MMIO_CAPABILITY_WITH_PERMISSIONS(
-		               void *, hazard_pointers, true, true, true, false)}
-		    .length();
+		size_t hazardQuarantineSize = hazard_quarantine_size();
+		size_t hazardRegionSize     = 2 * hazardQuarantineSize;
 
 		m.bounds()            = sizeof(*m);
 		m->heapStart          = tbase;
 		m->heapStart.bounds() = tsize;
-		m->heapStart.address() += msize + hazardQuarantineSize;
+		m->heapStart.address() += msize + hazardRegionSize;
 		m->init_bins();
 
 		// Carve off the front of the heap space to use for the hazard
-		// quarantine.
+		// quarantine and the hazard snapshot.
 		Capability hazardQuarantine = tbase;
 		hazardQuarantine.address() += msize;
 		hazardQuarantine.bounds() = hazardQuarantineSize;
 		m->hazardQuarantine       = hazardQuarantine.cast<void *>();
+		Capability hazardSnapshot = tbase;
+		hazardSnapshot.address() += msize + hazardQuarantineSize;
+		hazardSnapshot.bounds() = hazardQuarantineSize;
+		m->hazardSnapshot       = hazardSnapshot.cast<void *>();
 
 		m->mspace_firstchunk_add(
-		  ds::pointer::offset<void>(tbase.get(), msize + hazardQuarantineSize),
-		  tsize - msize - hazardQuarantineSize);
+		  ds::pointer::offset<void>(tbase.get(), msize + hazardRegionSize),
+		  tsize - msize - hazardRegionSize);
 
 		return m;
 	}
@@ -125,11 +157,263 @@ namespace
 			                                   /*loadMutable*/ true));
 
 			revoker.init();
+#ifdef CHERIOT_ALLOCATOR_TRACE
+			traceCursors.reset();
+#endif
 			gm = mstate_init(heap, heap.bounds());
 			Debug::Assert(gm != nullptr, "gm should not be null");
 		}
 	}
 
+	/**
+	 * Carve a dedicated arena that can hold `quota` bytes of allocations out
+	 * of the shared heap.  The chunk that holds the arena has no owner and so
+	 * can never be freed.  Returns nullptr if there is not enough free memory
+	 * in the shared heap.
+	 */
+	MState *arena_create(size_t quota)
+	{
+		check_gm();
+		// The arena needs space for its own metadata, hazard quarantine and
+		// hazard snapshot, the quota (which includes chunk headers), and the
+		// footer chunk.
+		size_t size = pad_request(sizeof(MState)) +
+		              2 * hazard_quarantine_size() + quota +
+		              sizeof(MChunkHeader);
+		// The arena is not charged to any quota.
+		size_t arenaQuota = std::numeric_limits<size_t>::max();
+		auto   ret        = gm->mspace_dispatch(size, arenaQuota, 0);
+		if (!std::holds_alternative<Capability<void>>(ret))
+		{
+			Debug::log("Unable to allocate {}-byte arena", size);
+			return nullptr;
+		}
+		Capability<void> region = std::get<Capability<void>>(ret);
+		MState          *arena  = mstate_init(region, region.length());
+		if (arena == nullptr)
+		{
+			gm->mspace_free(*MChunkHeader::from_body(region), region.length());
+			return nullptr;
+		}
+		arena->quarantineDrainBudget = gm->quarantineDrainBudget;
+		arena->nextArena             = dedicatedArenas;
+		dedicatedArenas              = arena;
+		Debug::log("Created {}-byte arena {}", size, region);
+		return arena;
+	}
+
+	/**
+	 * Call `fn` on the shared heap and then on each dedicated arena.
+	 */
+	void arenas_for_each(auto &&fn)
+	{
+		fn(*gm);
+		for (MState *arena = dedicatedArenas; arena != nullptr;
+		     arena         = arena->nextArena)
+		{
+			fn(*arena);
+		}
+	}
+
+	/**
+	 * Begin a batch of frees in every arena.  Returns a guard object that must
+	 * be held until all of the frees in the batch are done.
+	 *
+	 * A batch may free objects in any arena, because claims cross arenas, so
+	 * the batch is open in all of them.  The hazard epoch is held for the
+	 * whole batch, so each arena builds its hazard snapshot at most once,
+	 * rather than walking the hazard slots on every free.  When the guard
+	 * goes out of scope, each arena does its quarantine maintenance and the
+	 * revoker is kicked at most once, with the most urgent request from any
+	 * arena.
+	 */
+	[[nodiscard]] auto free_batch_begin()
+	{
+		uint32_t epoch = MState::hazard_epoch_acquire();
+		arenas_for_each([](MState &arena) { arena.free_batch_begin(); });
+		struct Guard
+		{
+			uint32_t epoch;
+			~Guard()
+			{
+				std::optional<Revocation::SweepUrgency> urgency;
+				arenas_for_each([&](MState &arena) {
+					auto wanted = arena.free_batch_end();
+					if (wanted && (!urgency || (*wanted > *urgency)))
+					{
+						urgency = wanted;
+					}
+				});
+				MState::hazard_epoch_release(epoch);
+				if (urgency)
+				{
+					revocationPolicy.kick(revoker, *urgency);
+				}
+			}
+		};
+		return Guard{epoch};
+	}
+
+	/**
+	 * Returns the memory space that allocations with `capability` should use.
+	 */
+	MState *arena_for(PrivateAllocatorCapabilityState &capability)
+	{
+		return capability.arena != nullptr ? capability.arena : gm;
+	}
+
+	/**
+	 * Returns the memory space that contains `address`.  Dedicated arenas are
+	 * carved out of the shared heap and so must be checked first.
+	 */
+	MState *arena_containing(ptraddr_t address)
+	{
+		for (MState *arena = dedicatedArenas; arena != nullptr;
+		     arena         = arena->nextArena)
+		{
+			if ((address >= arena->heapStart.base()) &&
+			    (address < arena->heapStart.top()))
+			{
+				return arena;
+			}
+		}
+		return gm;
+	}
+
+#ifdef CHERIOT_ALLOCATOR_TRACE
+	/// The number of records in the trace buffer.
+	constexpr size_t TraceRecords = CHERIOT_ALLOCATOR_TRACE;
+
+	/**
+	 * Storage for the trace buffer.  Records are removed by
+	 * `heap_trace_drain`.
+	 */
+	HeapTraceRecord traceRecords[TraceRecords];
+
+	/// Cursors for `traceRecords`.  Reset in `check_gm`.
+	ds::ring_buffer::Cursors<Debug, TraceRecords> traceCursors;
+
+	/// The number of records lost because the trace buffer was full.
+	uint32_t traceDropped;
+#endif
+
+	/**
+	 * Append a record to the trace buffer, if tracing is enabled.
+	 */
+	void trace_record([[maybe_unused]] HeapTraceOperation operation,
+	                  [[maybe_unused]] uint16_t           owner,
+	                  [[maybe_unused]] size_t             size,
+	                  [[maybe_unused]] ptraddr_t          address)
+	{
+#ifdef CHERIOT_ALLOCATOR_TRACE
+		decltype(traceCursors)::Ix next;
+		if (!traceCursors.tail_next(next))
+		{
+			traceDropped++;
+			return;
+		}
+		traceRecords[next] = {static_cast<uint8_t>(operation),
+		                      0,
+		                      owner,
+		                      static_cast<uint32_t>(size),
+		                      address,
+		                      static_cast<uint32_t>(rdcycle64())};
+		traceCursors.tail_advance();
+#endif
+	}
+
+#ifdef CHERIOT_ALLOCATOR_QUOTA_STATISTICS
+	/**
+	 * Usage statistics for a single allocator capability.
+	 */
+	struct QuotaStatistics
+	{
+		/// The capability that these statistics describe.
+		PrivateAllocatorCapabilityState *owner;
+		/// The quota that the capability had when it was first used.
+		size_t quota;
+		/// The largest number of bytes charged to the capability at once.
+		size_t peakBytes;
+		/// The number of successful allocations.
+		uint32_t allocations;
+		/// Log2 histogram of allocation sizes.
+		uint32_t histogram[HEAP_QUOTA_HISTOGRAM_BUCKETS];
+	};
+
+	/**
+	 * Statistics for the first `CHERIOT_ALLOCATOR_QUOTA_STATISTICS` allocator
+	 * capabilities to be used, indexed by identifier minus one.
+	 */
+	QuotaStatistics quotaStatistics[CHERIOT_ALLOCATOR_QUOTA_STATISTICS];
+
+	/**
+	 * Returns the statistics for `capability`, or nullptr if it is not
+	 * tracked.
+	 */
+	QuotaStatistics *
+	quota_statistics_find(PrivateAllocatorCapabilityState &capability)
+	{
+		size_t index = capability.identifier - 1;
+		if (index >= CHERIOT_ALLOCATOR_QUOTA_STATISTICS)
+		{
+			return nullptr;
+		}
+		return &quotaStatistics[index];
+	}
+#endif
+
+	/**
+	 * Start tracking usage for `capability`, which has just been assigned an
+	 * identifier, if per-quota statistics are enabled.
+	 */
+	void quota_statistics_start(
+	  [[maybe_unused]] PrivateAllocatorCapabilityState &capability)
+	{
+#ifdef CHERIOT_ALLOCATOR_QUOTA_STATISTICS
+		if (QuotaStatistics *statistics = quota_statistics_find(capability))
+		{
+			statistics->owner = &capability;
+			statistics->quota = capability.quota;
+		}
+#endif
+	}
+
+	/**
+	 * Update the peak usage of `capability` after more memory has been
+	 * charged to it, if per-quota statistics are enabled.
+	 */
+	void quota_statistics_peak(
+	  [[maybe_unused]] PrivateAllocatorCapabilityState &capability)
+	{
+#ifdef CHERIOT_ALLOCATOR_QUOTA_STATISTICS
+		if (QuotaStatistics *statistics = quota_statistics_find(capability))
+		{
+			statistics->peakBytes = std::max(
+			  statistics->peakBytes, statistics->quota - capability.quota);
+		}
+#endif
+	}
+
+	/**
+	 * Record a successful allocation of `bytes` bytes with `capability`, if
+	 * per-quota statistics are enabled.
+	 */
+	void quota_statistics_allocation(
+	  [[maybe_unused]] PrivateAllocatorCapabilityState &capability,
+	  [[maybe_unused]] size_t                           bytes)
+	{
+#ifdef CHERIOT_ALLOCATOR_QUOTA_STATISTICS
+		if (QuotaStatistics *statistics = quota_statistics_find(capability))
+		{
+			size_t bucket = (bytes < 16) ? 0 : (31 - __builtin_clz(bytes)) - 3;
+			statistics->allocations++;
+			statistics->histogram[std::min<size_t>(
+			  bucket, HEAP_QUOTA_HISTOGRAM_BUCKETS - 1)]++;
+		}
+		quota_statistics_peak(capability);
+#endif
+	}
+
 	/**
 	 * Futex value to allow a thread to wait for another thread to free an
 	 * object.
@@ -164,63 +448,152 @@ namespace
 		return g.try_lock(timeout);
 	}
 
+	/**
+	 * Returns true if `pointer` may still be written by the allocator.  This
+	 * must be rechecked for caller-provided buffers whenever the lock has been
+	 * dropped and reacquired: another thread may have freed the heap object
+	 * that `pointer` refers to.  A freed object stays tagged in our registers
+	 * until revocation, so `check_pointer` alone would accept it, but a store
+	 * would corrupt the quarantine metadata.  Freed objects have their shadow
+	 * bits painted, so check those.
+	 */
+	bool pointer_is_live(const void *pointer)
+	{
+		Capability cap{pointer};
+		if (!cap.is_valid())
+		{
+			return false;
+		}
+		if constexpr (HasTemporalSafety)
+		{
+			if (heap_address_is_valid(pointer))
+			{
+				return !revoker.shadow_bit_get(cap.base());
+			}
+		}
+		return true;
+	}
+
 	/**
 	 * Wait for the background revoker, if the revoker supports
 	 * interrupt-driven notifications.
 	 *
-	 * Waits until either `timeout` expires or `epoch` has finished and then
-	 * tries to reacquire the lock. Returns true if the epoch has passed and the
-	 * lock has been reacquired, returns false and does *not* reacquire the lock
-	 * in the case of any error.
-	 *
+	 * Waits until either `timeout` expires or `epoch` has finished.  Returns
+	 * true if the epoch has passed.  This is called without holding the
+	 * allocator lock.
 	 */
 	template<typename T = Revocation::Revoker>
 	bool wait_for_background_revoker(
-	  Timeout                   *timeout,
-	  uint32_t                   epoch,
-	  LockGuard<decltype(lock)> &g,
-	  T &r = revoker) requires(Revocation::SupportsInterruptNotification<T>)
+	  Timeout *timeout,
+	  uint32_t epoch,
+	  T       &r = revoker) requires(Revocation::SupportsInterruptNotification<T>)
 	{
-		// Release the lock before sleeping
-		g.unlock();
-		// Wait for the interrupt to fire, then try to reacquire the lock if
-		// the epoch is passed.
-		return r.wait_for_completion(timeout, epoch) && g.try_lock(timeout);
+		return r.wait_for_completion(timeout, epoch);
 	}
 
 	/**
 	 * Wait for the background revoker, if the revoker does not support
-	 * interrupt-driven notifications.  This will yield and retry if the revoker
-	 * has not yet finished.
-	 *
-	 * Waits until either `timeout` expires or `epoch` has finished and then
-	 * tries to reacquire the lock. Returns true if the epoch has passed and the
-	 * lock has been reacquired, returns false and does *not* reacquire the lock
-	 * in the case of any error.
+	 * interrupt-driven notifications.  An asynchronous revoker is polled once
+	 * per tick.  A synchronous revoker does work only when it is kicked, so
+	 * this runs the sweep, charging the time spent to `timeout`.
 	 *
+	 * Waits until either `timeout` expires or `epoch` has finished.  Returns
+	 * true if the epoch has passed.  This is called without holding the
+	 * allocator lock.
 	 */
 	template<typename T = Revocation::Revoker>
 	bool wait_for_background_revoker(
-	  Timeout                   *timeout,
-	  uint32_t                   epoch,
-	  LockGuard<decltype(lock)> &g,
-	  T &r = revoker) requires(!Revocation::SupportsInterruptNotification<T>)
+	  Timeout *timeout,
+	  uint32_t epoch,
+	  T       &r = revoker) requires(!Revocation::SupportsInterruptNotification<T>)
 	{
-		// Yield while until a revocation pass has finished.
-		while (!revoker.has_revocation_finished_for_epoch<true>(epoch))
+		auto systemTick = []() {
+			SystickReturn tick = thread_systemtick_get();
+			return (uint64_t(tick.hi) << 32) | tick.lo;
+		};
+		// Individual kicks are much shorter than a tick, so charge the
+		// timeout with the total time since the start rather than per kick.
+		uint64_t start   = T::IsAsynchronous ? 0 : systemTick();
+		uint64_t charged = 0;
+		while (!r.template has_revocation_finished_for_epoch<true>(epoch))
 		{
-			// Release the lock before sleeping
-			g.unlock();
-			Timeout smallSleep{1};
-			thread_sleep(&smallSleep);
-			if (!reacquire_lock(timeout, g, smallSleep.elapsed))
+			if (!may_block(timeout))
 			{
 				return false;
 			}
+			if constexpr (T::IsAsynchronous)
+			{
+				Timeout smallSleep{1};
+				smallSleep.deadline = timeout->deadline;
+				thread_sleep(&smallSleep);
+				timeout->elapse(smallSleep.elapsed);
+			}
+			else
+			{
+				if constexpr (Revocation::SupportsUrgentKick<T>)
+				{
+					r.system_bg_revoker_kick(true);
+				}
+				else
+				{
+					r.system_bg_revoker_kick();
+				}
+				uint64_t elapsed = systemTick() - start;
+				timeout->elapse(static_cast<Ticks>(
+				  std::min<uint64_t>(elapsed - charged, UnlimitedTimeout)));
+				charged = elapsed;
+			}
 		}
 		return true;
 	}
 
+	/**
+	 * The thread ID of the thread that is waiting for the revoker on behalf
+	 * of every thread blocked on revocation, or 0 if there is no such thread.
+	 * Other blocked threads wait on this word, with priority inheritance, and
+	 * are woken when it is cleared.
+	 */
+	cheriot::atomic<uint32_t> revocationWaiter = 0;
+
+	/**
+	 * Wait for a revocation sweep to finish `epoch`, so that an allocation
+	 * blocked on memory in quarantine can be retried.  Must be called with
+	 * the lock held.
+	 *
+	 * The first thread to block becomes the revocation waiter.  It releases
+	 * the lock and waits for the revoker (for the completion interrupt, by
+	 * polling, or by running the sweep itself), then wakes every other
+	 * blocked thread.  Threads that block while there is a waiter sleep on
+	 * `revocationWaiter` and donate their priority to it, rather than each
+	 * polling the revoker and contending for the lock.
+	 *
+	 * Returns true if the lock has been reacquired, false (without the lock)
+	 * if the timeout expired.  A return value of true does not guarantee that
+	 * `epoch` has passed, so the caller should recheck.
+	 */
+	bool wait_for_revocation(Timeout                   *timeout,
+	                         uint32_t                   epoch,
+	                         LockGuard<decltype(lock)> &g)
+	{
+		if (!may_block(timeout))
+		{
+			return true;
+		}
+		uint32_t waiter = revocationWaiter;
+		if (waiter != 0)
+		{
+			g.unlock();
+			revocationWaiter.wait(timeout, waiter, FutexPriorityInheritance);
+			return reacquire_lock(timeout, g);
+		}
+		revocationWaiter = thread_id_get();
+		g.unlock();
+		bool finished    = wait_for_background_revoker(timeout, epoch);
+		revocationWaiter = 0;
+		revocationWaiter.notify_all();
+		return finished && reacquire_lock(timeout, g);
+	}
+
 	/**
 	 * Malloc implementation.  Allocates `bytes` bytes of memory.  If `timeout`
 	 * is greater than zero, may block for that many ticks.  If `timeout` is the
@@ -236,27 +609,31 @@ namespace
 	 * If `isSealedAllocation` is true, then the allocation is marked as sealed
 	 * and excluded during `heap_free_all`.
 	 */
-	void *malloc_internal(size_t                           bytes,
-	                      LockGuard<decltype(lock)>      &&g,
-	                      PrivateAllocatorCapabilityState *capability,
-	                      Timeout                         *timeout,
-	                      bool isSealedAllocation = false)
+	void *malloc_internal_untraced(size_t                           bytes,
+	                               LockGuard<decltype(lock)>      &&g,
+	                               PrivateAllocatorCapabilityState *capability,
+	                               Timeout                         *timeout,
+	                               bool isSealedAllocation)
 	{
 		check_gm();
+		MState *arena = arena_for(*capability);
 
 		do
 		{
-			auto ret = gm->mspace_dispatch(bytes,
-			                               capability->quota,
-			                               capability->identifier,
-			                               isSealedAllocation);
+			auto ret = arena->mspace_dispatch(bytes,
+			                                  capability->quota,
+			                                  capability->identifier,
+			                                  isSealedAllocation);
 			if (std::holds_alternative<Capability<void>>(ret))
 			{
 				return std::get<Capability<void>>(ret);
 			}
-			// If the timeout is 0, fail now.
+			// If the timeout is 0, fail now.  Make sure that any sweep that the
+			// policy deferred starts, because there may be no later call into
+			// the allocator to retry it.
 			if (!may_block(timeout))
 			{
+				revocationPolicy.kick_deferred(revoker);
 				return nullptr;
 			}
 			// If there is enough memory in the quarantine to fulfil this
@@ -274,29 +651,18 @@ namespace
 				// requires individual attention to merge back into the free
 				// pool (and consolidate with neighbors), and each round here
 				// moves at most O(1) chunks out of quarantine.
-				if (!gm->quarantine_dequeue())
+				if (!arena->quarantine_dequeue())
 				{
 					Debug::log("Quarantine has enough memory to satisfy "
 					           "allocation, kicking revoker");
 
-					revoker.system_bg_revoker_kick();
+					revocationPolicy.kick(
+					  revoker, Revocation::SweepUrgency::AllocationBlocked);
 
-					if constexpr (Revocation::Revoker::IsAsynchronous)
-					{
-						wait_for_background_revoker(
-						  timeout, needsRevocation->waitingEpoch, g);
-					}
-					else
+					if (!wait_for_revocation(
+					      timeout, needsRevocation->waitingEpoch, g))
 					{
-						// Drop and reacquire the lock while yielding.
-						// Sleep for a single tick.
-						g.unlock();
-						Timeout smallSleep{0};
-						thread_sleep(&smallSleep);
-						if (!reacquire_lock(timeout, g, smallSleep.elapsed))
-						{
-							return nullptr;
-						}
+						return nullptr;
 					}
 				}
 				continue;
@@ -315,13 +681,18 @@ namespace
 				// a matched number of allocations and frees happen (in which
 				// case, we're happy to sleep because we still can't manage
 				// this allocation).
-				auto expected = gm->heapFreeSize;
+				auto expected = arena->heapFreeSize;
 				freeFutex     = expected;
+				// Memory in quarantine will not come back while we sleep
+				// unless a sweep runs.
+				revocationPolicy.kick_deferred(revoker);
 				// If there are things on the hazard list, wake after one tick
 				// and see if they have gone away.  Otherwise, wait until we
 				// have some newly freed objects.
-				Timeout t{gm->hazard_quarantine_is_empty() ? timeout->remaining
-				                                           : 1};
+				Timeout t{arena->hazard_quarantine_is_empty()
+				            ? timeout->remaining
+				            : 1};
+				t.deadline = timeout->deadline;
 				// Drop the lock while yielding
 				g.unlock();
 				freeFutex.wait(&t, expected);
@@ -341,6 +712,36 @@ namespace
 		return nullptr;
 	}
 
+	/**
+	 * Wrapper around `malloc_internal_untraced` that records the allocation
+	 * in the trace buffer and the per-quota statistics.  All allocation paths
+	 * go through here.
+	 */
+	void *malloc_internal(size_t                           bytes,
+	                      LockGuard<decltype(lock)>      &&g,
+	                      PrivateAllocatorCapabilityState *capability,
+	                      Timeout                         *timeout,
+	                      bool isSealedAllocation = false)
+	{
+		void *ret = malloc_internal_untraced(
+		  bytes, std::move(g), capability, timeout, isSealedAllocation);
+		if (ret != nullptr)
+		{
+			quota_statistics_allocation(*capability, bytes);
+		}
+		// A failed allocation may return without the lock, if the timeout
+		// expired while reacquiring it, and the trace buffer is protected by
+		// the lock.
+		if (g)
+		{
+			trace_record(HeapTraceAllocate,
+			             capability->identifier,
+			             bytes,
+			             Capability{ret}.base());
+		}
+		return ret;
+	}
+
 	/**
 	 * Unseal an allocator capability and return it.  Returns `nullptr` if this
 	 * is not a heap capability.
@@ -366,10 +767,37 @@ namespace
 				return nullptr;
 			}
 			capability->identifier = nextIdentifier++;
+			quota_statistics_start(*capability);
+		}
+		// Carve out the dedicated arena if this is the first time that we've
+		// seen this and it wants one.  If there isn't enough space yet, the
+		// capability is unusable until there is.
+		if ((capability->flags & AllocatorCapabilityDedicatedArena) &&
+		    (capability->arena == nullptr))
+		{
+			capability->arena = arena_create(capability->quota);
+			if (capability->arena == nullptr)
+			{
+				return nullptr;
+			}
 		}
 		return capability;
 	}
 
+	/**
+	 * Returns true if `in` is a valid allocator management capability.
+	 */
+	bool management_capability_is_valid(SealedAllocation in)
+	{
+		auto key = STATIC_SEALING_TYPE(ManagementKey);
+		if (!token_unseal<AllocatorManagementCapabilityState>(key, in.get()))
+		{
+			Debug::log("Invalid allocator management capability {}", in);
+			return false;
+		}
+		return true;
+	}
+
 	/**
 	 * Object representing a claim.  When a heap object is claimed, an instance
 	 * of this structure exists to track the reference count per claimer.
@@ -524,7 +952,7 @@ namespace
 		static Claim *create(PrivateAllocatorCapabilityState &capability,
 		                     uint16_t                         next)
 		{
-			auto space = gm->mspace_dispatch(
+			auto space = arena_for(capability)->mspace_dispatch(
 			  sizeof(Claim), capability.quota, capability.identifier);
 			if (!std::holds_alternative<Capability<void>>(space))
 			{
@@ -540,14 +968,15 @@ namespace
 		static void destroy(PrivateAllocatorCapabilityState &capability,
 		                    Claim                           *claim)
 		{
-			Capability heap{gm->heapStart};
+			MState    *arena = arena_for(capability);
+			Capability heap{arena->heapStart};
 			heap.address() = Capability{claim}.address();
 			auto chunk     = MChunkHeader::from_body(heap);
 			capability.quota += chunk->size_get();
 			// We could skip quarantine for these objects, since we know that
 			// they haven't escaped, but they're small so it's probably not
 			// worthwhile.
-			gm->mspace_free(*chunk, sizeof(Claim));
+			arena->mspace_free(*chunk, sizeof(Claim));
 		}
 
 		/**
@@ -630,6 +1059,38 @@ namespace
 		return {chunk.claims, nullptr};
 	}
 
+	/**
+	 * Try to add a claim to the chunk in `owner`'s claim cache.  This handles
+	 * the common case of a compartment repeatedly claiming an object that it
+	 * already holds a claim on, without needing to find the start of the
+	 * object from the shadow bitmap.
+	 *
+	 * Returns the chunk if `address` is in the cached chunk and the claim was
+	 * added, or `nullptr` if the caller must take the slow path.
+	 */
+	MChunkHeader *claim_cache_add(PrivateAllocatorCapabilityState &owner,
+	                              ptraddr_t                        address)
+	{
+		MChunkHeader *chunk = owner.claimCache;
+		if (chunk == nullptr)
+		{
+			return nullptr;
+		}
+		ptraddr_t base = chunk->body().address();
+		if ((address < base) ||
+		    (address >= base + chunk->size_get() - sizeof(MChunkHeader)))
+		{
+			return nullptr;
+		}
+		Claim *claim = claim_find(owner.identifier, *chunk).second;
+		if (claim == nullptr)
+		{
+			return nullptr;
+		}
+		claim->reference_add();
+		return chunk;
+	}
+
 	/**
 	 * Add a claim to a chunk, owned by `owner`.  This returns true if the
 	 * claim was successfully added, false otherwise.
@@ -642,6 +1103,7 @@ namespace
 		{
 			Debug::log("Adding second claim");
 			claim->reference_add();
+			owner.claimCache = &chunk;
 			return true;
 		}
 		bool   isOwner = (chunk.ownerID == owner.identifier);
@@ -666,7 +1128,9 @@ namespace
 				chunk.ownerID = 0;
 				claim->reference_add();
 			}
-			next = claim->encode_address();
+			next             = claim->encode_address();
+			owner.claimCache = &chunk;
+			quota_statistics_peak(owner);
 			return true;
 		}
 		// If we failed to allocate the claim object, undo adding this to our
@@ -709,6 +1173,10 @@ namespace
 			size_t size = chunk.size_get();
 			owner.quota += size;
 			Claim::destroy(owner, claim);
+			if (owner.claimCache == &chunk)
+			{
+				owner.claimCache = nullptr;
+			}
 			Debug::log("Dropped last claim, refunding {}-byte quota for {}",
 			           size,
 			           chunk.body());
@@ -745,7 +1213,8 @@ namespace
 			chunk.ownerID    = 0;
 			if (chunk.claims == 0)
 			{
-				int ret = gm->mspace_free(chunk, bodySize);
+				int ret = arena_containing(Capability{&chunk}.address())
+				            ->mspace_free(chunk, bodySize);
 				// If free fails, don't manipulate the quota.
 				if (ret == 0)
 				{
@@ -765,22 +1234,45 @@ namespace
 		{
 			if ((chunk.claims == 0) && (chunk.ownerID == 0))
 			{
-				return gm->mspace_free(chunk, bodySize);
+				return arena_containing(Capability{&chunk}.address())
+				  ->mspace_free(chunk, bodySize);
 			}
 			return 0;
 		}
 		return -EPERM;
 	}
 
-	__noinline int
-	heap_free_internal(SObj heapCapability, void *rawPointer, bool reallyFree)
+	bool token_pool_contains(ptraddr_t address);
+
+	/**
+	 * Find the header of the live allocation that contains `address` in
+	 * `arena`, or return nullptr if there is none.
+	 *
+	 * Addresses in the objects of a token pool are rejected.  The pool's
+	 * storage is a single allocation, but destroyed objects in it have their
+	 * shadow bits set, which would make `MState::allocation_start` mistake
+	 * the end of a destroyed object for a chunk header.  Pool objects are
+	 * managed only through the `token_pool_*` functions.
+	 */
+	MChunkHeader *allocation_start(MState *arena, ptraddr_t address)
 	{
-		auto *capability = malloc_capability_unseal(heapCapability);
-		if (capability == nullptr)
+		if (token_pool_contains(address))
 		{
-			Debug::log("Invalid heap capability {}", heapCapability);
-			return -EPERM;
+			Debug::log("{} is in a token pool", address);
+			return nullptr;
 		}
+		return arena->allocation_start(address);
+	}
+
+	/**
+	 * Free (or, if `reallyFree` is false, check whether we could free) the
+	 * object that `rawPointer` points to, using the already-unsealed allocator
+	 * capability `capability`.
+	 */
+	__noinline int heap_free_pointer(PrivateAllocatorCapabilityState &capability,
+	                                 void *rawPointer,
+	                                 bool  reallyFree)
+	{
 		Capability<void> mem{rawPointer};
 		if (!mem.is_valid())
 		{
@@ -788,17 +1280,39 @@ namespace
 		}
 		check_gm();
 		// Find the chunk that corresponds to this allocation.
-		auto *chunk = gm->allocation_start(mem.address());
+		MState *arena = arena_containing(mem.address());
+		auto   *chunk = allocation_start(arena, mem.address());
 		if (!chunk)
 		{
 			return -EINVAL;
 		}
 		ptraddr_t start    = chunk->body().address();
-		size_t    bodySize = gm->chunk_body_size(*chunk);
+		size_t    bodySize = arena->chunk_body_size(*chunk);
 		// Is the pointer that we're freeing a pointer to the entire allocation?
 		bool isPrecise = (start == mem.base()) && (bodySize == mem.length());
-		return heap_free_chunk(
-		  *capability, *chunk, bodySize, isPrecise, reallyFree);
+		bool isOwner   = isPrecise && (chunk->owner() == capability.identifier);
+		int  ret       = heap_free_chunk(
+		  capability, *chunk, bodySize, isPrecise, reallyFree);
+		if (reallyFree && (ret == 0))
+		{
+			trace_record(isOwner ? HeapTraceFree : HeapTraceRelease,
+			             capability.identifier,
+			             bodySize,
+			             start);
+		}
+		return ret;
+	}
+
+	__noinline int
+	heap_free_internal(SObj heapCapability, void *rawPointer, bool reallyFree)
+	{
+		auto *capability = malloc_capability_unseal(heapCapability);
+		if (capability == nullptr)
+		{
+			Debug::log("Invalid heap capability {}", heapCapability);
+			return -EPERM;
+		}
+		return heap_free_pointer(*capability, rawPointer, reallyFree);
 	}
 
 } // namespace
@@ -817,11 +1331,24 @@ size_t heap_quota_remaining(struct SObjStruct *heapCapability)
 void heap_quarantine_empty()
 {
 	LockGuard g{lock};
-	while (gm->heapQuarantineSize > 0)
+	check_gm();
+	revocationPolicy.kick_deferred(revoker);
+	while (true)
 	{
-		if (!gm->quarantine_dequeue())
+		bool   dequeued       = false;
+		size_t quarantineSize = 0;
+		arenas_for_each([&](MState &arena) {
+			dequeued |= arena.quarantine_dequeue();
+			quarantineSize += arena.heapQuarantineSize;
+		});
+		if (quarantineSize == 0)
 		{
-			revoker.system_bg_revoker_kick();
+			break;
+		}
+		if (!dequeued)
+		{
+			revocationPolicy.kick(
+			  revoker, Revocation::SweepUrgency::AllocationBlocked);
 		}
 		g.unlock();
 		yield();
@@ -829,20 +1356,119 @@ void heap_quarantine_empty()
 	}
 }
 
-void *heap_allocate(Timeout *timeout, SObj heapCapability, size_t bytes)
+size_t heap_quarantine_drain_idle()
 {
-	if (!check_timeout_pointer(timeout))
+	size_t drained = 0;
+	while (true)
 	{
-		return nullptr;
+		LockGuard g{lock};
+		check_gm();
+		int dequeued = 0;
+		arenas_for_each(
+		  [&](MState &arena) { dequeued += arena.quarantine_drain(); });
+		if (dequeued == 0)
+		{
+			break;
+		}
+		drained += dequeued;
 	}
-	LockGuard g{lock};
-	auto     *cap = malloc_capability_unseal(heapCapability);
-	if (cap == nullptr)
+	return drained;
+}
+
+int heap_revocation_idle()
+{
 	{
-		return nullptr;
-	}
-	if (!check_pointer<PermissionSet{Permission::Load, Permission::Store}>(
-	      timeout))
+		LockGuard g{lock};
+		check_gm();
+		size_t quarantineSize = 0;
+		arenas_for_each(
+		  [&](MState &arena) { quarantineSize += arena.heapQuarantineSize; });
+		if ((quarantineSize == 0) && ((revoker.system_epoch_get() & 1) == 0))
+		{
+			return 0;
+		}
+		revocationPolicy.kick(revoker, Revocation::SweepUrgency::Idle);
+	}
+	int kicks = 1;
+	if constexpr (!Revocation::Revoker::IsAsynchronous)
+	{
+		// Drive the sweep to completion without holding the allocator lock.
+		// Each kick is a single short tick, and interrupts are enabled
+		// between them, so higher-priority threads can preempt this loop.
+		while ((revoker.system_epoch_get() & 1) == 1)
+		{
+			revoker.system_bg_revoker_kick();
+			kicks++;
+		}
+	}
+	return kicks;
+}
+
+int heap_quarantine_drain_budget_set(SObj managementCapability, size_t budget)
+{
+	LockGuard g{lock};
+	check_gm();
+	if (!management_capability_is_valid(managementCapability))
+	{
+		return -EPERM;
+	}
+	int ret = 0;
+	arenas_for_each([&](MState &arena) {
+		ret = arena.quarantine_drain_budget_set(budget);
+	});
+	return ret;
+}
+
+int heap_quarantine_drain_statistics(SObj managementCapability,
+                                     HeapQuarantineDrainStatistics *statistics,
+                                     bool                           reset)
+{
+	LockGuard g{lock};
+	check_gm();
+	if (!management_capability_is_valid(managementCapability))
+	{
+		return -EPERM;
+	}
+	if (!check_pointer<PermissionSet{Permission::Store}>(statistics))
+	{
+		return -EINVAL;
+	}
+	// The budget is set for every arena at once, so any arena's will do.
+	statistics->budget    = gm->quarantineDrainBudget;
+	statistics->maxCycles = 0;
+	std::fill(std::begin(statistics->histogram),
+	          std::end(statistics->histogram),
+	          0);
+	arenas_for_each([&](MState &arena) {
+		statistics->maxCycles =
+		  std::max(statistics->maxCycles, arena.quarantineDrainMaxCycles);
+		for (size_t i = 0; i < arena.quarantineDrainHistogram.size(); i++)
+		{
+			statistics->histogram[i] += arena.quarantineDrainHistogram[i];
+		}
+		if (reset)
+		{
+			arena.quarantineDrainMaxCycles = 0;
+			arena.quarantineDrainHistogram.fill(0);
+		}
+	});
+	return 0;
+}
+
+void *heap_allocate(Timeout *timeout, SObj heapCapability, size_t bytes)
+{
+	if (!check_timeout_pointer(timeout))
+	{
+		return nullptr;
+	}
+	LockGuard g{lock};
+	auto     *cap = malloc_capability_unseal(heapCapability);
+	if (cap == nullptr)
+	{
+		return nullptr;
+	}
+	if (!check_pointer<PermissionSet{Permission::Load, Permission::Store}>(
+	      timeout))
 	{
 		return nullptr;
 	}
@@ -850,6 +1476,91 @@ void *heap_allocate(Timeout *timeout, SObj heapCapability, size_t bytes)
 	return malloc_internal(bytes, std::move(g), cap, timeout);
 }
 
+void *heap_reallocate(Timeout *timeout,
+                      SObj     heapCapability,
+                      void    *pointer,
+                      size_t   bytes)
+{
+	if (!check_timeout_pointer(timeout))
+	{
+		return nullptr;
+	}
+	LockGuard g{lock};
+	auto     *cap = malloc_capability_unseal(heapCapability);
+	if (cap == nullptr)
+	{
+		return nullptr;
+	}
+	if (!check_pointer<PermissionSet{Permission::Load, Permission::Store}>(
+	      timeout))
+	{
+		return nullptr;
+	}
+	if (pointer == nullptr)
+	{
+		return malloc_internal(bytes, std::move(g), cap, timeout);
+	}
+	check_gm();
+	Capability<void> mem{pointer};
+	if (!mem.is_valid() || (bytes == 0))
+	{
+		return nullptr;
+	}
+	MState *arena = arena_containing(mem.address());
+	auto   *chunk = allocation_start(arena, mem.address());
+	if (chunk == nullptr)
+	{
+		return nullptr;
+	}
+	// Only the owner may reallocate an object, and only with a capability to
+	// the whole object: this is the same check that heap_free uses.
+	size_t bodySize = arena->chunk_body_size(*chunk);
+	if ((mem.base() != chunk->body().address()) ||
+	    (mem.length() != bodySize) || (chunk->owner() != cap->identifier) ||
+	    chunk->isSealedObject)
+	{
+		Debug::log("Cannot reallocate {}", mem);
+		return nullptr;
+	}
+	// Shrinking is a no-op: the bounds must continue to cover the whole object
+	// so that it can be freed.
+	if (bytes <= bodySize)
+	{
+		return pointer;
+	}
+	// Claims are charged for the size of the chunk when they are made, so we
+	// can grow only unclaimed objects in place.
+	if (chunk->claims == 0)
+	{
+		Capability<void> grown =
+		  arena->mspace_grow_in_place(*chunk, bytes, cap->quota);
+		if (grown != nullptr)
+		{
+			Debug::log("Grew {} in place to {}", mem, grown);
+			quota_statistics_peak(*cap);
+			trace_record(
+			  HeapTraceReallocate, cap->identifier, bytes, grown.base());
+			return grown;
+		}
+	}
+	// Fall back to allocate, copy, and free.
+	void *newObject = malloc_internal(bytes, std::move(g), cap, timeout);
+	if (newObject == nullptr)
+	{
+		return nullptr;
+	}
+	// We may have dropped the lock while waiting for memory, so make sure that
+	// the old object is still live and still ours to free.
+	if (heap_free_pointer(*cap, pointer, false) != 0)
+	{
+		heap_free_pointer(*cap, newObject, true);
+		return nullptr;
+	}
+	memcpy(newObject, pointer, bodySize);
+	heap_free_pointer(*cap, pointer, true);
+	return newObject;
+}
+
 size_t heap_claim(SObj heapCapability, void *pointer)
 {
 	LockGuard g{lock};
@@ -864,7 +1575,20 @@ size_t heap_claim(SObj heapCapability, void *pointer)
 		Debug::log("Invalid claimed cap");
 		return 0;
 	}
-	auto *chunk = gm->allocation_start(Capability{pointer}.address());
+	check_gm();
+	ptraddr_t address = Capability{pointer}.address();
+	MState   *arena   = arena_containing(address);
+	auto claimed = [&](MChunkHeader *chunk) {
+		size_t size = arena->chunk_body_size(*chunk);
+		trace_record(
+		  HeapTraceClaim, cap->identifier, size, chunk->body().address());
+		return size;
+	};
+	if (auto *chunk = claim_cache_add(*cap, address))
+	{
+		return claimed(chunk);
+	}
+	auto *chunk = allocation_start(arena, address);
 	if (chunk == nullptr)
 	{
 		Debug::log("chunk not found");
@@ -872,7 +1596,7 @@ size_t heap_claim(SObj heapCapability, void *pointer)
 	}
 	if (claim_add(*cap, *chunk))
 	{
-		return gm->chunk_body_size(*chunk);
+		return claimed(chunk);
 	}
 	Debug::log("failed to add claim");
 	return 0;
@@ -904,8 +1628,13 @@ int heap_free(SObj heapCapability, void *rawPointer)
 	return 0;
 }
 
-ssize_t heap_free_all(SObj heapCapability)
+ssize_t heap_free_batch(SObj heapCapability, void **ptrs, size_t count)
 {
+	size_t arraySize;
+	if (__builtin_mul_overflow(count, sizeof(void *), &arraySize))
+	{
+		return -EINVAL;
+	}
 	LockGuard g{lock};
 	auto     *capability = malloc_capability_unseal(heapCapability);
 	if (capability == nullptr)
@@ -913,23 +1642,105 @@ ssize_t heap_free_all(SObj heapCapability)
 		Debug::log("Invalid heap capability {}", heapCapability);
 		return -EPERM;
 	}
-
-	auto      chunk   = gm->heapStart.cast<MChunkHeader>();
-	ptraddr_t heapEnd = chunk.top();
-	ssize_t   freed   = 0;
-	do
+	if (!check_pointer<PermissionSet{Permission::Load,
+	                                 Permission::Store,
+	                                 Permission::LoadStoreCapability}>(
+	      ptrs, arraySize))
+	{
+		return -EINVAL;
+	}
+	check_gm();
+	// If `ptrs` is itself a heap object, find its extent.  Entries that point
+	// into it are skipped: freeing it would leave the rest of this loop
+	// loading from and storing to quarantined memory.
+	ptraddr_t ptrsStart = 0;
+	ptraddr_t ptrsEnd   = 0;
+	if (heap_address_is_valid(ptrs))
+	{
+		ptraddr_t address = Capability{ptrs}.address();
+		MState   *arena   = arena_containing(address);
+		if (auto *chunk = allocation_start(arena, address))
+		{
+			ptrsStart = chunk->body().address();
+			ptrsEnd   = ptrsStart + arena->chunk_body_size(*chunk);
+		}
+	}
+	ssize_t freed = 0;
 	{
-		if (chunk->is_in_use() && !chunk->isSealedObject)
+		// Quarantine maintenance and the revoker kick happen once, when this
+		// goes out of scope.  Claims may be released in any arena, so this
+		// covers all of them.
+		auto batch = free_batch_begin();
+		for (size_t i = 0; i < count; i++)
 		{
-			auto size = chunk->size_get();
-			if (heap_free_chunk(
-			      *capability, *chunk, gm->chunk_body_size(*chunk)) == 0)
+			void *pointer = ptrs[i];
+			if (pointer == nullptr)
+			{
+				continue;
+			}
+			ptraddr_t base = Capability{pointer}.base();
+			if ((base >= ptrsStart) && (base < ptrsEnd))
+			{
+				Debug::log("Not freeing {}, which holds the batch", pointer);
+				continue;
+			}
+			// Clear the entry before the object is freed, so that we never
+			// store to an object after it has been freed.
+			ptrs[i] = nullptr;
+			if (heap_free_pointer(*capability, pointer, true) == 0)
+			{
+				freed++;
+			}
+			else
 			{
-				freed += size;
+				ptrs[i] = pointer;
 			}
 		}
-		chunk = static_cast<MChunkHeader *>(chunk->cell_next());
-	} while (chunk.address() < heapEnd);
+	}
+
+	// If there are any threads blocked allocating memory, wake them up.
+	if ((freed > 0) && (freeFutex != -1))
+	{
+		Debug::log("Some threads are blocking on allocations, waking them");
+		freeFutex = -1;
+		freeFutex.notify_all();
+	}
+
+	return freed;
+}
+
+ssize_t heap_free_all(SObj heapCapability)
+{
+	LockGuard g{lock};
+	auto     *capability = malloc_capability_unseal(heapCapability);
+	if (capability == nullptr)
+	{
+		Debug::log("Invalid heap capability {}", heapCapability);
+		return -EPERM;
+	}
+
+	check_gm();
+	ssize_t freed = 0;
+	// Objects owned by this capability are all in its arena, but it may hold
+	// claims on objects in any arena.
+	arenas_for_each([&](MState &arena) {
+		auto      chunk   = arena.heapStart.cast<MChunkHeader>();
+		ptraddr_t heapEnd = chunk.top();
+		do
+		{
+			if (chunk->is_in_use() && !chunk->isSealedObject)
+			{
+				auto size = chunk->size_get();
+				if (heap_free_chunk(*capability,
+				                    *chunk,
+				                    arena.chunk_body_size(*chunk)) == 0)
+				{
+					freed += size;
+				}
+			}
+			chunk = static_cast<MChunkHeader *>(chunk->cell_next());
+		} while (chunk.address() < heapEnd);
+	});
 
 	// If there are any threads blocked allocating memory, wake them up.
 	if ((freeFutex > 0) && (freed > 0))
@@ -971,6 +1782,75 @@ void *heap_allocate_array(Timeout *timeout,
 	return malloc_internal(req, std::move(g), cap, timeout);
 }
 
+ssize_t heap_allocate_batch(Timeout *timeout,
+                            SObj     heapCapability,
+                            size_t   size,
+                            size_t   count,
+                            void   **out)
+{
+	if (!check_timeout_pointer(timeout))
+	{
+		return -EINVAL;
+	}
+	size_t outSize;
+	if (__builtin_mul_overflow(count, sizeof(void *), &outSize))
+	{
+		return -EINVAL;
+	}
+	LockGuard g{lock};
+	auto     *cap = malloc_capability_unseal(heapCapability);
+	if (cap == nullptr)
+	{
+		return -EPERM;
+	}
+	if (!check_pointer<PermissionSet{Permission::Load, Permission::Store}>(
+	      timeout) ||
+	    !check_pointer<PermissionSet{Permission::Store,
+	                                 Permission::LoadStoreCapability}>(
+	      out, outSize))
+	{
+		return -EINVAL;
+	}
+	// Check the quota for the entire batch before allocating anything.  Each
+	// object costs at least its rounded-up size plus a header.
+	size_t alignSize = (representable_length(size) + MallocAlignMask) &
+	                   ~MallocAlignMask;
+	size_t batchSize;
+	if (__builtin_mul_overflow(pad_request(alignSize), count, &batchSize) ||
+	    (batchSize > cap->quota))
+	{
+		Debug::log("Quota {} cannot hold {} {}-byte objects",
+		           cap->quota,
+		           count,
+		           size);
+		return -ENOMEM;
+	}
+	// Make sure that the caller sees null for anything that we fail to
+	// allocate.
+	memset(out, 0, outSize);
+	ssize_t allocated = 0;
+	for (; static_cast<size_t>(allocated) < count; allocated++)
+	{
+		void *object = malloc_internal(size, std::move(g), cap, timeout);
+		if (object == nullptr)
+		{
+			break;
+		}
+		// We may have dropped the lock while waiting for memory, in which
+		// case another thread may have freed the output array.  The objects
+		// that we have already stored there are still owned by `cap` and can
+		// be released with `heap_free_all`.
+		if (!pointer_is_live(out))
+		{
+			Debug::log("Output array {} freed during batch allocation", out);
+			heap_free_pointer(*cap, object, true);
+			break;
+		}
+		out[allocated] = object;
+	}
+	return allocated;
+}
+
 namespace
 {
 	/**
@@ -1187,7 +2067,543 @@ int token_obj_can_destroy(SObj heapCapability, SKey key, SObj object)
 	return heap_can_free(heapCapability, unsealed);
 }
 
+namespace
+{
+	/**
+	 * Sentinel index used to terminate the free and quarantine lists in a
+	 * token pool.
+	 */
+	constexpr uint32_t NoPoolSlot = std::numeric_limits<uint32_t>::max();
+
+	/**
+	 * The state for a pool of sealed objects, created by `token_pool_create`.
+	 * The pool is itself a sealed object, sealed with `tokenPoolKey`.
+	 *
+	 * Each slot in `objects` is a sealed object (header and body).  Slots that
+	 * are not live have a type of zero, so handles to them do not unseal, and
+	 * are linked into either the free list or the quarantine list through
+	 * their header's padding word.
+	 */
+	struct TokenPool
+	{
+		/// The sealing type of the objects in this pool.
+		ptraddr_t key;
+		/// The distance between objects, including the header.
+		uint32_t stride;
+		/// The number of objects.
+		uint32_t count;
+		/// The index of the first free object, or `NoPoolSlot`.
+		uint32_t freeHead;
+		/// The index of the first destroyed object that may still be
+		/// referenced, or `NoPoolSlot`.
+		uint32_t quarantineHead;
+		/// The revocation epoch that must pass before the objects in the
+		/// quarantine list can be reused.
+		uint32_t quarantineEpoch;
+		/**
+		 * The storage for the objects.  The address is that of the first
+		 * object but the base is earlier: the load barrier checks the shadow
+		 * bit for the base, which would be set while the first object is in
+		 * quarantine.
+		 */
+		SObjStruct *objects;
+		/// The next pool in `tokenPools`.
+		TokenPool *next;
+	};
+
+	/**
+	 * The key used to seal token pools.  Allocated when the first pool is
+	 * created.
+	 */
+	SKey tokenPoolKey;
+
+	/**
+	 * Every live token pool, so that the heap functions can reject pointers
+	 * into pool objects.
+	 */
+	TokenPool *tokenPools;
+
+	/**
+	 * Returns true if `address` is in the objects of a live token pool.  Must
+	 * be called with the lock held.
+	 */
+	bool token_pool_contains(ptraddr_t address)
+	{
+		for (TokenPool *pool = tokenPools; pool != nullptr; pool = pool->next)
+		{
+			Capability objects{pool->objects};
+			if ((address >= objects.address()) && (address < objects.top()))
+			{
+				return true;
+			}
+		}
+		return false;
+	}
+
+	/**
+	 * Unseal a token pool and check that it holds objects sealed with `key`.
+	 * Returns nullptr if either check fails.  Must be called with the lock
+	 * held.
+	 */
+	TokenPool *token_pool_unseal(SObj pool, SealingKey key)
+	{
+		if (tokenPoolKey == nullptr)
+		{
+			return nullptr;
+		}
+		auto unsealed = unseal_internal(tokenPoolKey, pool);
+		if (unsealed == nullptr)
+		{
+			return nullptr;
+		}
+		auto *state = reinterpret_cast<TokenPool *>(unsealed->data);
+		if (state->key != key.address())
+		{
+			return nullptr;
+		}
+		return state;
+	}
+
+	/**
+	 * Returns a bounded capability to the slot at `index` in `pool`.
+	 */
+	SealedAllocation token_pool_slot(TokenPool *pool, uint32_t index)
+	{
+		SealedAllocation slot{pool->objects};
+		slot.address() += index * pool->stride;
+		slot.bounds() = pool->stride;
+		return slot;
+	}
+
+	/**
+	 * Take an object from `pool` and seal it with the pool's key.  Returns
+	 * the sealed and unsealed capabilities, or a pair of nulls if the pool
+	 * is exhausted and the timeout expires before revocation makes a
+	 * destroyed object reusable.
+	 */
+	std::pair<SObj, void *> token_pool_take(Timeout      *timeout,
+	                                        SObj          pool,
+	                                        SealingKey    key,
+	                                        PermissionSet permissions)
+	{
+		if (!check_timeout_pointer(timeout))
+		{
+			return {nullptr, nullptr};
+		}
+		if (!permissions.can_derive_from(key.permissions()))
+		{
+			Debug::log(
+			  "Operation requires {}, cannot derive from {}", permissions, key);
+			return {nullptr, nullptr};
+		}
+		LockGuard g{lock};
+		while (true)
+		{
+			// The pool may have been destroyed while we were waiting, so
+			// unseal it again on every iteration.
+			auto *state = token_pool_unseal(pool, key);
+			if (state == nullptr)
+			{
+				return {nullptr, nullptr};
+			}
+			// Destroyed objects can be reused once all references to them
+			// have been revoked.  Clear their shadow bits and move the whole
+			// list to the free list.
+			if ((state->freeHead == NoPoolSlot) &&
+			    (state->quarantineHead != NoPoolSlot) &&
+			    revoker.has_revocation_finished_for_epoch(
+			      state->quarantineEpoch))
+			{
+				for (uint32_t index = state->quarantineHead;
+				     index != NoPoolSlot;)
+				{
+					auto slot = token_pool_slot(state, index);
+					revoker.shadow_paint_range<false>(slot.base(), slot.top());
+					index = slot->padding;
+				}
+				state->freeHead       = state->quarantineHead;
+				state->quarantineHead = NoPoolSlot;
+			}
+			if (state->freeHead != NoPoolSlot)
+			{
+				auto obj        = token_pool_slot(state, state->freeHead);
+				state->freeHead = obj->padding;
+				obj->padding    = 0;
+				obj->type       = key.address();
+				auto sealed     = obj;
+				sealed.seal(SEALING_CAP());
+				obj.address() += ObjHdrSize; // Exclude the header.
+				obj.bounds() = obj.length() - ObjHdrSize;
+				return {sealed, obj};
+			}
+			if ((state->quarantineHead == NoPoolSlot) || !may_block(timeout))
+			{
+				Debug::log("Token pool {} exhausted", pool);
+				return {nullptr, nullptr};
+			}
+			revocationPolicy.kick(revoker,
+			                      Revocation::SweepUrgency::AllocationBlocked);
+			if (!wait_for_revocation(timeout, state->quarantineEpoch, g))
+			{
+				return {nullptr, nullptr};
+			}
+		}
+	}
+} // namespace
+
+SObj token_pool_create(Timeout *timeout,
+                       SObj     heapCapability,
+                       SKey     rawKey,
+                       size_t   sz,
+                       size_t   count)
+{
+	SealingKey key{rawKey};
+	if (!check_timeout_pointer(timeout))
+	{
+		return INVALID_SOBJ;
+	}
+	if (!PermissionSet{Permission::Seal}.can_derive_from(key.permissions()))
+	{
+		Debug::log("Token pool key {} cannot seal", key);
+		return INVALID_SOBJ;
+	}
+	if ((count == 0) || (sz > 0xfe8 - ObjHdrSize))
+	{
+		Debug::log("Cannot create a pool of {} {}-byte objects", count, sz);
+		return INVALID_SOBJ;
+	}
+	// Each object must have precise bounds and be able to hold capabilities.
+	size_t stride = (representable_length(sz + ObjHdrSize) + MallocAlignMask) &
+	                ~MallocAlignMask;
+	size_t padding = std::max<size_t>(
+	  ~representable_alignment_mask(stride) + 1, MallocAlignment);
+	size_t total;
+	if (__builtin_mul_overflow(stride, count, &total) ||
+	    __builtin_add_overflow(total, padding, &total))
+	{
+		return INVALID_SOBJ;
+	}
+	SKey poolKey;
+	{
+		// Allocate the key for pools when the first one is created.  This
+		// must happen under the lock so that racing callers agree on it.
+		// `token_key_new` uses its own lock, which is never held while
+		// acquiring this one.
+		LockGuard g{lock};
+		if (tokenPoolKey == nullptr)
+		{
+			tokenPoolKey = token_key_new();
+		}
+		poolKey = tokenPoolKey;
+	}
+	if (poolKey == nullptr)
+	{
+		Debug::log("Failed to allocate a key for token pools");
+		return INVALID_SOBJ;
+	}
+	auto [sealed, pool] = allocate_sealed_unsealed(timeout,
+	                                               heapCapability,
+	                                               poolKey,
+	                                               sizeof(TokenPool),
+	                                               {Permission::Seal});
+	if (sealed == nullptr)
+	{
+		return INVALID_SOBJ;
+	}
+	void *objects;
+	{
+		LockGuard g{lock};
+		auto     *capability = malloc_capability_unseal(heapCapability);
+		if (capability == nullptr)
+		{
+			objects = nullptr;
+		}
+		else
+		{
+			objects =
+			  malloc_internal(total, std::move(g), capability, timeout, true);
+		}
+	}
+	if (objects == nullptr)
+	{
+		Debug::log("Underlying allocation failed for token pool");
+		token_obj_destroy(heapCapability, poolKey, sealed);
+		return INVALID_SOBJ;
+	}
+	LockGuard g{lock};
+	auto     *state       = static_cast<TokenPool *>(pool);
+	state->key            = key.address();
+	state->stride         = stride;
+	state->count          = count;
+	state->freeHead       = 0;
+	state->quarantineHead = NoPoolSlot;
+	Capability<SObjStruct> first{static_cast<SObjStruct *>(objects)};
+	first.address() += padding;
+	state->objects = first;
+	state->next    = tokenPools;
+	tokenPools     = state;
+	// Thread every object onto the free list.  The allocation is zeroed, so
+	// each object's type is already zero.
+	for (uint32_t i = 0; i < count; i++)
+	{
+		token_pool_slot(state, i)->padding =
+		  (i + 1 < count) ? i + 1 : NoPoolSlot;
+	}
+	Debug::log("Created pool of {} {}-byte objects", count, sz);
+	return sealed;
+}
+
+SObj token_pool_sealed_unsealed_alloc(Timeout *timeout,
+                                      SObj     pool,
+                                      SKey     key,
+                                      void   **unsealed)
+{
+	auto [sealed, obj] = token_pool_take(
+	  timeout, pool, key, {Permission::Seal, Permission::Unseal});
+	if (sealed == nullptr)
+	{
+		return INVALID_SOBJ;
+	}
+	LockGuard g{lock};
+	if (check_pointer<PermissionSet{Permission::Store,
+	                                Permission::LoadStoreCapability}>(unsealed))
+	{
+		*unsealed = obj;
+		return sealed;
+	}
+	g.unlock();
+	token_pool_obj_destroy(pool, key, sealed);
+	return INVALID_SOBJ;
+}
+
+SObj token_pool_sealed_alloc(Timeout *timeout, SObj pool, SKey key)
+{
+	return token_pool_take(timeout, pool, key, {Permission::Seal}).first;
+}
+
+int token_pool_obj_destroy(SObj pool, SKey key, SObj object)
+{
+	LockGuard g{lock};
+	auto     *state = token_pool_unseal(pool, key);
+	if (state == nullptr)
+	{
+		return -EINVAL;
+	}
+	auto obj = unseal_internal(key, object);
+	if (obj == nullptr)
+	{
+		return -EINVAL;
+	}
+	// The object must be a whole slot in this pool.
+	ptraddr_t base   = Capability{state->objects}.address();
+	ptraddr_t offset = obj.address() - base;
+	if ((obj.address() < base) || (offset % state->stride != 0) ||
+	    (offset / state->stride >= state->count) ||
+	    (obj.length() != state->stride))
+	{
+		return -EINVAL;
+	}
+	// As with `heap_free`, paint the shadow bits before zeroing so that no
+	// copy of a handle can be used to undo the zeroing.  The load barrier now
+	// prevents new references to the object from being loaded and the
+	// revoker will invalidate any that are already in memory.  The object is
+	// not reused until that has happened.
+	auto slot = token_pool_slot(state, offset / state->stride);
+	revoker.shadow_paint_range<true>(slot.base(), slot.top());
+	memset(slot->data, 0, state->stride - ObjHdrSize);
+	auto epoch = revoker.system_epoch_get();
+	epoch += epoch & 1;
+	slot->type             = 0;
+	slot->padding          = state->quarantineHead;
+	state->quarantineHead  = offset / state->stride;
+	state->quarantineEpoch = epoch;
+	return 0;
+}
+
+int token_pool_destroy(SObj heapCapability, SKey key, SObj pool)
+{
+	SealingKey sealingKey{key};
+	LockGuard  g{lock};
+	if (!sealingKey.permissions().contains(Permission::Unseal))
+	{
+		return -EINVAL;
+	}
+	auto *state = token_pool_unseal(pool, sealingKey);
+	if (state == nullptr)
+	{
+		return -EINVAL;
+	}
+	auto *capability = malloc_capability_unseal(heapCapability);
+	if (capability == nullptr)
+	{
+		Debug::log("Invalid heap capability {}", heapCapability);
+		return -EPERM;
+	}
+	void      *poolObject = unseal_internal(tokenPoolKey, pool);
+	Capability region{state->objects};
+	region.address() = region.base();
+	void *objects    = region;
+	// Check that both allocations can be freed before removing the pool from
+	// the list, so that a failure leaves the pool usable.
+	int ret = heap_free_pointer(*capability, poolObject, false);
+	if (ret == 0)
+	{
+		ret = heap_free_pointer(*capability, objects, false);
+	}
+	if (ret != 0)
+	{
+		return ret;
+	}
+	// Every live pool is in the list.
+	TokenPool **link = &tokenPools;
+	while (*link != state)
+	{
+		link = &(*link)->next;
+	}
+	*link = state->next;
+	// Freeing the pool revokes every handle to it and to its objects.
+	heap_free_pointer(*capability, objects, true);
+	heap_free_pointer(*capability, poolObject, true);
+
+	// If there are any threads blocked allocating memory, wake them up.
+	if (freeFutex != -1)
+	{
+		Debug::log("Some threads are blocking on allocations, waking them");
+		freeFutex = -1;
+		freeFutex.notify_all();
+	}
+	return 0;
+}
+
 size_t heap_available()
 {
-	return gm->heapFreeSize;
+	// Dedicated arenas are allocated chunks in the shared heap, so their free
+	// space is not counted in `gm` and must be added.
+	size_t available = 0;
+	arenas_for_each([&](MState &arena) { available += arena.heapFreeSize; });
+	return available;
+}
+
+ssize_t heap_trace_drain(SObj             managementCapability,
+                         HeapTraceRecord *records,
+                         size_t           count)
+{
+	LockGuard g{lock};
+	check_gm();
+	if (!management_capability_is_valid(managementCapability))
+	{
+		return -EPERM;
+	}
+#ifdef CHERIOT_ALLOCATOR_TRACE
+	size_t length;
+	if (__builtin_mul_overflow(count, sizeof(HeapTraceRecord), &length) ||
+	    !check_pointer<PermissionSet{Permission::Store}>(records, length))
+	{
+		return -EINVAL;
+	}
+	size_t copied = 0;
+	// Report lost records first, so that the consumer knows that there is a
+	// gap before the records that follow.
+	if ((traceDropped > 0) && (count > 0))
+	{
+		records[copied++] = {HeapTraceDropped,
+		                     0,
+		                     0,
+		                     traceDropped,
+		                     0,
+		                     static_cast<uint32_t>(rdcycle64())};
+		traceDropped      = 0;
+	}
+	decltype(traceCursors)::Ix head;
+	while ((copied < count) && traceCursors.head_get(head))
+	{
+		records[copied++] = traceRecords[head];
+		traceCursors.head_advance();
+	}
+	return copied;
+#else
+	return -ENOTSUP;
+#endif
+}
+
+ssize_t heap_quota_statistics_get(SObj                 managementCapability,
+                                  HeapQuotaStatistics *statistics,
+                                  size_t               count)
+{
+	LockGuard g{lock};
+	check_gm();
+	if (!management_capability_is_valid(managementCapability))
+	{
+		return -EPERM;
+	}
+#ifdef CHERIOT_ALLOCATOR_QUOTA_STATISTICS
+	size_t length;
+	if (__builtin_mul_overflow(count, sizeof(HeapQuotaStatistics), &length) ||
+	    !check_pointer<PermissionSet{Permission::Store}>(statistics, length))
+	{
+		return -EINVAL;
+	}
+	size_t copied = 0;
+	for (auto &tracked : quotaStatistics)
+	{
+		if ((copied == count) || (tracked.owner == nullptr))
+		{
+			break;
+		}
+		auto &out       = statistics[copied++];
+		out.identifier  = tracked.owner->identifier;
+		out.reserved    = 0;
+		out.capability  = Capability{tracked.owner}.address();
+		out.quota       = tracked.quota;
+		out.liveBytes   = tracked.quota - tracked.owner->quota;
+		out.peakBytes   = tracked.peakBytes;
+		out.allocations = tracked.allocations;
+		memcpy(out.histogram, tracked.histogram, sizeof(out.histogram));
+	}
+	return copied;
+#else
+	return -ENOTSUP;
+#endif
+}
+
+int heap_stats_get(SObj managementCapability, HeapStatistics *statistics)
+{
+	LockGuard g{lock};
+	check_gm();
+	if (!management_capability_is_valid(managementCapability))
+	{
+		return -EPERM;
+	}
+	if (!check_pointer<PermissionSet{Permission::Store}>(statistics))
+	{
+		return -EINVAL;
+	}
+	memset(statistics, 0, sizeof(*statistics));
+	arenas_for_each([&](MState &arena) { arena.statistics_add(*statistics); });
+	// Dedicated arenas are carved out of the shared heap, so their memory is
+	// already in its total.
+	statistics->totalSize = gm->heapTotalSize;
+	statistics->revocationSweeps         = revocationPolicy.sweeps_started();
+	statistics->revocationSweepsDeferred = revocationPolicy.sweeps_deferred();
+	statistics->revocationBytesReclaimed = revocationPolicy.bytes_reclaimed();
+	if constexpr (Revocation::SupportsSweepStatistics<Revocation::Revoker>)
+	{
+		const SoftwareRevokerStatistics *sweeps = revoker.sweep_statistics();
+		statistics->revocationLastSweepCycles   = sweeps->lastSweepCycles;
+		statistics->revocationMaxSweepCycles    = sweeps->maxSweepCycles;
+		statistics->revocationMaxPauseCycles    = sweeps->maxTickCycles;
+		statistics->revocationTickSize          = sweeps->tickSize;
+		statistics->revocationSweepsCompleted   = sweeps->sweeps;
+		statistics->revocationLastSweepTicks    = sweeps->lastSweepTicks;
+	}
+	else
+	{
+		statistics->revocationLastSweepCycles = 0;
+		statistics->revocationMaxSweepCycles  = 0;
+		statistics->revocationMaxPauseCycles  = 0;
+		statistics->revocationTickSize        = 0;
+		statistics->revocationSweepsCompleted = 0;
+		statistics->revocationLastSweepTicks  = 0;
+	}
+	return 0;
 }
@@ -4,6 +4,7 @@
 #pragma once
 #include "alloc_config.h"
 #include "software_revoker.h"
+#include <algorithm>
 #include <concepts>
 #include <riscvreg.h>
 #include <stdint.h>
@@ -56,6 +57,51 @@ namespace Revocation
 			} -> std::same_as<bool>;
 	};
 
+	/**
+	 * Revokers that do work only when they are kicked may accept a hint that
+	 * something is waiting for the current sweep, in which case they may do
+	 * more work per kick.
+	 */
+	template<typename T>
+	concept SupportsUrgentKick = requires(T v, bool urgent)
+	{
+		{
+			v.system_bg_revoker_kick(urgent)
+			} -> std::same_as<void>;
+	};
+
+	/**
+	 * Revokers that scan memory may keep a summary of which memory may
+	 * contain capabilities, so that they can skip memory that cannot.  The
+	 * allocator reports ranges that may have gained capabilities (because
+	 * they have left the free lists) and ranges that cannot contain
+	 * capabilities (because they are free and zeroed).
+	 */
+	template<typename T>
+	concept SupportsCapabilitySummary = requires(T         v,
+	                                             ptraddr_t base,
+	                                             ptraddr_t top)
+	{
+		{
+			v.capabilities_may_exist(base, top)
+			} -> std::same_as<void>;
+		{
+			v.capabilities_absent(base, top)
+			} -> std::same_as<void>;
+	};
+
+	/**
+	 * Revokers that time their own sweeps expose the timings through a
+	 * `sweep_statistics` method.
+	 */
+	template<typename T>
+	concept SupportsSweepStatistics = requires(T v)
+	{
+		{
+			v.sweep_statistics()
+			} -> std::same_as<const SoftwareRevokerStatistics *>;
+	};
+
 	/**
 	 * Class for interacting with the shadow bitmap.  This bitmap controls the
 	 * behaviour of a hardware load barrier, which will invalidate capabilities
@@ -351,6 +397,43 @@ namespace Revocation
 		 */
 		const uint32_t *epoch;
 
+		/**
+		 * A (read-only) pointer to the revoker's sweep statistics.
+		 */
+		const SoftwareRevokerStatistics *statistics;
+
+		/**
+		 * The summary of which heap granules may contain capabilities, which
+		 * the revoker uses to skip granules that cannot.
+		 */
+		SoftwareRevokerSummary *summary;
+
+		/**
+		 * Set (if `Fill`) or clear the summary bits for granules `first` to
+		 * `last` inclusive.
+		 */
+		template<bool Fill>
+		void summary_paint(size_t first, size_t last)
+		{
+			while (first <= last)
+			{
+				size_t   word  = first / 32;
+				size_t   shift = first % 32;
+				size_t   count = std::min<size_t>(32 - shift, last - first + 1);
+				uint32_t mask =
+				  (count == 32) ? ~0U : ((1U << count) - 1) << shift;
+				if constexpr (Fill)
+				{
+					summary->bits[word] |= mask;
+				}
+				else
+				{
+					summary->bits[word] &= ~mask;
+				}
+				first += count;
+			}
+		}
+
 		public:
 		/**
 		 * Software sweeping is implemented synchronously now. The sweeping is
@@ -365,7 +448,13 @@ namespace Revocation
 		void init()
 		{
 			Bitmap<WordT, TCMBaseAddr>::init();
-			epoch = revoker_epoch_get();
+			epoch      = revoker_epoch_get();
+			statistics = revoker_statistics_get();
+			summary    = revoker_summary_get();
+			// If another compartment has taken the summary then it can hide
+			// memory from the revoker.
+			Debug::Invariant(summary != nullptr,
+			                 "Software revoker summary already claimed");
 		}
 
 		/**
@@ -388,7 +477,7 @@ namespace Revocation
 			// time that it's queried.
 			if ((*epoch & 1) == 1)
 			{
-				revoker_tick();
+				revoker_tick(false);
 			}
 			if (AllowPartial)
 			{
@@ -411,10 +500,63 @@ namespace Revocation
 			return *epoch - previousEpoch >= (2 + (previousEpoch & 1));
 		}
 
-		/// Start revocation running.
-		void system_bg_revoker_kick()
+		/**
+		 * Start revocation running, or continue a running sweep.  If `urgent`
+		 * is true, the revoker does more work in this tick because something
+		 * is waiting for the sweep to finish.
+		 */
+		void system_bg_revoker_kick(bool urgent = false)
+		{
+			revoker_tick(urgent);
+		}
+
+		/// Returns the revoker's sweep timing statistics.
+		const SoftwareRevokerStatistics *sweep_statistics()
+		{
+			return statistics;
+		}
+
+		/**
+		 * Record that the memory between `base` and `top` may contain
+		 * capabilities.  Every granule that overlaps the range is marked.
+		 */
+		void capabilities_may_exist(ptraddr_t base, ptraddr_t top)
 		{
-			revoker_tick();
+			if ((top <= base) || (base < summary->base))
+			{
+				return;
+			}
+			size_t first = (base - summary->base) >> summary->granuleShift;
+			size_t last  = std::min<size_t>(
+			  (top - 1 - summary->base) >> summary->granuleShift,
+			  summary->granules - 1);
+			if (first <= last)
+			{
+				summary_paint<true>(first, last);
+			}
+		}
+
+		/**
+		 * Record that the memory between `base` and `top` contains no
+		 * capabilities.  Only granules that lie entirely within the range are
+		 * cleared, because the others may share memory with objects that do
+		 * contain capabilities.
+		 */
+		void capabilities_absent(ptraddr_t base, ptraddr_t top)
+		{
+			if ((top <= base) || (base < summary->base))
+			{
+				return;
+			}
+			size_t granule = size_t(1) << summary->granuleShift;
+			size_t first =
+			  (base - summary->base + granule - 1) >> summary->granuleShift;
+			size_t end = std::min<size_t>(
+			  (top - summary->base) >> summary->granuleShift, summary->granules);
+			if (first < end)
+			{
+				summary_paint<false>(first, end - 1);
+			}
 		}
 	};
 
@@ -456,18 +598,24 @@ namespace Revocation
 		}
 
 		/**
-		 * Queries whether the specified revocation epoch has finished.
+		 * Queries whether the specified revocation epoch has finished.  Every
+		 * kick is a complete sweep, so this is true once the revoker has been
+		 * kicked after `previousEpoch` was read.
 		 */
 		template<bool AllowPartial = false>
 		uint32_t has_revocation_finished_for_epoch(uint32_t previousEpoch)
 		{
-			return true;
+			return epoch > previousEpoch;
 		}
 
-		/// Start revocation running.  Fake revocation completes instantly.
+		/**
+		 * Run a revocation sweep.  Fake revocation completes instantly, so
+		 * this advances the epoch past both the start and the end of a sweep
+		 * and the epoch is never odd.
+		 */
 		void system_bg_revoker_kick()
 		{
-			epoch++;
+			epoch += 2;
 		}
 	};
 	/**
@@ -490,4 +638,161 @@ namespace Revocation
 #	endif
 #endif
 	  ;
+
+	/**
+	 * How urgently the allocator needs a revocation sweep.
+	 */
+	enum class SweepUrgency
+	{
+		/**
+		 * Quarantine has grown past the point where a sweep is worthwhile,
+		 * but nothing is waiting for it.  Sweeps may be deferred so that more
+		 * frees are reclaimed by a single sweep.
+		 */
+		Background,
+		/**
+		 * The system is idle and has asked for a sweep.  This is never
+		 * deferred, because nothing else is competing for the time, but the
+		 * sweep runs at the normal pace.
+		 */
+		Idle,
+		/**
+		 * Free memory is low.  Start a sweep even if one started recently.
+		 */
+		LowMemory,
+		/**
+		 * An allocation is blocked waiting for memory in quarantine.  Start a
+		 * sweep immediately.
+		 */
+		AllocationBlocked,
+	};
+
+	/**
+	 * The minimum number of cycles between the start of one background sweep
+	 * and the start of the next.  Background requests to start a sweep within
+	 * this window are deferred, so that frees arriving close together are
+	 * reclaimed by a single sweep.  More urgent requests are never deferred.
+	 */
+#ifndef CHERIOT_ALLOCATOR_MIN_SWEEP_INTERVAL
+#	define CHERIOT_ALLOCATOR_MIN_SWEEP_INTERVAL 0x10000
+#endif
+	constexpr uint64_t MinSweepIntervalCycles =
+	  CHERIOT_ALLOCATOR_MIN_SWEEP_INTERVAL;
+
+	/**
+	 * Revocation policy.  All requests to start a revocation sweep go through
+	 * this, which decides whether a new sweep is worth starting and counts
+	 * the sweeps that are started and the memory that they reclaim.
+	 *
+	 * Requests made while a sweep is already running are always passed to
+	 * the revoker, because the software revoker makes progress only when it
+	 * is kicked.
+	 */
+	class Policy
+	{
+		/// The number of sweeps that this policy has started.
+		uint32_t sweepsStarted = 0;
+		/// The number of background requests that were deferred.
+		uint32_t sweepsDeferred = 0;
+		/// The total number of bytes released from quarantine by sweeps.
+		uint64_t bytesReclaimed = 0;
+		/// The cycle count when the last sweep was started.
+		uint64_t lastSweepStartCycles = 0;
+		/// The epoch from which the last sweep was started.
+		uint32_t lastSweepStartEpoch = 0;
+		/**
+		 * Set when a background request has been deferred and no sweep has
+		 * started since.  Nothing retries a deferred request if the heap goes
+		 * idle, so paths that are about to sleep or fail call `kick_deferred`.
+		 */
+		bool deferredPending = false;
+
+		public:
+		/**
+		 * Ask `revoker` to start (or continue) a sweep with the given urgency.
+		 * Returns true if the revoker was kicked, false if the request was
+		 * deferred.
+		 */
+		template<typename R>
+		bool kick(R &revoker, SweepUrgency urgency)
+		{
+			uint32_t epoch    = revoker.system_epoch_get();
+			bool     starting = (epoch & 1) == 0;
+			uint64_t now      = rdcycle64();
+			if (starting && (urgency == SweepUrgency::Background) &&
+			    (sweepsStarted > 0) &&
+			    (now - lastSweepStartCycles < MinSweepIntervalCycles))
+			{
+				sweepsDeferred++;
+				deferredPending = true;
+				return false;
+			}
+			if constexpr (SupportsUrgentKick<R>)
+			{
+				revoker.system_bg_revoker_kick(urgency ==
+				                               SweepUrgency::AllocationBlocked);
+			}
+			else
+			{
+				revoker.system_bg_revoker_kick();
+			}
+			/*
+			 * A hardware revoker may not have advanced the epoch by the time
+			 * the kick returns, so a sweep is counted when it is requested
+			 * from an epoch that we have not already requested one from.
+			 */
+			if (starting &&
+			    ((sweepsStarted == 0) || (epoch != lastSweepStartEpoch)))
+			{
+				sweepsStarted++;
+				lastSweepStartCycles = now;
+				lastSweepStartEpoch  = epoch;
+			}
+			if (starting)
+			{
+				deferredPending = false;
+			}
+			return true;
+		}
+
+		/**
+		 * Start a sweep for a background request that was deferred, if there
+		 * is one, without deferring it again.  Callers that are about to
+		 * block or to report an allocation failure use this so that memory in
+		 * quarantine is not stranded when no later allocator call arrives.
+		 * Returns true if the revoker was kicked.
+		 */
+		template<typename R>
+		bool kick_deferred(R &revoker)
+		{
+			return deferredPending && kick(revoker, SweepUrgency::LowMemory);
+		}
+
+		/**
+		 * Record that a finished sweep has allowed `bytes` bytes to leave
+		 * quarantine.
+		 */
+		void reclaimed(size_t bytes)
+		{
+			bytesReclaimed += bytes;
+		}
+
+		/// Returns the number of sweeps started.
+		[[nodiscard]] uint32_t sweeps_started() const
+		{
+			return sweepsStarted;
+		}
+
+		/// Returns the number of background requests that were deferred.
+		[[nodiscard]] uint32_t sweeps_deferred() const
+		{
+			return sweepsDeferred;
+		}
+
+		/// Returns the number of bytes reclaimed by all sweeps.
+		[[nodiscard]] uint64_t bytes_reclaimed() const
+		{
+			return bytesReclaimed;
+		}
+	};
 } // namespace Revocation
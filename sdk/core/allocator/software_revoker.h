@@ -2,14 +2,39 @@
 // SPDX-License-Identifier: MIT
 
 #include <cdefs.h>
+#include <stddef.h>
 #include <stdint.h>
 
+/**
+ * Statistics about the software revoker's sweeps.  All times are in cycles.
+ */
+struct SoftwareRevokerStatistics
+{
+	/// The number of sweeps that have completed.
+	uint32_t sweeps;
+	/// The number of capabilities currently scanned by a normal tick.
+	uint32_t tickSize;
+	/// The time from the start to the end of the most recent sweep.
+	uint32_t lastSweepCycles;
+	/// The longest time from the start to the end of any sweep.
+	uint32_t maxSweepCycles;
+	/// The number of ticks that the most recent sweep took.
+	uint32_t lastSweepTicks;
+	/// The longest time spent scanning, with interrupts disabled, in one tick.
+	uint32_t maxTickCycles;
+};
+
 /**
  * Prod the software revoker to do some work.  This does not do a complete
  * revocation pass, it will scan a region of memory and then return.
+ *
+ * The amount of memory scanned is adjusted so that each tick takes around
+ * `CHERIOT_SOFTWARE_REVOKER_TICK_CYCLES` cycles.  If `urgent` is true, a
+ * larger region is scanned so that a sweep that something is waiting for
+ * finishes sooner, at the cost of a longer period with interrupts disabled.
  */
 [[cheri::interrupt_state(disabled)]] __cheri_compartment(
-  "software_revoker") void revoker_tick();
+  "software_revoker") void revoker_tick(bool urgent);
 
 /**
  * Returns a read-only capability to the current revocation epoch.  If the low
@@ -17,3 +42,45 @@
  * wrap, the caller is responsible for handling overflow.
  */
 const uint32_t *__cheri_compartment("software_revoker") revoker_epoch_get();
+
+/**
+ * Returns a read-only capability to the software revoker's statistics.
+ */
+const SoftwareRevokerStatistics *__cheri_compartment("software_revoker")
+  revoker_statistics_get();
+
+/**
+ * The number of 32-bit words in the software revoker's capability summary.
+ * Each bit covers one granule of the heap, and the granule size is chosen at
+ * run time to be the smallest power of two, no smaller than 512 bytes, for
+ * which this many bits cover the whole heap.
+ */
+static constexpr size_t SoftwareRevokerSummaryWords = 128;
+
+/**
+ * A coarse summary of which parts of the heap may contain capabilities.  The
+ * software revoker does not scan granules whose bit is clear.  The allocator
+ * sets the bits for memory that leaves the free lists and clears them for
+ * granules that lie entirely within free (and therefore zeroed) chunks.
+ */
+struct SoftwareRevokerSummary
+{
+	/// The address of the start of the heap.  Granule 0 starts here.
+	ptraddr_t base;
+	/// The base-two logarithm of the size of a granule, in bytes.
+	uint32_t granuleShift;
+	/// The number of granules that cover the heap.
+	uint32_t granules;
+	/// One bit per granule, set if the granule may contain capabilities.
+	uint32_t bits[SoftwareRevokerSummaryWords];
+};
+
+/**
+ * Returns a writeable capability to the software revoker's capability
+ * summary, with every bit set.  Until this is called, the revoker scans the
+ * entire heap.  This returns a valid capability only once: it is intended to
+ * be called by the allocator and any subsequent call returns null.  The
+ * linker audit report shows which compartments can call this.
+ */
+[[cheri::interrupt_state(disabled)]] SoftwareRevokerSummary *
+  __cheri_compartment("software_revoker") revoker_summary_get();
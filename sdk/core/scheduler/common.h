@@ -29,6 +29,19 @@ namespace
 #endif
 	  ;
 
+	/**
+	 * Is the scheduler tickless?  If so, the timer is programmed to fire only
+	 * when a thread's timeout expires or a time slice ends, rather than on
+	 * every tick.
+	 */
+	constexpr bool Tickless =
+#ifdef SCHEDULER_TICKLESS
+	  SCHEDULER_TICKLESS
+#else
+	  false
+#endif
+	  ;
+
 	using Debug = ConditionalDebug<DebugScheduler, "Scheduler">;
 	/**
 	 * Base class for types that are exported from the scheduler with a common
@@ -60,9 +60,32 @@ static uint64_t cyclesAtLastSchedulingEvent;
 namespace
 {
 	/**
-	 * Priority-sorted list of threads waiting for a futex.
+	 * The number of wait queues for futexes.  Must be a power of two.
 	 */
-	Thread *futexWaitingList;
+	constexpr size_t FutexWaitQueues = 16;
+
+	static_assert((FutexWaitQueues & (FutexWaitQueues - 1)) == 0,
+	              "The number of futex wait queues must be a power of two");
+
+	/**
+	 * Priority-sorted lists of threads waiting for a futex.  Each futex
+	 * address maps to one queue (see `futex_wait_queue`), so waking a futex
+	 * considers only the threads waiting on futexes that share its queue.
+	 */
+	Thread *futexWaitQueues[FutexWaitQueues];
+
+	/**
+	 * Returns the wait queue for the futex at `key`.
+	 */
+	Thread *&futex_wait_queue(ptraddr_t key)
+	{
+		// Futex words are 4-byte aligned, so discard the low bits and then use
+		// Fibonacci hashing so that nearby futexes (for example, adjacent
+		// fields of one object) use different queues.
+		constexpr uint32_t Multiplier = 0x9e3779b1;
+		constexpr uint32_t Shift      = 32 - __builtin_ctz(FutexWaitQueues);
+		return futexWaitQueues[((key >> 2) * Multiplier) >> Shift];
+	}
 
 	/**
 	 * The value used for priority-boosting futexes that are not actually
@@ -82,13 +105,18 @@ namespace
 	 */
 	uint8_t priority_boost_for_thread(uint16_t threadID, uint8_t priority = 0)
 	{
-		Thread::walk_thread_list(futexWaitingList, [&](Thread *thread) {
-			if ((thread->futexPriorityInheriting) &&
-			    (thread->futexPriorityBoostedThread == threadID))
-			{
-				priority = std::max(priority, thread->priority_get());
-			}
-		});
+		// The boosting threads may be waiting on any futex (the boosted
+		// thread may hold more than one lock), so visit every queue.
+		for (Thread *&queue : futexWaitQueues)
+		{
+			Thread::walk_thread_list(queue, [&](Thread *thread) {
+				if ((thread->futexPriorityInheriting) &&
+				    (thread->futexPriorityBoostedThread == threadID))
+				{
+					priority = std::max(priority, thread->priority_get());
+				}
+			});
+		}
 		return priority;
 	}
 
@@ -98,9 +126,9 @@ namespace
 	 */
 	void priority_boost_update(ptraddr_t key, uint16_t threadID)
 	{
-		Thread::walk_thread_list(futexWaitingList, [&](Thread *thread) {
+		Thread::walk_thread_list(futex_wait_queue(key), [&](Thread *thread) {
 			if ((thread->futexPriorityInheriting) &&
-			    (thread->futexWaitAddress = key))
+			    (thread->futexWaitAddress == key))
 			{
 				thread->futexPriorityBoostedThread = threadID;
 			}
@@ -119,9 +147,9 @@ namespace
 	 */
 	void priority_boost_reset(ptraddr_t key, uint16_t threadID)
 	{
-		Thread::walk_thread_list(futexWaitingList, [&](Thread *thread) {
+		Thread::walk_thread_list(futex_wait_queue(key), [&](Thread *thread) {
 			if ((thread->futexPriorityInheriting) &&
-			    (thread->futexWaitAddress = key))
+			    (thread->futexWaitAddress == key))
 			{
 				if (thread->futexPriorityBoostedThread == threadID)
 				{
@@ -158,7 +186,7 @@ namespace
 		// success.
 		int woke = 0;
 		Thread::walk_thread_list(
-		  futexWaitingList,
+		  futex_wait_queue(key),
 		  [&](Thread *thread) {
 			  if (thread->futexWaitAddress == key)
 			  {
@@ -270,6 +298,9 @@ namespace sched
 
 		ExceptionGuard g{[=]() { sched_panic(mcause, mepc, mtval); }};
 
+		// In tickless mode, time may have passed without a timer interrupt.
+		Timer::update();
+
 		switch (mcause)
 		{
 			// Explicit yield call
@@ -312,6 +343,7 @@ namespace sched
 		}
 		auto newContext =
 		  schedNeeded ? Thread::schedule(sealedTStack) : sealedTStack;
+		Timer::update_next();
 
 		if constexpr (Accounting)
 		{
@@ -410,6 +442,7 @@ using namespace sched;
 // thread APIs
 SystickReturn __cheri_compartment("sched") thread_systemtick_get()
 {
+	Timer::update();
 	uint64_t      ticks = Thread::ticksSinceBoot;
 	uint32_t      hi    = ticks >> 32;
 	uint32_t      lo    = ticks;
@@ -424,10 +457,29 @@ int __cheri_compartment("sched") thread_sleep(Timeout *timeout)
 	{
 		return -EINVAL;
 	}
+	Timer::update();
 	Thread::current_get()->suspend(timeout, nullptr, true);
 	return 0;
 }
 
+uint64_t __cheri_compartment("sched") thread_timer_get()
+{
+	Timer::update();
+	return Thread::timerValue;
+}
+
+int __cheri_compartment("sched") thread_sleep_until(uint64_t deadline)
+{
+	if (deadline == 0)
+	{
+		return -EINVAL;
+	}
+	Timer::update();
+	Timeout timeout = Timeout::until(deadline);
+	Thread::current_get()->suspend(&timeout, nullptr, true);
+	return 0;
+}
+
 int futex_timed_wait(Timeout        *timeout,
                      const uint32_t *address,
                      uint32_t        expected,
@@ -480,7 +532,8 @@ int futex_timed_wait(Timeout        *timeout,
 		owningThread->priority_boost(priority_boost_for_thread(
 		  owningThreadID, currentThread->priority_get()));
 	}
-	currentThread->suspend(timeout, &futexWaitingList);
+	Timer::update();
+	currentThread->suspend(timeout, &futex_wait_queue(key));
 	bool timedout                   = currentThread->futexWaitAddress == 0;
 	currentThread->futexWaitAddress = 0;
 	if (isPriorityInheriting)
@@ -512,6 +565,51 @@ int futex_timed_wait(Timeout        *timeout,
 	return 0;
 }
 
+namespace
+{
+	/**
+	 * Common tail for the futex wake entry points.  Drops any priority boost
+	 * that the caller received from priority-inheriting waiters on `key` and
+	 * then either yields (if a higher-priority thread is now runnable) or
+	 * updates the timer for any new time slice that is needed.
+	 */
+	void futex_wake_finish(ptraddr_t key, bool shouldYield, bool shouldReset)
+	{
+		// If this futex wake is dropping a priority boost, reset the boost.
+		if (shouldReset)
+		{
+			Thread *currentThread = Thread::current_get();
+			// We are removing ourself from the priority boost from *this*
+			// futex, we may still be boosted by another futex, but we have
+			// just dropped the lock and so we should not be boosted so clear
+			// this thread as the target for other priority boosts.
+			priority_boost_reset(key, currentThread->id_get());
+			// If we have nested priority-inheriting locks, we may have dropped
+			// the inner one but still hold the outer one.  In this case, we
+			// need to keep the priority boost.  Similarly, if we've done a
+			// notify-one operation but two threads were blocked on a
+			// priority-inheriting futex, then we need to keep the priority
+			// boost from the other threads.
+			currentThread->priority_boost(
+			  priority_boost_for_thread(currentThread->id_get()));
+			// If we have dropped priority below that of another runnable
+			// thread, we should yield now.
+			shouldYield |= !currentThread->is_highest_priority();
+		}
+
+		if (shouldYield)
+		{
+			Thread::yield_interrupt_enabled();
+		}
+		else
+		{
+			// If we woke a thread at our priority, we now need a time slice.
+			Timer::update();
+			Timer::update_next();
+		}
+	}
+} // namespace
+
 int futex_wake(uint32_t *address, uint32_t count)
 {
 	if (!check_pointer<PermissionSet{Permission::Store}>(address))
@@ -522,34 +620,90 @@ int futex_wake(uint32_t *address, uint32_t count)
 
 	auto [shouldYield, shouldResetPrioirity, woke] = futex_wake(key, count);
 
-	// If this futex wake is dropping a priority boost, reset the boost.
-	if (shouldResetPrioirity)
+	futex_wake_finish(key, shouldYield, shouldResetPrioirity);
+
+	return woke;
+}
+
+int futex_requeue(uint32_t       *from,
+                  const uint32_t *to,
+                  uint32_t        expected,
+                  uint32_t        wakeCount,
+                  uint32_t        requeueCount)
+{
+	if (!check_pointer<PermissionSet{Permission::Store}>(from) ||
+	    !check_pointer<PermissionSet{Permission::Load}>(to))
 	{
-		Thread *currentThread = Thread::current_get();
-		// We are removing ourself from the priority boost from *this* futex,
-		// we may still be boosted by another futex, but we have just dropped
-		// the lock and so we should not be boosted so clear this thread as the
-		// target for other priority boosts.
-		priority_boost_reset(key, currentThread->id_get());
-		// If we have nested priority-inheriting locks, we may have dropped the
-		// inner one but still hold the outer one.  In this case, we need to
-		// keep the priority boost.  Similarly, if we've done a notify-one
-		// operation but two threads were blocked on a priority-inheriting
-		// futex, then we need to keep the priority boost from the other
-		// threads.
-		currentThread->priority_boost(
-		  priority_boost_for_thread(currentThread->id_get()));
-		// If we have dropped priority below that of another runnable thread, we
-		// should yield now.
-		shouldYield |= !currentThread->is_highest_priority();
+		return -EINVAL;
+	}
+	// This runs with interrupts disabled, so nothing can change `to` between
+	// this check and moving the waiters.
+	if (*to != expected)
+	{
+		Debug::log("futex_requeue: {} != {}, not requeueing", *to, expected);
+		return -EAGAIN;
 	}
+	ptraddr_t fromKey = Capability{from}.address();
+	ptraddr_t toKey   = Capability{to}.address();
 
-	if (shouldYield)
+	bool shouldYield          = false;
+	bool shouldResetPrioirity = false;
+	int  woke                 = 0;
+	if (wakeCount > 0)
 	{
-		Thread::yield_interrupt_enabled();
+		std::tie(shouldYield, shouldResetPrioirity, woke) =
+		  futex_wake(fromKey, wakeCount);
 	}
 
-	return woke;
+	// Move up to `requeueCount` of the remaining waiters to the new futex
+	// word.  None of these threads becomes runnable.
+	int       requeued  = 0;
+	Thread  **fromQueue = &futex_wait_queue(fromKey);
+	Thread  **toQueue   = &futex_wait_queue(toKey);
+	Debug::log("Requeueing up to {} waiters from {} to {}",
+	           requeueCount,
+	           from,
+	           to);
+	Thread::walk_thread_list(
+	  *fromQueue,
+	  [&](Thread *thread) {
+		  if (thread->futexWaitAddress != fromKey)
+		  {
+			  return;
+		  }
+		  thread->futexWaitAddress = toKey;
+		  // If the two words hash to different queues, move the thread.  The
+		  // walk has already read the next pointer, so this is safe.
+		  if (fromQueue != toQueue)
+		  {
+			  thread->list_remove(fromQueue);
+			  thread->list_insert(toQueue);
+			  thread->sleepQueue = toQueue;
+		  }
+		  // The owner of the old futex is not the owner of the new one, so
+		  // stop boosting it.  The waiter will not boost the owner of the new
+		  // futex until it waits again.
+		  if (thread->futexPriorityInheriting)
+		  {
+			  uint16_t boosted = thread->futexPriorityBoostedThread;
+			  thread->futexPriorityInheriting    = false;
+			  thread->futexPriorityBoostedThread = FutexBoostNotThread;
+			  if (Thread *owner = get_thread(boosted); owner != nullptr)
+			  {
+				  owner->priority_boost(priority_boost_for_thread(boosted));
+			  }
+			  // If we were the boosted thread, we may no longer be the
+			  // highest-priority runnable thread.
+			  shouldYield |= !Thread::current_get()->is_highest_priority();
+		  }
+		  requeueCount--;
+		  requeued++;
+	  },
+	  [&]() { return requeueCount == 0; });
+
+	futex_wake_finish(fromKey, shouldYield, shouldResetPrioirity);
+
+	return woke + requeued;
 }
 
 int multiwaiter_create(Timeout           *timeout,
@@ -609,6 +763,7 @@ int multiwaiter_wait(Timeout           *timeout,
 				Debug::log("Sleeping for {} ticks", timeout->remaining);
 				if (timeout->may_block())
 				{
+					Timer::update();
 					mw.wait(timeout);
 					// If we yielded then it's possible for either of the
 					// pointers that we were passed to have been freed out from
@@ -7,6 +7,7 @@
 #include <cdefs.h>
 #include <priv/riscv.h>
 #include <strings.h>
+#include <tick_macros.h>
 #include <utils.hh>
 
 namespace
@@ -60,7 +61,21 @@ namespace
 		 * disabled.
 		 */
 		static inline uint64_t ticksSinceBoot;
-		/// All threads that are suspended must be on this list.
+		/**
+		 * The value of the system timer at the start of the current tick.
+		 * Timeouts in ticks expire a whole number of ticks after this.
+		 */
+		static inline uint64_t tickStartTime;
+		/**
+		 * The value of the system timer when the scheduler was last entered.
+		 */
+		static inline uint64_t timerValue;
+		/**
+		 * The root of the pairing heap of threads that are suspended with a
+		 * timeout, ordered by expiry time.  The root is the thread that will
+		 * expire first.  Threads that are suspended without a timeout are not
+		 * in the heap.
+		 */
 		static inline ThreadImpl *waitingList;
 
 		/// Returns the current running thread.
@@ -154,9 +169,15 @@ namespace
 		             ThreadImpl **newSleepQueue,
 		             bool         yieldUnconditionally = false)
 		{
+			uint64_t deadline = t->deadline;
+			// A deadline that has already passed behaves like a zero timeout.
+			if ((deadline != 0) && (deadline <= timerValue))
+			{
+				t->remaining = 0;
+			}
 			if (t->remaining != 0)
 			{
-				suspend(t->remaining, newSleepQueue);
+				suspend(t->remaining, newSleepQueue, deadline);
 			}
 			if ((t->remaining != 0) || yieldUnconditionally)
 			{
@@ -164,6 +185,10 @@ namespace
 				if (CHERI::Capability{t}.is_valid())
 				{
 					t->elapse(elapsed);
+					if ((deadline != 0) && (deadline <= timerValue))
+					{
+						t->remaining = 0;
+					}
 					if (t->remaining > 0)
 					{
 						return false;
@@ -193,8 +218,8 @@ namespace
 		{
 			static_assert(NPrios <
 			              std::numeric_limits<decltype(priority)>::max());
-			// All threads are created in blocked state.
-			timer_list_insert(&waitingList);
+			// All threads are created in blocked state, with no timeout and so
+			// not in the timer heap.
 		}
 
 		/**
@@ -277,8 +302,13 @@ namespace
 		 * Suspend this thread. Take it off the ready list. If it is suspended
 		 * waiting on a resource, add it to the list of that resource. No
 		 * matter what, it has to be added to the timer list.
+		 *
+		 * The thread wakes after `waitTicks` ticks or, if `deadline` is not
+		 * zero and is earlier, when the system timer reaches `deadline`.
 		 */
-		void suspend(uint32_t waitTicks, ThreadImpl **newSleepQueue)
+		void suspend(uint32_t     waitTicks,
+		             ThreadImpl **newSleepQueue,
+		             uint64_t     deadline = 0)
 		{
 			Debug::Assert(state == ThreadState::Ready,
 			              "Suspending thread that is in state {}, not ready",
@@ -291,8 +321,14 @@ namespace
 				list_insert(newSleepQueue);
 				sleepQueue = newSleepQueue;
 			}
-			expiryTime =
-			  (waitTicks == UINT32_MAX ? -1 : ticksSinceBoot + waitTicks);
+			expiryTime = (waitTicks == UINT32_MAX)
+			               ? -1
+			               : tickStartTime + static_cast<uint64_t>(waitTicks) *
+			                                   TIMERCYCLES_PER_TICK;
+			if (deadline != 0)
+			{
+				expiryTime = std::min(expiryTime, deadline);
+			}
 
 			timer_list_insert(&waitingList);
 		}
@@ -330,6 +366,15 @@ namespace
 			}
 		}
 
+		/**
+		 * Returns true if this thread is runnable and another thread at the
+		 * same priority is also runnable, and so the two must share the CPU.
+		 */
+		bool time_slice_needed()
+		{
+			return (state == ThreadState::Ready) && (next != this);
+		}
+
 		/**
 		 * Returns true if this thread is running with the highest priority of
 		 * any runnable threads.
@@ -399,44 +444,22 @@ namespace
 			}
 		}
 
-		/// Same as list_insert(), but sorted on ExpiryTime.
+		/**
+		 * Insert self into the timer heap rooted at `*headPtr`.  Does nothing
+		 * if this thread has no timeout.  This is O(1).
+		 */
 		void timer_list_insert(ThreadImpl **headPtr)
 		{
-			ThreadImpl *head = *headPtr;
-
 			Debug::Assert(state == ThreadState::Suspended,
 			              "Inserting thread into timer list that is in state "
 			              "{}, not suspended",
 			              state);
-			if (head == nullptr)
-			{
-				timerNext = timerPrev = *headPtr = this;
-			}
-			else
+			if (expiryTime == std::numeric_limits<uint64_t>::max())
 			{
-				ThreadImpl *iter = head->timerPrev;
-				ThreadImpl *iterNext;
-
-				// Go back from tail, and stop at the first Thread whose expiry
-				// <= ours.
-				while (iter->expiryTime > expiryTime)
-				{
-					iter = iter->timerPrev;
-					if (iter == head->timerPrev)
-					{
-						break;
-					}
-				}
-				iterNext        = iter->timerNext;
-				iter->timerNext = iterNext->timerPrev = this;
-				timerNext                             = iterNext;
-				timerPrev                             = iter;
-
-				if (expiryTime < head->expiryTime)
-				{
-					*headPtr = this;
-				}
+				return;
 			}
+			timerPrev = timerNext = timerChild = nullptr;
+			*headPtr                           = timer_heap_meld(*headPtr, this);
 		}
 
 		/// Remove self from the list headPtr points to.
@@ -470,35 +493,108 @@ namespace
 			next = prev = nullptr;
 		}
 
-		/// Same as list_remove(), but for the timer list.
+		/**
+		 * Remove self from the timer heap rooted at `*headPtr`.  Does nothing
+		 * if this thread has no timeout.  This is O(log n) amortised.
+		 */
 		void timer_list_remove(ThreadImpl **headPtr)
 		{
-			ThreadImpl *head = *headPtr;
-
-			if (timerNext == this)
+			if (expiryTime == std::numeric_limits<uint64_t>::max())
 			{
-				// We are the only one left on this list, clear the head.
-				Debug::Assert(timerPrev == this,
-				              "Invalid loop in thread list.  Next pointer "
-				              "points to this ({}) but previous pointer is {}",
-				              this,
-				              timerPrev);
-				*headPtr = nullptr;
+				return;
+			}
+			ThreadImpl *children = timer_heap_merge_pairs(timerChild);
+			if (*headPtr == this)
+			{
+				*headPtr = children;
 			}
 			else
 			{
-				ThreadImpl *prevThread = timerPrev;
-				ThreadImpl *nextThread = timerNext;
+				// Unlink this subtree from its parent (if we are the leftmost
+				// child) or from our left sibling, then add our children back
+				// to the heap.
+				if (timerPrev->timerChild == this)
+				{
+					timerPrev->timerChild = timerNext;
+				}
+				else
+				{
+					timerPrev->timerNext = timerNext;
+				}
+				if (timerNext != nullptr)
+				{
+					timerNext->timerPrev = timerPrev;
+				}
+				*headPtr = timer_heap_meld(*headPtr, children);
+			}
+			timerPrev = timerNext = timerChild = nullptr;
+		}
 
-				prevThread->timerNext = nextThread;
-				nextThread->timerPrev = prevThread;
+		/**
+		 * Meld two timer heaps, either of which may be empty, and return the
+		 * root of the result.  The roots must not have siblings.
+		 */
+		static ThreadImpl *timer_heap_meld(ThreadImpl *a, ThreadImpl *b)
+		{
+			if (a == nullptr)
+			{
+				return b;
+			}
+			if (b == nullptr)
+			{
+				return a;
+			}
+			if (b->expiryTime < a->expiryTime)
+			{
+				std::swap(a, b);
+			}
+			// Make `b` the leftmost child of `a`.
+			b->timerPrev = a;
+			b->timerNext = a->timerChild;
+			if (a->timerChild != nullptr)
+			{
+				a->timerChild->timerPrev = b;
+			}
+			a->timerChild = b;
+			return a;
+		}
 
-				if (head == this)
+		/**
+		 * Combine a list of sibling heaps (linked via `timerNext`) into a
+		 * single heap with the standard two-pass pairing: meld adjacent pairs
+		 * left to right, then meld the results right to left.  This is
+		 * iterative to bound the scheduler's stack usage.
+		 */
+		static ThreadImpl *timer_heap_merge_pairs(ThreadImpl *first)
+		{
+			// First pass.  The melded pairs are pushed onto a list (again via
+			// `timerNext`), which leaves them in reverse order for the second
+			// pass.
+			ThreadImpl *pairs = nullptr;
+			while (first != nullptr)
+			{
+				ThreadImpl *a = first;
+				ThreadImpl *b = a->timerNext;
+				first         = (b == nullptr) ? nullptr : b->timerNext;
+				a->timerPrev = a->timerNext = nullptr;
+				if (b != nullptr)
 				{
-					*headPtr = timerNext;
+					b->timerPrev = b->timerNext = nullptr;
 				}
+				ThreadImpl *pair = timer_heap_meld(a, b);
+				pair->timerNext  = pairs;
+				pairs            = pair;
+			}
+			// Second pass.
+			ThreadImpl *root = nullptr;
+			while (pairs != nullptr)
+			{
+				ThreadImpl *pair = pairs;
+				pairs            = pair->timerNext;
+				pair->timerNext  = nullptr;
+				root             = timer_heap_meld(root, pair);
 			}
-			timerNext = timerPrev = nullptr;
+			return root;
 		}
 
 		uint16_t id_get()
@@ -524,16 +620,22 @@ namespace
 		ThreadImpl *prev;
 		ThreadImpl *next;
 		///@}
-		/// Linked list fields to the global timer list, when this thread is
-		/// blocked with a timeout.
+		/**
+		 * Pairing heap fields for the timer heap, when this thread is blocked
+		 * with a timeout.  `timerPrev` points to the parent if this is the
+		 * leftmost child and to the left sibling otherwise, `timerNext` to
+		 * the right sibling, and `timerChild` to the leftmost child.
+		 */
 		///@{
 		ThreadImpl *timerPrev;
 		ThreadImpl *timerNext;
+		ThreadImpl *timerChild;
 		///@}
 		/// Pointer to the list of the resource this thread is blocked on.
 		ThreadImpl **sleepQueue;
-		/// If suspended, when will this thread expire. The maximum value is
-		/// special-cased to mean blocked indefinitely.
+		/// If suspended, the value of the system timer at which this thread
+		/// will expire. The maximum value is special-cased to mean blocked
+		/// indefinitely.
 		uint64_t expiryTime;
 
 		/// The number of cycles that this thread has been scheduled for.
@@ -5,6 +5,8 @@
 
 #include "plic.h"
 #include "thread.h"
+#include <algorithm>
+#include <concepts>
 #include <platform-timer.hh>
 #include <stdint.h>
 #include <tick_macros.h>
@@ -13,13 +15,18 @@
 namespace
 {
 	/**
-	 * Concept for the interface to setting the system timer.
+	 * Concept for the interface to the system timer.  Timers must be able to
+	 * report the current time and to deliver an interrupt after a number of
+	 * cycles.
 	 */
 	template<typename T>
 	concept IsTimer = requires(uint32_t cycles)
 	{
 		{T::init()};
 		{T::setnext(cycles)};
+		{
+			T::time()
+			} -> std::same_as<uint64_t>;
 	};
 
 	static_assert(
@@ -28,6 +35,12 @@ namespace
 
 	class Timer final : private TimerCore
 	{
+		/**
+		 * In tickless mode, the value of the timer when the scheduler
+		 * started.  Ticks are counted from here.
+		 */
+		static inline uint64_t timeAtBoot;
+
 		public:
 		static void interrupt_setup()
 		{
@@ -35,42 +48,110 @@ namespace
 			              "Cycles per tick can't be represented in 32 bits. "
 			              "Double check your platform config");
 			init();
-			setnext(TIMERCYCLES_PER_TICK);
+			timeAtBoot = time();
+			update();
+			Thread::tickStartTime = timeAtBoot;
+			if constexpr (Tickless)
+			{
+				update_next();
+			}
+			else
+			{
+				setnext(TIMERCYCLES_PER_TICK);
+			}
 		}
 
 		static void do_interrupt()
 		{
-			++Thread::ticksSinceBoot;
+			update();
+			if constexpr (!Tickless)
+			{
+				++Thread::ticksSinceBoot;
+				Thread::tickStartTime = Thread::timerValue;
+			}
 
 			expiretimers();
-			setnext(TIMERCYCLES_PER_TICK);
+			// In tickless mode, the next interrupt is programmed by
+			// `update_next` once the scheduler has picked a thread to run.
+			if constexpr (!Tickless)
+			{
+				setnext(TIMERCYCLES_PER_TICK);
+			}
 		}
 
-		private:
-		static void expiretimers()
+		/**
+		 * Record the current value of the timer.  In tickless mode, also
+		 * recompute the number of ticks since boot: the timer interrupt does
+		 * not fire on every tick in this mode and so the tick count is
+		 * derived from the timer.  This must be called on entry to the
+		 * scheduler before anything uses `Thread::ticksSinceBoot`, or
+		 * computes an expiry time.  Must be called with interrupts disabled.
+		 */
+		static void update()
 		{
-			if (Thread::waitingList == nullptr)
+			Thread::timerValue = time();
+			if constexpr (Tickless)
 			{
-				return;
+				Thread::ticksSinceBoot =
+				  (Thread::timerValue - timeAtBoot) / TIMERCYCLES_PER_TICK;
+				Thread::tickStartTime =
+				  timeAtBoot + Thread::ticksSinceBoot * TIMERCYCLES_PER_TICK;
 			}
-			for (Thread *iter = Thread::waitingList;;)
+		}
+
+		/**
+		 * In tickless mode, program the timer to fire at the next point
+		 * where the scheduler has work to do: the earliest expiry time of a
+		 * waiting thread, or the end of the current tick if another thread
+		 * at the same priority as the running thread is ready and so the two
+		 * must be time sliced.  If neither applies, no interrupt is needed
+		 * and the timer is set as far ahead as it can be.
+		 *
+		 * Must be called with interrupts disabled, after `update`, whenever
+		 * the set of waiting or runnable threads may have changed.
+		 *
+		 * Does nothing in ticked mode.
+		 */
+		static void update_next()
+		{
+			if constexpr (Tickless)
 			{
-				if (iter->expiryTime <= Thread::ticksSinceBoot)
+				uint64_t next = std::numeric_limits<uint64_t>::max();
+				if (Thread::waitingList != nullptr)
 				{
-					Thread *iterNext = iter->timerNext;
-
-					iter->ready(Thread::WakeReason::Timer);
-					iter = iterNext;
-					if (Thread::waitingList == nullptr ||
-					    iter == Thread::waitingList)
-					{
-						break;
-					}
+					next = Thread::waitingList->expiryTime;
 				}
-				else
+				Thread *current = Thread::current_get();
+				if ((current != nullptr) && current->time_slice_needed())
 				{
-					break;
+					next = std::min(next,
+					                Thread::tickStartTime + TIMERCYCLES_PER_TICK);
 				}
+				uint64_t now = time();
+				// If the deadline has already passed, fire as soon as
+				// possible.  Waits that are too long to express are split
+				// into several interrupts.
+				setnext(next <= now ? 1
+				                    : std::min<uint64_t>(
+				                        next - now,
+				                        std::numeric_limits<uint32_t>::max()));
+			}
+		}
+
+		private:
+		/**
+		 * Wake all threads whose expiry time is no later than the time at
+		 * which the scheduler was entered.  In ticked mode, that is the start
+		 * of the current tick.
+		 */
+		static void expiretimers()
+		{
+			// The root of the heap is always the thread that expires first.
+			// Readying it removes it from the heap.
+			while ((Thread::waitingList != nullptr) &&
+			       (Thread::waitingList->expiryTime <= Thread::timerValue))
+			{
+				Thread::waitingList->ready(Thread::WakeReason::Timer);
 			}
 		}
 	};
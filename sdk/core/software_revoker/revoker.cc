@@ -5,7 +5,9 @@
 #include <array>
 #include <cheri.hh>
 #include <debug.hh>
+#include <riscvreg.h>
 #include <utility>
+#include <utils.hh>
 
 using CHERI::Capability;
 using CHERI::Permission;
@@ -95,12 +97,96 @@ namespace
 	}
 
 	/**
-	 * The number of capabilities to scan per tick.  This probably needs some
-	 * tuning.  Invoking the revoker costs around 400 cycles on Flute, so we're
-	 * likely to be spending about half of our total time on domain transitions
-	 * with a value <100.
+	 * The number of cycles that a single tick should take.  Ticks run with
+	 * interrupts disabled, so this bounds the interrupt latency that the
+	 * revoker adds to the system.  The number of capabilities scanned per
+	 * tick is adjusted to keep ticks close to this length.
 	 */
-	static constexpr size_t TickSize = 4096;
+#ifndef CHERIOT_SOFTWARE_REVOKER_TICK_CYCLES
+#	define CHERIOT_SOFTWARE_REVOKER_TICK_CYCLES 16384
+#endif
+	constexpr uint32_t TargetTickCycles = CHERIOT_SOFTWARE_REVOKER_TICK_CYCLES;
+
+	/**
+	 * The smallest number of capabilities to scan per tick.  Invoking the
+	 * revoker costs around 400 cycles on Flute, so we're likely to be
+	 * spending about half of our total time on domain transitions with a
+	 * value <100.
+	 */
+	constexpr size_t MinTickSize = 256;
+
+	/**
+	 * The largest number of capabilities to scan per tick.
+	 */
+	constexpr size_t MaxTickSize = 16384;
+
+	/**
+	 * Urgent ticks, requested when an allocation is waiting for revocation,
+	 * scan this many times the normal tick size (up to `MaxTickSize`), trading
+	 * a longer interrupts-disabled window for finishing the sweep sooner.
+	 */
+	constexpr size_t UrgentTickMultiplier = 4;
+
+	/**
+	 * The number of capabilities to scan in the first tick, which is
+	 * reasonable for most cores.
+	 */
+	constexpr size_t InitialTickSize = 4096;
+
+	/**
+	 * The number of capabilities to scan per tick.  This is adjusted after
+	 * each full tick towards `TargetTickCycles`.
+	 */
+	size_t tickSize = InitialTickSize;
+
+	/**
+	 * The cycle count when the current sweep started.
+	 */
+	uint64_t sweepStartCycles;
+
+	/**
+	 * The number of ticks in the current sweep.
+	 */
+	uint32_t sweepTicks;
+
+	/**
+	 * Statistics exposed read-only to the allocator.
+	 */
+	SoftwareRevokerStatistics statistics = {0, InitialTickSize, 0, 0, 0, 0};
+
+	/**
+	 * The base-two logarithm of the smallest granule size, in bytes, for the
+	 * capability summary.
+	 */
+	constexpr size_t MinGranuleShift = 9;
+
+	/**
+	 * The summary of which heap granules may contain capabilities.  This is
+	 * maintained by the allocator once it has asked for it.
+	 */
+	SoftwareRevokerSummary summary;
+
+	/**
+	 * True once `summary` has been handed out and initialised.  Until then,
+	 * the whole heap is scanned.
+	 */
+	bool summaryShared;
+
+	/**
+	 * The base-two logarithm of the granule size, in pointer-sized units.
+	 * This is kept separately from the copy in `summary`, which the allocator
+	 * can write.
+	 */
+	size_t granuleWordShift;
+
+	/**
+	 * Returns true if the granule with the given index may contain
+	 * capabilities.
+	 */
+	bool granule_may_contain_capabilities(size_t granule)
+	{
+		return (summary.bits[granule / 32] & (1U << (granule % 32))) != 0;
+	}
 
 	/**
 	 * Advance the state machine to the next state.
@@ -113,6 +199,8 @@ namespace
 		{
 			epoch++;
 			assert((epoch & 1) == 1);
+			sweepStartCycles = rdcycle64();
+			sweepTicks       = 0;
 		}
 		// Find the next state.
 		auto [nextRange, nextState] = next();
@@ -135,39 +223,108 @@ namespace
 	}
 
 	/**
-	 * Scan a fixed-size range of the current memory region.
+	 * Scan up to `budget` capabilities of the current memory region.  Returns
+	 * the amount of work done, which is the number of capabilities scanned
+	 * plus the number of heap granules skipped because the capability summary
+	 * says that they cannot contain capabilities.
 	 */
-	void scan_range()
+	size_t scan_range(size_t budget)
 	{
-		size_t end     = offset + std::min(length - offset, TickSize);
-		auto   current = get_globals(currentRange);
-		// With interrupts disabled, loading and storing a capability will
-		// clear the tag on anything that has been revoked via the load
-		// barrier.
-		for (int i = offset; i < end; i++)
+		auto   current    = get_globals(currentRange);
+		bool   useSummary = summaryShared && (state == State::ScanningHeap);
+		size_t work       = 0;
+		while ((offset < length) && (work < budget))
 		{
-			current[i] = current[i];
+			size_t end = offset + std::min(length - offset, budget - work);
+			if (useSummary)
+			{
+				size_t granule    = offset >> granuleWordShift;
+				size_t granuleEnd = std::min(
+				  (granule + 1) << granuleWordShift, length);
+				// Skipping a granule is cheap but not free, so count it as a
+				// single unit of work.
+				if (!granule_may_contain_capabilities(granule))
+				{
+					offset = granuleEnd;
+					work++;
+					continue;
+				}
+				end = std::min(end, granuleEnd);
+			}
+			// With interrupts disabled, loading and storing a capability will
+			// clear the tag on anything that has been revoked via the load
+			// barrier.
+			for (size_t i = offset; i < end; i++)
+			{
+				current[i] = current[i];
+			}
+			// Record the amount that we've scanned.
+			work += end - offset;
+			offset = end;
 		}
-		// Record the amount that we've scanned.
-		offset = end;
 		// Advance to the next state if we've finished scanning this range.
 		if (offset == length)
 		{
 			advance();
 		}
+		return work;
+	}
+
+	/**
+	 * Adjust the tick size after a tick that scanned `scanned` capabilities
+	 * in `cycles` cycles.  Ticks that ended early at the end of a region are
+	 * not a good measure of the cost of a full tick and are ignored.
+	 */
+	void adapt_tick_size(size_t scanned, uint32_t cycles)
+	{
+		if (scanned != tickSize)
+		{
+			return;
+		}
+		if ((cycles > TargetTickCycles) && (tickSize > MinTickSize))
+		{
+			tickSize /= 2;
+		}
+		else if ((cycles < TargetTickCycles / 2) && (tickSize < MaxTickSize))
+		{
+			tickSize *= 2;
+		}
+		statistics.tickSize = tickSize;
 	}
 
 } // namespace
 
-void revoker_tick()
+void revoker_tick(bool urgent)
 {
 	// If we've been asked to run, make sure that we're running.
 	if (state == State::NotRunning)
 	{
 		advance();
 	}
+	size_t budget =
+	  urgent ? std::min(tickSize * UrgentTickMultiplier, MaxTickSize) : tickSize;
 	// Do some work.
-	return scan_range();
+	uint64_t start   = rdcycle64();
+	size_t   scanned = scan_range(budget);
+	uint64_t end     = rdcycle64();
+	uint32_t cycles  = end - start;
+
+	statistics.maxTickCycles = std::max(statistics.maxTickCycles, cycles);
+	sweepTicks++;
+	if (!urgent)
+	{
+		adapt_tick_size(scanned, cycles);
+	}
+	// If this tick finished the sweep, record how long it took.
+	if (state == State::NotRunning)
+	{
+		uint32_t sweepCycles = end - sweepStartCycles;
+		statistics.sweeps++;
+		statistics.lastSweepCycles = sweepCycles;
+		statistics.maxSweepCycles =
+		  std::max(statistics.maxSweepCycles, sweepCycles);
+		statistics.lastSweepTicks = sweepTicks;
+	}
 }
 
 const uint32_t *revoker_epoch_get()
@@ -176,3 +333,43 @@ const uint32_t *revoker_epoch_get()
 	epochPtr.permissions() &= {Permission::Load, Permission::Global};
 	return epochPtr;
 }
+
+const SoftwareRevokerStatistics *revoker_statistics_get()
+{
+	Capability<SoftwareRevokerStatistics> statisticsPtr{&statistics};
+	statisticsPtr.permissions() &= {Permission::Load, Permission::Global};
+	return statisticsPtr;
+}
+
+SoftwareRevokerSummary *revoker_summary_get()
+{
+	if (summaryShared)
+	{
+		return nullptr;
+	}
+	auto   heap       = get_globals(1);
+	size_t heapLength = __builtin_cheri_length_get(heap);
+	// Find the smallest granule size for which the summary covers the heap.
+	size_t granuleShift = MinGranuleShift;
+	while (((heapLength + (1U << granuleShift) - 1) >> granuleShift) >
+	       SoftwareRevokerSummaryWords * 32)
+	{
+		granuleShift++;
+	}
+	summary.base         = __builtin_cheri_base_get(heap);
+	summary.granuleShift = granuleShift;
+	summary.granules =
+	  (heapLength + (1U << granuleShift) - 1) >> granuleShift;
+	// Nothing is known about the heap yet, so every granule may contain
+	// capabilities until the allocator says otherwise.
+	for (auto &word : summary.bits)
+	{
+		word = ~0U;
+	}
+	granuleWordShift = granuleShift - utils::log2<sizeof(void *)>();
+	summaryShared    = true;
+	Capability<SoftwareRevokerSummary> summaryPtr{&summary};
+	summaryPtr.permissions() &=
+	  {Permission::Load, Permission::Store, Permission::Global};
+	return summaryPtr;
+}
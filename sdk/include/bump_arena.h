@@ -0,0 +1,139 @@
+// Copyright Microsoft and CHERIoT Contributors.
+// SPDX-License-Identifier: MIT
+
+#pragma once
+/**
+ * This file contains the interface for bump-pointer arenas, implemented in the
+ * `bump_arena` library.
+ *
+ * A bump arena obtains a single block from the heap and hands out pieces of
+ * it, each bounded to the requested size.  Pieces are never freed
+ * individually: the whole block is released with a single call to
+ * `heap_free` when the arena is destroyed, which also revokes every pointer to
+ * any piece.  This is intended for compartments that allocate several
+ * temporaries while handling a request and free all of them at the end,
+ * replacing a cross-compartment call into the allocator for each temporary
+ * with one call to allocate and one to free.
+ */
+
+#include <cdefs.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <timeout.h>
+
+struct SObjStruct;
+
+/**
+ * State for a bump arena.  This is usually placed on the stack of the
+ * function that handles a request.
+ */
+struct BumpArena
+{
+	/// The block obtained from the heap, or null if there is none.
+	void *block;
+	/// The offset in `block` at which the next allocation will start.
+	size_t used;
+};
+
+__BEGIN_DECLS
+
+/**
+ * Initialise `arena` with a block of `size` bytes allocated from
+ * `heapCapability`.
+ *
+ * Returns 0 on success or `-ENOMEM` if the allocation failed (including
+ * because the timeout expired).
+ */
+int __cheri_libcall bump_arena_create(Timeout           *timeout,
+                                      struct SObjStruct *heapCapability,
+                                      struct BumpArena  *arena,
+                                      size_t             size);
+
+/**
+ * Allocate `size` bytes from `arena`.  The result is zeroed and is bounded to
+ * `size` bytes, rounded up to the nearest length that can be represented
+ * precisely, and so cannot be used to reach any other allocation.  Returns
+ * null if there is not enough space left in the arena.
+ */
+void *__cheri_libcall bump_arena_allocate(struct BumpArena *arena, size_t size);
+
+/**
+ * Returns the number of bytes remaining in `arena`.  An allocation of this
+ * size may still fail if it needs padding for alignment.
+ */
+size_t __cheri_libcall bump_arena_remaining(struct BumpArena *arena);
+
+/**
+ * Free the block that backs `arena`, invalidating every allocation made from
+ * it.  The arena is empty after this call and can be passed to
+ * `bump_arena_create` again.
+ *
+ * Returns the result of `heap_free`.  If that fails, for example because
+ * `heapCapability` is not the one that allocated the block, the arena is left
+ * unchanged.
+ */
+int __cheri_libcall bump_arena_destroy(struct SObjStruct *heapCapability,
+                                       struct BumpArena  *arena);
+
+__END_DECLS
+
+#ifdef __cplusplus
+/**
+ * A bump arena that is destroyed when it goes out of scope.  Check `is_valid`
+ * after construction to find out whether the block was allocated.
+ */
+class ScopedBumpArena
+{
+	/// The heap capability that was used to allocate the block.
+	struct SObjStruct *heapCapability;
+	/// The arena state.
+	BumpArena arena = {nullptr, 0};
+
+	public:
+	/**
+	 * Create an arena with a block of `size` bytes allocated from
+	 * `heapCapability`.
+	 */
+	ScopedBumpArena(Timeout           *timeout,
+	                struct SObjStruct *heapCapability,
+	                size_t             size)
+	  : heapCapability(heapCapability)
+	{
+		bump_arena_create(timeout, heapCapability, &arena, size);
+	}
+
+	ScopedBumpArena(const ScopedBumpArena &) = delete;
+	ScopedBumpArena &operator=(const ScopedBumpArena &) = delete;
+
+	/// Free the block and everything allocated from it.
+	~ScopedBumpArena()
+	{
+		bump_arena_destroy(heapCapability, &arena);
+	}
+
+	/// Returns true if the block was allocated.
+	[[nodiscard]] bool is_valid() const
+	{
+		return arena.block != nullptr;
+	}
+
+	/// Allocate `size` bytes, see `bump_arena_allocate`.
+	void *allocate(size_t size)
+	{
+		return bump_arena_allocate(&arena, size);
+	}
+
+	/// Allocate space for a `T`, see `bump_arena_allocate`.
+	template<typename T>
+	T *allocate()
+	{
+		return static_cast<T *>(bump_arena_allocate(&arena, sizeof(T)));
+	}
+
+	/// Returns the number of bytes remaining.
+	size_t remaining()
+	{
+		return bump_arena_remaining(&arena);
+	}
+};
+#endif
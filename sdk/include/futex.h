@@ -72,3 +72,37 @@ __always_inline static int futex_wait(const uint32_t *address,
  */
 [[cheri::interrupt_state(disabled)]] int __cheri_compartment("sched")
   futex_wake(uint32_t *address, uint32_t count);
+
+/**
+ * Wakes up to `wakeCount` threads that are sleeping with `futex[_timed]_wait`
+ * on `from` and then moves up to `requeueCount` of the remaining sleepers so
+ * that they are waiting on `to` instead.  Moved threads are not woken: they
+ * sleep until a wake is sent to `to` or their timeout expires.
+ *
+ * If `to` does not contain `expected`, nothing is done.  This check is atomic
+ * with the move, so a caller that has seen a value in `to` that means that
+ * some other thread will later wake `to` cannot strand the moved threads by
+ * racing with that wake.
+ *
+ * This is used to implement condition variable broadcasts: one waiter is
+ * woken and the rest are moved to the lock word, so that they are not woken
+ * while the notifying thread still holds the lock.
+ *
+ * The `from` argument must permit storing four bytes of data after the
+ * address, as with `futex_wake`.  The `to` argument must permit loading four
+ * bytes of data after the address.
+ *
+ * Threads waiting with `FutexPriorityInheritance` stop boosting the owner of
+ * `from` when they are moved and do not boost the owner of `to`.  Threads
+ * blocked on `from` in a multiwaiter may be woken but are never moved.
+ *
+ * The return value for a successful call is the number of threads that were
+ * woken or moved.  `-EAGAIN` is returned if `to` does not contain `expected`
+ * and `-EINVAL` is returned for invalid arguments.
+ */
+[[cheri::interrupt_state(disabled)]] int __cheri_compartment("sched")
+  futex_requeue(uint32_t       *from,
+                const uint32_t *to,
+                uint32_t        expected,
+                uint32_t        wakeCount,
+                uint32_t        requeueCount);
@@ -0,0 +1,136 @@
+// Copyright Microsoft and CHERIoT Contributors.
+// SPDX-License-Identifier: MIT
+
+#pragma once
+
+/**
+ * The allocator's statistics structures.  These are part of the `stdlib.h`
+ * interface, but are kept separate so that the allocator can be built for a
+ * host with no other part of the CHERIoT C library.
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * The number of buckets in the quarantine drain latency histogram.
+ */
+#define HEAP_QUARANTINE_DRAIN_HISTOGRAM_BUCKETS 16
+
+/**
+ * Statistics about the time that the allocator spends moving chunks from
+ * quarantine back to the free lists.  Only drains that moved at least one
+ * chunk are recorded.
+ */
+struct HeapQuarantineDrainStatistics
+{
+	/// The number of chunks that each free or allocation tries to dequeue.
+	size_t budget;
+	/// The largest number of cycles that a single drain has taken.
+	uint32_t maxCycles;
+	/**
+	 * Log2 histogram of drain times.  Bucket `i` counts drains that took at
+	 * least 2^i and fewer than 2^(i+1) cycles.  The last bucket also counts
+	 * all longer drains.
+	 */
+	uint32_t histogram[HEAP_QUARANTINE_DRAIN_HISTOGRAM_BUCKETS];
+};
+
+/**
+ * The number of small bins and tree bins reported in `HeapStatistics`.
+ */
+#define HEAP_STATISTICS_SMALL_BINS 8
+#define HEAP_STATISTICS_TREE_BINS 12
+
+/**
+ * A snapshot of the state of the heap, returned by `heap_stats_get`.  All
+ * sizes are in bytes and include the eight-byte chunk header.  Sizes, counts,
+ * and allocation outcomes are summed over the shared heap and any dedicated
+ * arenas.
+ */
+struct HeapStatistics
+{
+	/**
+	 * The total size of the heap.  Dedicated arenas are carved out of the
+	 * shared heap and so are not counted a second time.
+	 */
+	size_t totalSize;
+	/// The amount of memory that is free and not in quarantine.
+	size_t freeSize;
+	/// The amount of memory waiting in quarantine for revocation.
+	size_t quarantineSize;
+	/// The size of the largest free chunk in any arena's free lists.
+	size_t largestFreeChunk;
+	/// The number of objects freed while a hazard pointer referred to them.
+	size_t hazardQuarantineOccupancy;
+	/**
+	 * The number of free chunks in each small bin.  Small bin `i` holds
+	 * chunks of exactly `(i + 1) * 8` bytes.
+	 */
+	size_t smallBinChunks[HEAP_STATISTICS_SMALL_BINS];
+	/// The number of free chunks in each tree bin, in increasing size order.
+	size_t treeBinChunks[HEAP_STATISTICS_TREE_BINS];
+	/// The total size of the free chunks in each tree bin.
+	size_t treeBinBytes[HEAP_STATISTICS_TREE_BINS];
+	/// The number of allocation attempts that succeeded.
+	uint32_t allocations;
+	/// The number of allocation attempts that could never succeed.
+	uint32_t failuresPermanent;
+	/**
+	 * The number of allocation attempts that failed because the memory
+	 * needed was still in quarantine.
+	 */
+	uint32_t failuresRevocationNeeded;
+	/**
+	 * The number of allocation attempts that failed because there was not
+	 * enough free memory (or quota) and so required something to be freed.
+	 */
+	uint32_t failuresDeallocationNeeded;
+	/// The number of revocation sweeps that the allocator has started.
+	uint32_t revocationSweeps;
+	/**
+	 * The number of requests for a background sweep that were deferred
+	 * because a sweep had started too recently.
+	 */
+	uint32_t revocationSweepsDeferred;
+	/**
+	 * The total number of bytes that completed sweeps have released from
+	 * quarantine.  Dividing this by `revocationSweeps` gives the average
+	 * reclaimed per sweep.
+	 */
+	uint64_t revocationBytesReclaimed;
+	/**
+	 * The number of cycles that the most recent revocation sweep took from
+	 * start to finish.  Only the software revoker times its sweeps, this is
+	 * zero with other revokers.
+	 */
+	uint32_t revocationLastSweepCycles;
+	/**
+	 * The longest time, in cycles, that any revocation sweep has taken.  Zero
+	 * if the revoker does not time its sweeps.
+	 */
+	uint32_t revocationMaxSweepCycles;
+	/**
+	 * The longest time, in cycles, that the software revoker has run with
+	 * interrupts disabled in a single step of a sweep.  Zero with other
+	 * revokers.
+	 */
+	uint32_t revocationMaxPauseCycles;
+	/**
+	 * The number of capabilities that the software revoker currently scans in
+	 * a single step.  This adapts to keep the time spent with interrupts
+	 * disabled close to `CHERIOT_SOFTWARE_REVOKER_TICK_CYCLES`.  Zero with
+	 * other revokers.
+	 */
+	uint32_t revocationTickSize;
+	/**
+	 * The number of sweeps that the software revoker has finished.  Zero with
+	 * other revokers.
+	 */
+	uint32_t revocationSweepsCompleted;
+	/**
+	 * The number of steps that the software revoker took to finish the most
+	 * recent sweep.  Zero with other revokers.
+	 */
+	uint32_t revocationLastSweepTicks;
+};
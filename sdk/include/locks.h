@@ -68,6 +68,19 @@ struct CountingSemaphoreState
 	uint32_t maxCount;
 };
 
+/**
+ * State for a condition variable.  Condition variables are used with a flag
+ * lock that protects the condition.
+ */
+struct ConditionVariableState
+{
+	/**
+	 * Sequence counter, incremented on every notification.  Waiters sleep on
+	 * this word.
+	 */
+	_Atomic(uint32_t) sequence __if_cxx(= 0);
+};
+
 __BEGIN_DECLS
 
 /**
@@ -176,6 +189,43 @@ void __cheri_libcall ticketlock_lock(struct TicketLockState *lock);
  */
 void __cheri_libcall ticketlock_unlock(struct TicketLockState *lock);
 
+/**
+ * Wait on a condition variable.  The caller must hold `lock`, which must not
+ * be priority inheriting.  This atomically releases `lock` and sleeps until
+ * the condition variable is notified or the timeout expires, then reacquires
+ * `lock` before returning.  Wakes may be spurious, so callers should recheck
+ * the condition in a loop.
+ *
+ * Returns 0 on success or -ETIMEDOUT if the timeout expired.  In both cases
+ * the caller holds `lock` on return.  Returns -EINVAL if the arguments are
+ * invalid or -ENOENT if the lock was set in destruction mode while waiting,
+ * in which case the caller does not hold `lock`.
+ */
+int __cheri_libcall
+conditionvariable_wait(Timeout                       *timeout,
+                       struct ConditionVariableState *conditionVariable,
+                       struct FlagLockState          *lock);
+
+/**
+ * Wake one thread that is waiting on a condition variable.
+ */
+void __cheri_libcall
+conditionvariable_notify_one(struct ConditionVariableState *conditionVariable);
+
+/**
+ * Wake all threads that are waiting on a condition variable.  `lock` must be
+ * the lock that the waiters passed to `conditionvariable_wait`.
+ *
+ * If `lock` is held, then only one waiter is woken and the rest are moved to
+ * wait on `lock` with `futex_requeue`.  Each release of the lock then wakes
+ * one moved waiter, which wakes the next when it releases the lock, so the
+ * waiters take the lock in turn rather than all waking to contend for it.  If
+ * the lock is not held, all waiters are woken immediately.
+ */
+void __cheri_libcall
+conditionvariable_notify_all(struct ConditionVariableState *conditionVariable,
+                             struct FlagLockState          *lock);
+
 /**
  * Semaphore get operation, decrements the semaphore count.  Returns 0 on
  * success, -ETIMEDOUT if the timeout expired.  Can also return -EINVAL if the
@@ -40,6 +40,9 @@ class FlagLockGeneric
 {
 	FlagLockState state;
 
+	/// Condition variables need access to the lock word.
+	friend class ConditionVariable;
+
 	public:
 	/**
 	 * Attempt to acquire the lock, blocking until a timeout specified by the
@@ -285,4 +288,65 @@ class LockGuard
 	}
 };
 
+/**
+ * A condition variable, for use with a `FlagLock` that protects the condition.
+ *
+ * Waiters atomically release the lock and sleep until notified, reacquiring
+ * the lock before `wait` returns.  Calling `notify_all` with the lock held
+ * wakes one waiter and moves the rest to wait on the lock, so that they do
+ * not wake while the notifying thread still holds it.  Each release of the
+ * lock then wakes one moved thread, which wakes the next when it releases the
+ * lock, so the moved threads are handed the lock one at a time.
+ */
+class ConditionVariable
+{
+	ConditionVariableState state;
+
+	public:
+	/**
+	 * Release `lock`, wait for a notification or for the timeout to expire,
+	 * and then reacquire `lock`.  The caller must hold `lock`.  Wakes may be
+	 * spurious.  See `conditionvariable_wait` for the return values.
+	 */
+	__always_inline int wait(Timeout *timeout, FlagLock &lock)
+	{
+		return conditionvariable_wait(timeout, &state, &lock.state);
+	}
+
+	/**
+	 * Wait until `predicate` returns true or the timeout expires.  The caller
+	 * must hold `lock` and `predicate` is always called with `lock` held.
+	 * Returns 0 if the predicate is true, or the error from `wait` otherwise.
+	 */
+	template<typename Predicate>
+	int wait(Timeout *timeout, FlagLock &lock, Predicate &&predicate)
+	{
+		while (!predicate())
+		{
+			if (int ret = wait(timeout, lock); ret != 0)
+			{
+				return ((ret == -ETIMEDOUT) && predicate()) ? 0 : ret;
+			}
+		}
+		return 0;
+	}
+
+	/**
+	 * Wake one waiting thread.
+	 */
+	__always_inline void notify_one()
+	{
+		conditionvariable_notify_one(&state);
+	}
+
+	/**
+	 * Wake all waiting threads.  `lock` must be the lock that is used with
+	 * `wait`, and should be held by the caller.
+	 */
+	__always_inline void notify_all(FlagLock &lock)
+	{
+		conditionvariable_notify_all(&state, &lock.state);
+	}
+};
+
 __clang_ignored_warning_pop();
@@ -53,11 +53,30 @@ class StandardClint : private utils::NoCopyNoMove
 	 */
 	static void setnext(uint32_t cycles)
 	{
-		/// the high 32 bits of the 64-bit MTIME register
+		/// the high 32 bits of the 64-bit MTIMECMP register
 		volatile uint32_t *pmtimercmphigh = pmtimercmp + 1;
-		/// the low 32 bits
+		uint64_t           curmtime       = time();
+		uint32_t           curmtimehigh   = curmtime >> 32;
+		uint32_t           curmtimenew;
+
+		// Add tick cycles to current time. Handle carry bit.
+		curmtimehigh += __builtin_add_overflow(
+		  static_cast<uint32_t>(curmtime), cycles, &curmtimenew);
+
+		// Write the new MTIMECMP value, at which the next interrupt fires.
+		*pmtimercmphigh = -1; // Prevent spurious interrupts.
+		*pmtimercmp     = curmtimenew;
+		*pmtimercmphigh = curmtimehigh;
+	}
+
+	/**
+	 * Returns the current value of the 64-bit MTIME register.
+	 */
+	static uint64_t time()
+	{
+		/// the high 32 bits of the 64-bit MTIME register
 		volatile uint32_t *pmtimerhigh = pmtimer + 1;
-		uint32_t           curmtimehigh, curmtime, curmtimenew;
+		uint32_t           curmtimehigh, curmtime;
 
 		// Read the current time. Loop until the high 32 bits are stable.
 		do
@@ -65,14 +84,7 @@ class StandardClint : private utils::NoCopyNoMove
 			curmtimehigh = *pmtimerhigh;
 			curmtime     = *pmtimer;
 		} while (curmtimehigh != *pmtimerhigh);
-
-		// Add tick cycles to current time. Handle carry bit.
-		curmtimehigh += __builtin_add_overflow(curmtime, cycles, &curmtimenew);
-
-		// Write the new MTIMECMP value, at which the next interrupt fires.
-		*pmtimercmphigh = -1; // Prevent spurious interrupts.
-		*pmtimercmp     = curmtimenew;
-		*pmtimercmphigh = curmtimehigh;
+		return (static_cast<uint64_t>(curmtimehigh) << 32) | curmtime;
 	}
 
 	private:
@@ -5,6 +5,7 @@
 
 #include <cdefs.h>
 #include <compartment-macros.h>
+#include <heap_statistics.h>
 #include <riscvreg.h>
 #include <stddef.h>
 #include <stdint.h>
@@ -28,11 +29,29 @@ struct AllocatorCapabilityState
 	/// The number of bytes that the capability will permit to be allocated.
 	size_t quota;
 	/// Reserved space for internal use.
-	size_t unused;
+	uint16_t unused;
+	/// Flags controlling how allocations are made, from
+	/// `AllocatorCapabilityFlags`.
+	uint16_t flags;
 	/// Reserved space for internal use.
 	uintptr_t reserved[2];
 };
 
+/**
+ * Flags that may be set in `AllocatorCapabilityState::flags`.
+ */
+enum AllocatorCapabilityFlags
+{
+	/**
+	 * Allocate from a dedicated arena that is carved out of the shared heap
+	 * the first time that the capability is used.  The arena is large enough
+	 * to hold the capability's entire quota, so allocations with this
+	 * capability are not affected by fragmentation caused by other
+	 * compartments.  The arena is never returned to the shared heap.
+	 */
+	AllocatorCapabilityDedicatedArena = 1,
+};
+
 struct SObjStruct;
 
 /**
@@ -44,17 +63,25 @@ struct SObjStruct;
 
 /**
  * Helper macro to define an allocator capability authorising the specified
- * quota.
+ * quota, with the specified flags (from `AllocatorCapabilityFlags`).
  */
-#define DEFINE_ALLOCATOR_CAPABILITY(name, quota)                               \
+#define DEFINE_ALLOCATOR_CAPABILITY_WITH_FLAGS(name, quota, flags)             \
 	DEFINE_STATIC_SEALED_VALUE(struct AllocatorCapabilityState,                \
 	                           alloc,                                          \
 	                           MallocKey,                                      \
 	                           name,                                           \
 	                           (quota),                                        \
 	                           0,                                              \
+	                           (flags),                                        \
 	                           {0, 0});
 
+/**
+ * Helper macro to define an allocator capability authorising the specified
+ * quota.
+ */
+#define DEFINE_ALLOCATOR_CAPABILITY(name, quota)                               \
+	DEFINE_ALLOCATOR_CAPABILITY_WITH_FLAGS(name, quota, 0)
+
 /**
  * Helper macro to define an allocator capability without a separate
  * declaration.
@@ -63,6 +90,15 @@ struct SObjStruct;
 	DECLARE_ALLOCATOR_CAPABILITY(name);                                        \
 	DEFINE_ALLOCATOR_CAPABILITY(name, quota)
 
+/**
+ * Helper macro to define an allocator capability that allocates from its own
+ * dedicated arena, without a separate declaration.
+ */
+#define DECLARE_AND_DEFINE_ALLOCATOR_CAPABILITY_WITH_ARENA(name, quota)        \
+	DECLARE_ALLOCATOR_CAPABILITY(name);                                        \
+	DEFINE_ALLOCATOR_CAPABILITY_WITH_FLAGS(                                    \
+	  name, quota, AllocatorCapabilityDedicatedArena)
+
 #ifndef CHERIOT_NO_AMBIENT_MALLOC
 /**
  * Declare a default capability for use with malloc-style APIs.  Compartments
@@ -85,6 +121,131 @@ DEFINE_ALLOCATOR_CAPABILITY(__default_malloc_capability, MALLOC_QUOTA)
  */
 #define MALLOC_CAPABILITY STATIC_SEALED_VALUE(__default_malloc_capability)
 
+/**
+ * The public view of state represented by a capability that authorises
+ * changing the global configuration of the allocator.  This is sealed with the
+ * `ManagementKey` type exported from the allocator compartment and should be
+ * held only by trusted compartments, which can be identified by auditing.
+ */
+struct AllocatorManagementCapabilityState
+{
+	/// Reserved space for internal use.
+	size_t reserved;
+};
+
+/**
+ * Helper macro to forward declare an allocator management capability.
+ */
+#define DECLARE_ALLOCATOR_MANAGEMENT_CAPABILITY(name)                          \
+	DECLARE_STATIC_SEALED_VALUE(                                               \
+	  struct AllocatorManagementCapabilityState, alloc, ManagementKey, name);
+
+/**
+ * Helper macro to define an allocator management capability.
+ */
+#define DEFINE_ALLOCATOR_MANAGEMENT_CAPABILITY(name)                           \
+	DEFINE_STATIC_SEALED_VALUE(struct AllocatorManagementCapabilityState,      \
+	                           alloc,                                          \
+	                           ManagementKey,                                  \
+	                           name,                                           \
+	                           0);
+
+/**
+ * Helper macro to define an allocator management capability without a
+ * separate declaration.
+ */
+#define DECLARE_AND_DEFINE_ALLOCATOR_MANAGEMENT_CAPABILITY(name)               \
+	DECLARE_ALLOCATOR_MANAGEMENT_CAPABILITY(name);                             \
+	DEFINE_ALLOCATOR_MANAGEMENT_CAPABILITY(name)
+
+/**
+ * The number of buckets in the per-quota allocation size histogram.
+ */
+#define HEAP_QUOTA_HISTOGRAM_BUCKETS 16
+
+/**
+ * Heap usage by a single allocator capability, see
+ * `heap_quota_statistics_get`.
+ */
+struct HeapQuotaStatistics
+{
+	/**
+	 * The identifier that the allocator assigned to this capability when it
+	 * was first used.  Trace records use the same identifier.
+	 */
+	uint16_t identifier;
+	/// Reserved for future use.
+	uint16_t reserved;
+	/**
+	 * The address of the capability's state.  This is the address of the
+	 * static sealed object, which can be matched against the firmware's
+	 * symbol table to find the compartment that holds the capability.
+	 */
+	ptraddr_t capability;
+	/// The quota that the capability had when it was first used.
+	size_t quota;
+	/// The number of bytes currently charged to this capability.
+	size_t liveBytes;
+	/// The largest number of bytes that have been charged at once.
+	size_t peakBytes;
+	/// The number of successful allocations.
+	uint32_t allocations;
+	/**
+	 * Log2 histogram of requested allocation sizes.  Bucket `i` counts
+	 * allocations of at least 2^(i+3) and fewer than 2^(i+4) bytes.  The
+	 * first bucket also counts all smaller allocations and the last bucket
+	 * all larger ones.
+	 */
+	uint32_t histogram[HEAP_QUOTA_HISTOGRAM_BUCKETS];
+};
+
+/**
+ * Operations recorded in the allocator trace.
+ */
+enum HeapTraceOperation
+{
+	/**
+	 * An allocation.  The address is zero if the allocation failed.
+	 */
+	HeapTraceAllocate,
+	/// An object was freed by its owner.
+	HeapTraceFree,
+	/// A claim was added to an object.
+	HeapTraceClaim,
+	/// A claim on an object was dropped.
+	HeapTraceRelease,
+	/**
+	 * Records were lost because the trace buffer was full.  The size field
+	 * holds the number of records that were lost.
+	 */
+	HeapTraceDropped,
+	/**
+	 * An object was grown in place by `heap_reallocate`.  The size is the
+	 * new requested size.  Reallocations that move the object are recorded
+	 * as an allocation followed by a free.
+	 */
+	HeapTraceReallocate,
+};
+
+/**
+ * A single record in the allocator trace, see `heap_trace_drain`.
+ */
+struct HeapTraceRecord
+{
+	/// The operation, from `HeapTraceOperation`.
+	uint8_t operation;
+	/// Reserved, always zero.
+	uint8_t reserved;
+	/// The identifier of the allocator capability used for the operation.
+	uint16_t owner;
+	/// The requested size for allocations, the object size otherwise.
+	uint32_t size;
+	/// The address of the start of the object.
+	ptraddr_t address;
+	/// The low 32 bits of the cycle counter when the operation completed.
+	uint32_t cycles;
+};
+
 __BEGIN_DECLS
 static inline void __dead2 panic()
 {
@@ -137,6 +298,69 @@ void *__cheri_compartment("alloc")
                       size_t             nmemb,
                       size_t             size);
 
+/**
+ * Non-standard allocation API.  Allocates `count` separate objects of `size`
+ * bytes each, storing capabilities to them in the first `count` elements of
+ * `out`.  This is equivalent to calling `heap_allocate` `count` times but
+ * requires only a single call into the allocator compartment.  Each object has
+ * its own bounds and must be freed individually (or with `heap_free_batch`).
+ *
+ * The quota is checked once, up front, for the whole batch.  If
+ * `heapCapability` cannot cover `count` objects of this size then this returns
+ * `-ENOMEM` without allocating anything.  Blocking behaviour is controlled by
+ * the `timeout` parameter, as with `heap_allocate`, and the timeout applies to
+ * the batch as a whole.
+ *
+ * Returns the number of objects allocated.  This may be less than `count` if
+ * the heap is exhausted and the timeout expires before space is available.
+ * The first *n* elements of `out` will contain the allocated objects and the
+ * remainder will be null.  Returns `-EPERM` if `heapCapability` is not a valid
+ * heap capability or `-EINVAL` if `timeout` or `out` is not valid (in which
+ * case nothing will have been allocated).
+ *
+ * If `out` is a heap object and another thread frees it while this call is
+ * blocked, no more objects are allocated or stored.  The objects already
+ * allocated remain charged to `heapCapability` and can be released only with
+ * `heap_free_all`.
+ *
+ * Memory returned from this interface is guaranteed to be zeroed.
+ */
+ssize_t __cheri_compartment("alloc")
+  heap_allocate_batch(Timeout           *timeout,
+                      struct SObjStruct *heapCapability,
+                      size_t             size,
+                      size_t             count,
+                      void             **out);
+
+/**
+ * Non-standard reallocation API.  Returns a pointer to an object of at least
+ * `size` bytes that contains the contents of the object that `ptr` points to.
+ * Blocking behaviour is controlled by the `timeout` parameter, as with
+ * `heap_allocate`.
+ *
+ * If the object is already at least `size` bytes, `ptr` is returned
+ * unmodified: shrinking an object does not reduce its bounds.  Otherwise, the
+ * allocator first tries to grow the object in place by absorbing free space
+ * that immediately follows it.  In this case the returned capability has the
+ * same base as `ptr` but covers the whole of the grown object and `ptr` (which
+ * still has the old bounds) can no longer be used to free the object.  If the
+ * object cannot grow in place (or has been claimed), a new object is
+ * allocated, the contents are copied, and the old object is freed.
+ *
+ * If `ptr` is null, this behaves like `heap_allocate`.  Returns null on
+ * failure, in which case the original object is unmodified.  Failure can be
+ * caused by a lack of memory or quota, a zero `size`, or `ptr` not being a
+ * capability to the whole of an unsealed object allocated with
+ * `heapCapability`.
+ *
+ * Any new memory is guaranteed to be zeroed.
+ */
+void *__cheri_compartment("alloc")
+  heap_reallocate(Timeout           *timeout,
+                  struct SObjStruct *heapCapability,
+                  void              *ptr,
+                  size_t             size);
+
 /**
  * Add a claim to an allocation.  The object will be counted against the quota
  * provided by the first argument until a corresponding call to `heap_free`.
@@ -175,6 +399,26 @@ int __cheri_libcall heap_claim_fast(Timeout         *timeout,
 int __cheri_compartment("alloc")
   heap_free(struct SObjStruct *heapCapability, void *ptr);
 
+/**
+ * Free several heap allocations with a single call into the allocator.
+ * `ptrs` is an array of `count` pointers, each of which is freed as if by
+ * `heap_free`.  Null entries are ignored.  Every entry that is successfully
+ * freed is replaced with null; entries that could not be freed are left
+ * unmodified.  Entries that point into the allocation that holds `ptrs` are
+ * never freed, because the array must remain valid for the whole call.
+ *
+ * All of the objects are freed while holding the allocator lock once and the
+ * revoker is kicked at most once for the whole batch, which makes this
+ * considerably cheaper than calling `heap_free` in a loop when tearing down
+ * large data structures.
+ *
+ * Returns the number of objects that were freed, `-EPERM` if
+ * `heapCapability` is not a valid heap capability, or `-EINVAL` if `ptrs` is
+ * not a valid, writeable, array of `count` pointers.
+ */
+ssize_t __cheri_compartment("alloc")
+  heap_free_batch(struct SObjStruct *heapCapability, void **ptrs, size_t count);
+
 /**
  * Free all allocations owned by this capability.
  *
@@ -207,6 +451,62 @@ size_t __cheri_compartment("alloc")
  */
 void __cheri_compartment("alloc") heap_quarantine_empty(void);
 
+/**
+ * Move chunks whose revocation has completed from quarantine back to the free
+ * lists, without waiting for any further revocation.  The work is done in
+ * steps of the current drain budget and the allocator lock is released
+ * between steps, so this does not block higher-priority threads for longer
+ * than a single free would.
+ *
+ * This is intended to be called from a low-priority thread when the system is
+ * otherwise idle, so that the work of draining quarantine is not done later on
+ * the allocation path.  Returns the number of chunks dequeued.
+ */
+size_t __cheri_compartment("alloc") heap_quarantine_drain_idle(void);
+
+/**
+ * Run a revocation sweep if there is anything in quarantine, or finish the
+ * sweep that is already running.  Returns the number of times the revoker was
+ * prodded, which is zero if there was nothing to do.  Unlike the sweeps
+ * started by `heap_free`, idle sweeps are never deferred by the revocation
+ * policy.
+ *
+ * This is intended to be called in a loop from a low-priority thread, together
+ * with `heap_quarantine_drain_idle`, so that sweeps happen while the system is
+ * otherwise idle rather than when an allocation is waiting for one.  With the
+ * software revoker, this runs the sweep to completion in short steps with
+ * interrupts enabled between them.  With a hardware revoker, this only starts
+ * the sweep.
+ */
+int __cheri_compartment("alloc") heap_revocation_idle(void);
+
+/**
+ * Set the number of chunks that each free or allocation tries to move from
+ * quarantine back to the free lists.  Larger values keep the quarantine
+ * smaller but increase the worst-case latency of each call.  The default is
+ * set by the `allocator-quarantine-drain` build option.
+ *
+ * The first argument must be an allocator management capability.  Returns 0
+ * on success, -EPERM if the capability is not valid, or -EINVAL if the budget
+ * is out of range (it must be between 2 and 128).
+ */
+int __cheri_compartment("alloc")
+  heap_quarantine_drain_budget_set(struct SObjStruct *managementCapability,
+                                   size_t             budget);
+
+/**
+ * Copy the quarantine drain statistics into `*statistics`.  If `reset` is
+ * true, the worst-case time and the histogram are cleared after being copied.
+ *
+ * The first argument must be an allocator management capability.  Returns 0
+ * on success, -EPERM if the capability is not valid, or -EINVAL if
+ * `statistics` is not a valid pointer.
+ */
+int __cheri_compartment("alloc") heap_quarantine_drain_statistics(
+  struct SObjStruct                    *managementCapability,
+  struct HeapQuarantineDrainStatistics *statistics,
+  _Bool                                 reset);
+
 /**
  * Returns true if `object` points to a valid heap address, false otherwise.
  * Note that this does *not* check that this is a valid pointer.  This should
@@ -254,6 +554,61 @@ static inline int free(void *ptr)
 
 size_t __cheri_compartment("alloc") heap_available(void);
 
+/**
+ * Copy a snapshot of the heap's state into `*statistics`.  The snapshot is
+ * built from counters that the allocator maintains as it runs, so this holds
+ * the allocator lock only for as long as it takes to copy them.
+ *
+ * Allocation outcomes are counted per attempt: a blocking allocation that
+ * waits for revocation and then succeeds is counted as both a failure and a
+ * success.
+ *
+ * The first argument must be an allocator management capability.  Returns 0
+ * on success, -EPERM if the capability is not valid, or -EINVAL if
+ * `statistics` is not a valid pointer.
+ */
+int __cheri_compartment("alloc")
+  heap_stats_get(struct SObjStruct     *managementCapability,
+                 struct HeapStatistics *statistics);
+
+/**
+ * Copy the usage statistics for up to `count` allocator capabilities into
+ * `statistics`, in the order in which the capabilities were first used.  The
+ * allocator tracks these for the first few capabilities to be used only if it
+ * was built with the `allocator-quota-statistics` option set to the number of
+ * capabilities to track.  Capabilities that have never been used do not
+ * appear.
+ *
+ * Comparing `peakBytes` with `quota` shows how far each capability's quota
+ * can be reduced, and `liveBytes` shows which compartments are holding the
+ * memory when the heap is filling up.
+ *
+ * Returns the number of entries copied, `-EPERM` if `managementCapability` is
+ * not a valid allocator management capability, `-EINVAL` if `statistics` is
+ * not a valid pointer to `count` entries, or `-ENOTSUP` if the allocator was
+ * built without per-quota statistics.
+ */
+ssize_t __cheri_compartment("alloc")
+  heap_quota_statistics_get(struct SObjStruct          *managementCapability,
+                            struct HeapQuotaStatistics *statistics,
+                            size_t                      count);
+
+/**
+ * Copy up to `count` records from the allocator trace buffer into `records`,
+ * removing them from the buffer.  The allocator records allocations, frees,
+ * and claims in this buffer only if it was built with the `allocator-trace`
+ * option.
+ *
+ * Returns the number of records copied, `-EPERM` if `managementCapability` is
+ * not a valid allocator management capability, `-EINVAL` if `records` is not
+ * a valid pointer to `count` records, or `-ENOTSUP` if the allocator was
+ * built without tracing.
+ */
+ssize_t __cheri_compartment("alloc")
+  heap_trace_drain(struct SObjStruct      *managementCapability,
+                   struct HeapTraceRecord *records,
+                   size_t                  count);
+
 static inline void yield(void)
 {
 	__asm volatile("ecall");
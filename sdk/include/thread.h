@@ -38,6 +38,20 @@ typedef struct
 [[cheri::interrupt_state(disabled)]] int __cheri_compartment("sched")
   thread_sleep(struct Timeout *timeout);
 
+/**
+ * Sleep until the system timer (see `thread_timer_get`) reaches `deadline`.
+ *
+ * This is equivalent to calling `thread_sleep` with a timeout that has an
+ * unlimited number of ticks remaining and the given deadline.  If the
+ * scheduler is built in tickless mode then the thread becomes runnable as
+ * soon as the deadline passes, otherwise the wait is rounded up to the next
+ * tick.  If the deadline has already passed, this is equivalent to `yield`.
+ *
+ * Returns 0 on success or `-EINVAL` if `deadline` is zero.
+ */
+[[cheri::interrupt_state(disabled)]] int __cheri_compartment("sched")
+  thread_sleep_until(uint64_t deadline);
+
 /**
  * Return the thread ID of the current running thread.
  * This is mostly useful where one compartment can run under different threads
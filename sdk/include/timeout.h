@@ -19,6 +19,16 @@ typedef uint32_t Ticks;
 /// Value indicating an unbounded timeout.
 static __if_cxx(constexpr) const Ticks UnlimitedTimeout = UINT32_MAX;
 
+__BEGIN_DECLS
+/**
+ * Returns the current value of the system timer.  This counts `CPU_TIMER_HZ`
+ * timer cycles per second and is the clock used for deadlines in
+ * `Timeout::deadline` and `thread_sleep_until`.
+ */
+[[cheri::interrupt_state(disabled)]] uint64_t __cheri_compartment("sched")
+  thread_timer_get(void);
+__END_DECLS
+
 /**
  * Structure representing a timeout.  This is intended to allow a single
  * instance to be chained across blocking calls.
@@ -43,6 +53,19 @@ typedef struct Timeout
 	 * timeout.
 	 */
 	Ticks remaining;
+	/**
+	 * An optional absolute deadline, as a value of the system timer (see
+	 * `thread_timer_get`).  If this is non-zero, blocking operations time out
+	 * when either `remaining` ticks have elapsed or the timer reaches this
+	 * value, whichever happens first, and `remaining` is set to zero once
+	 * the deadline has passed.  This allows timeouts that are shorter than a
+	 * tick.  Sub-tick precision requires the scheduler to be built in
+	 * tickless mode, otherwise deadlines are rounded up to the next tick.
+	 *
+	 * Code that blocks on behalf of a caller with a shorter, derived, timeout
+	 * must copy the caller's deadline into it.
+	 */
+	uint64_t deadline __if_cxx(= 0);
 #ifdef __cplusplus
 	/**
 	 * Constructor, initialises this structure to allow `time` ticks to
@@ -60,9 +83,21 @@ typedef struct Timeout
 	{
 	}
 
+	/**
+	 * Returns a timeout that expires when the system timer reaches
+	 * `deadline`, with no limit on the number of ticks.
+	 */
+	static Timeout until(uint64_t deadline)
+	{
+		Timeout t{UnlimitedTimeout};
+		t.deadline = deadline;
+		return t;
+	}
+
 	/**
 	 * Update this timeout if `time` ticks have elapsed.  This function
-	 * saturates the values on overflow.
+	 * saturates the values on overflow.  It does not read the timer, so a
+	 * deadline that has passed is noticed by the next `may_block`.
 	 */
 	inline void elapse(Ticks time)
 	{
@@ -78,10 +113,16 @@ typedef struct Timeout
 	}
 
 	/**
-	 * Helper indicating whether the owner of this timeout may block.
+	 * Helper indicating whether the owner of this timeout may block.  If the
+	 * deadline has passed, this sets `remaining` to zero.
 	 */
 	bool may_block()
 	{
+		if ((deadline != 0) && (remaining > 0) &&
+		    (thread_timer_get() >= deadline))
+		{
+			remaining = 0;
+		}
 		return remaining > 0;
 	}
 #endif
@@ -100,6 +100,86 @@ int __cheri_compartment("alloc")
 int __cheri_compartment("alloc")
   token_obj_can_destroy(SObj heapCapability, SKey key, SObj object);
 
+/**
+ * Create a pool of `count` objects of `sz` bytes, to be sealed with `key`.
+ *
+ * The memory for all of the objects is allocated, against the quota in
+ * `heapCapability`, when the pool is created.  Objects are then allocated
+ * from the pool with `token_pool_sealed_unsealed_alloc` or
+ * `token_pool_sealed_alloc` and returned to it with
+ * `token_pool_obj_destroy`, neither of which needs to search the heap or
+ * update the quota.
+ *
+ * Destroyed objects have the same temporal safety guarantees as freed heap
+ * memory: an object is not reused until every capability to it (including
+ * sealed handles) has been revoked.  If a pool is exhausted and contains
+ * destroyed objects, allocating from it will wait (up to the timeout) for
+ * revocation.
+ *
+ * The key must have the permit-seal permission.  The returned handle is a
+ * sealed object and must be passed to the other pool functions along with
+ * `key`.
+ *
+ * On error, this returns `INVALID_SOBJ`.
+ */
+SObj __cheri_compartment("alloc")
+  token_pool_create(Timeout           *timeout,
+                    struct SObjStruct *heapCapability,
+                    SKey               key,
+                    size_t             sz,
+                    size_t             count);
+
+/**
+ * Allocate an object from a pool created with `token_pool_create`.
+ *
+ * An unsealed pointer to the object is returned in `*unsealed`, the sealed
+ * pointer is returned as the return value.  The object is zeroed.
+ *
+ * The `key` parameter must be the key that was used to create the pool and
+ * must have both the permit-seal and permit-unseal permissions.
+ *
+ * On error, or if the pool is exhausted, this returns `INVALID_SOBJ`.
+ */
+SObj __cheri_compartment("alloc")
+  token_pool_sealed_unsealed_alloc(Timeout *timeout,
+                                   SObj     pool,
+                                   SKey     key,
+                                   void   **unsealed);
+
+/**
+ * Same as token_pool_sealed_unsealed_alloc() without getting the unsealed
+ * capability.
+ *
+ * The key must have the permit-seal permission.
+ */
+SObj __cheri_compartment("alloc")
+  token_pool_sealed_alloc(Timeout *timeout, SObj pool, SKey key);
+
+/**
+ * Return an object allocated from `pool` to the pool.
+ *
+ * The key must have the permit-unseal permission.  Objects allocated from a
+ * pool cannot be freed with `token_obj_destroy`, and pointers to them are
+ * rejected by `heap_claim`, `heap_free` and `heap_can_free`.
+ *
+ * @return 0 if no errors. -EINVAL if the key, pool, or object are not valid,
+ * or they don't match, or double destroy.
+ */
+int __cheri_compartment("alloc")
+  token_pool_obj_destroy(SObj pool, SKey key, SObj object);
+
+/**
+ * Destroy a pool created with `token_pool_create`, freeing the memory for it
+ * and all of its objects.  Any objects that are still live are invalidated.
+ *
+ * The key must have the permit-unseal permission.
+ *
+ * @return 0 if no errors. -EINVAL if the key or pool are not valid, or they
+ * don't match, or one of the errors from `heap_free`.
+ */
+int __cheri_compartment("alloc")
+  token_pool_destroy(struct SObjStruct *heapCapability, SKey key, SObj pool);
+
 __END_DECLS
 
 #ifdef __cplusplus
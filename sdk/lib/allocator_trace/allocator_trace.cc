@@ -0,0 +1,72 @@
+// Copyright Microsoft and CHERIoT Contributors.
+// SPDX-License-Identifier: MIT
+
+#include <debug.hh>
+#include <stdlib.h>
+#include <thread.h>
+
+using Debug = ConditionalDebug<false, "Allocator trace">;
+
+DECLARE_AND_DEFINE_ALLOCATOR_MANAGEMENT_CAPABILITY(allocatorTraceManagement);
+
+namespace
+{
+	/// The number of records to fetch from the allocator at a time.
+	constexpr size_t BatchRecords = 16;
+
+	/**
+	 * Buffer for records fetched from the allocator.  This is a global to
+	 * keep it off the stack.
+	 */
+	HeapTraceRecord records[BatchRecords];
+
+	/**
+	 * Write `record` to the UART as a single line containing the prefix
+	 * `alloc-trace:` followed by the bytes of the record in hex.
+	 */
+	void record_write(const HeapTraceRecord &record)
+	{
+		static constexpr char Hex[] = "0123456789abcdef";
+		auto                 *uart  = MMIO_CAPABILITY(Uart, uart);
+		for (char c : std::string_view{"alloc-trace:"})
+		{
+			uart->blocking_write(c);
+		}
+		const auto *bytes = reinterpret_cast<const uint8_t *>(&record);
+		for (size_t i = 0; i < sizeof(record); i++)
+		{
+			uart->blocking_write(Hex[bytes[i] >> 4]);
+			uart->blocking_write(Hex[bytes[i] & 0xf]);
+		}
+		uart->blocking_write('\n');
+	}
+} // namespace
+
+/**
+ * Thread entry point that drains the allocator trace buffer to the UART.  This
+ * should run in a low-priority thread.  It never returns unless the allocator
+ * was built without tracing.
+ */
+void __cheri_compartment("allocator_trace") allocator_trace_drain()
+{
+	while (true)
+	{
+		ssize_t count = heap_trace_drain(
+		  STATIC_SEALED_VALUE(allocatorTraceManagement), records, BatchRecords);
+		if (count < 0)
+		{
+			Debug::log("Unable to drain allocator trace: {}", count);
+			return;
+		}
+		for (ssize_t i = 0; i < count; i++)
+		{
+			record_write(records[i]);
+		}
+		// If the buffer was not full, wait for more records to arrive.
+		if (static_cast<size_t>(count) < BatchRecords)
+		{
+			Timeout t{1};
+			thread_sleep(&t);
+		}
+	}
+}
@@ -0,0 +1,6 @@
+-- Copyright Microsoft and CHERIoT Contributors.
+-- SPDX-License-Identifier: MIT
+
+compartment("allocator_trace")
+    set_default(false)
+    add_files("allocator_trace.cc")
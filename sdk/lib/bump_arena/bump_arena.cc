@@ -0,0 +1,78 @@
+// Copyright Microsoft and CHERIoT Contributors.
+// SPDX-License-Identifier: MIT
+
+#include <algorithm>
+#include <bump_arena.h>
+#include <cheri.hh>
+#include <errno.h>
+#include <stdlib.h>
+
+using namespace CHERI;
+
+int bump_arena_create(Timeout    *timeout,
+                      SObjStruct *heapCapability,
+                      BumpArena  *arena,
+                      size_t      size)
+{
+	arena->block = heap_allocate(timeout, heapCapability, size);
+	arena->used  = 0;
+	if (arena->block == nullptr)
+	{
+		return -ENOMEM;
+	}
+	return 0;
+}
+
+void *bump_arena_allocate(BumpArena *arena, size_t size)
+{
+	Capability<void> block{arena->block};
+	if (!block.is_valid() || (size == 0))
+	{
+		return nullptr;
+	}
+	// Round the size and the alignment up so that the bounds are exact.  The
+	// start of the block is aligned to the largest alignment that any
+	// representable allocation of its size needs, so aligning the offset is
+	// enough to align the address.
+	size_t length = representable_length(size);
+	size_t mask   = representable_alignment_mask(size);
+	size_t align  = std::max<size_t>(~mask + 1, sizeof(void *));
+	size_t start  = (arena->used + align - 1) & ~(align - 1);
+	if ((length < size) || (start < arena->used) ||
+	    (start > block.length()) || (length > block.length() - start))
+	{
+		return nullptr;
+	}
+	arena->used = start + length;
+	Capability<void> piece{block};
+	piece.address() += start;
+	piece.bounds() = length;
+	return piece;
+}
+
+size_t bump_arena_remaining(BumpArena *arena)
+{
+	Capability<void> block{arena->block};
+	if (!block.is_valid())
+	{
+		return 0;
+	}
+	return block.length() - arena->used;
+}
+
+int bump_arena_destroy(SObjStruct *heapCapability, BumpArena *arena)
+{
+	if (arena->block == nullptr)
+	{
+		return 0;
+	}
+	int ret = heap_free(heapCapability, arena->block);
+	// If the free failed, keep the block so that the caller can retry with
+	// the right heap capability rather than leaking it.
+	if (ret == 0)
+	{
+		arena->block = nullptr;
+		arena->used  = 0;
+	}
+	return ret;
+}
@@ -0,0 +1,3 @@
+library("bump_arena")
+  set_default(false)
+  add_files("bump_arena.cc")
@@ -43,6 +43,7 @@ int heap_claim_fast(Timeout *timeout, const void *ptr, const void *ptr2)
 			if (timeout->may_block())
 			{
 				Timeout t{1};
+				t.deadline = timeout->deadline;
 				futex_timed_wait(&t,
 				                 reinterpret_cast<uint32_t *>(epochCounter),
 				                 epoch,
@@ -1,6 +1,7 @@
 #include <atomic>
 #include <debug.hh>
 #include <errno.h>
+#include <futex.h>
 #include <limits>
 #include <locks.h>
 #include <thread.h>
@@ -33,21 +34,46 @@ namespace
 			/// The lock is held and one or more threads are waiting on it.
 			LockedWithWaiters = 1 << 17,
 			/// The lock is held and set in destruction mode.
-			LockedInDestructMode = 1 << 18
+			LockedInDestructMode = 1 << 18,
+			/**
+			 * The lock is held and threads have been moved to wait on the
+			 * lock word by `conditionvariable_notify_all`.  This is always
+			 * set with `LockedWithWaiters`.  Unlocking wakes only one
+			 * waiter, which sets this again when it acquires the lock, so
+			 * the waiters are handed the lock one at a time rather than all
+			 * waking to contend for it.
+			 */
+			LockedWithRequeuedWaiters = 1 << 19
 		};
 
 		public:
 		/**
 		 * Attempt to acquire the lock, blocking until a timeout specified by
 		 * the `timeout` parameter has expired.
+		 *
+		 * If `mayHaveBeenWoken` is true, the caller may have been woken by an
+		 * unlock that woke only one thread (see `LockedWithRequeuedWaiters`)
+		 * and so must pass the wake on.  This is set for any thread that has
+		 * slept on the lock word.
 		 */
-		int
-		try_lock(Timeout *timeout, uint32_t threadID, bool isPriorityInherited)
+		int try_lock(Timeout *timeout,
+		             uint32_t threadID,
+		             bool     isPriorityInherited,
+		             bool     mayHaveBeenWoken = false)
 		{
 			while (true)
 			{
 				uint32_t old     = Flag::Unlocked;
 				uint32_t desired = Flag::Locked | threadID;
+				// A thread that was woken by a single-thread wake cannot tell
+				// whether other threads are still sleeping on the lock word,
+				// so it takes the lock as if they were.  This costs, at most,
+				// one unneeded wake at the end of a chain of hand-offs.
+				if (mayHaveBeenWoken)
+				{
+					desired |= Flag::LockedWithWaiters |
+					           Flag::LockedWithRequeuedWaiters;
+				}
 				if (lockWord.compare_exchange_strong(old, desired))
 				{
 					return 0;
@@ -108,6 +134,7 @@ namespace
 					Debug::log("Wait failed {}", ret);
 					return ret;
 				}
+				mayHaveBeenWoken = true;
 			}
 		}
 
@@ -142,14 +169,47 @@ namespace
 			  &lockWord,
 			  old & 0x0000ffff);
 
-			// If there are waiters, wake them all up.
-			if ((old & Flag::LockedWithWaiters) != 0)
+			// If threads were moved here from a condition variable, wake one
+			// of them, which will pass the wake on when it unlocks.
+			// Otherwise, if there are waiters, wake them all up.
+			if ((old & Flag::LockedWithRequeuedWaiters) != 0)
+			{
+				Debug::log("hitting slow path single wake for {}", &lockWord);
+				lockWord.notify_one();
+			}
+			else if ((old & Flag::LockedWithWaiters) != 0)
 			{
 				Debug::log("hitting slow path wake for {}", &lockWord);
 				lockWord.notify_all();
 			}
 		}
 
+		/**
+		 * Mark the lock as having requeued waiters, so that the next `unlock`
+		 * wakes one of the threads sleeping on the lock word, which then
+		 * passes the wake on.  Returns the new value of the lock word, or 0 if
+		 * the lock is not held, in which case threads must not be left
+		 * sleeping on the lock word.
+		 *
+		 * The lock may be held by any thread and may be released as soon as
+		 * this returns.  Callers that move threads to the lock word must do
+		 * so only while it still holds the returned value.
+		 */
+		uint32_t mark_requeued_waiters()
+		{
+			constexpr uint32_t Marks =
+			  Flag::LockedWithWaiters | Flag::LockedWithRequeuedWaiters;
+			uint32_t old = lockWord.load();
+			do
+			{
+				if ((old & (Flag::Locked | Flag::LockedWithWaiters)) == 0)
+				{
+					return 0;
+				}
+			} while (!lockWord.compare_exchange_strong(old, old | Marks));
+			return old | Marks;
+		}
+
 		/**
 		 * Set the destruction bit in the flag lock word and wake
 		 * waiters. Assumes that the lock is held by the caller.
@@ -321,3 +381,78 @@ int __cheri_libcall recursivemutex_unlock(RecursiveMutexState *mutex)
 	static_cast<InternalFlagLock *>(&mutex->lock)->unlock();
 	return 0;
 }
+
+int __cheri_libcall
+conditionvariable_wait(Timeout                *timeout,
+                       ConditionVariableState *conditionVariable,
+                       FlagLockState          *lock)
+{
+	auto *internalLock = static_cast<InternalFlagLock *>(lock);
+	// Read the sequence number before dropping the lock.  Any notification
+	// after this point will increment it and so the wait below will not miss
+	// the wake.
+	uint32_t sequence = conditionVariable->sequence.load();
+	internalLock->unlock();
+	int ret = conditionVariable->sequence.wait(timeout, sequence);
+	if (ret == -EINVAL)
+	{
+		return ret;
+	}
+	// The caller must hold the lock on return, even after a timeout.  We may
+	// have been moved to the lock word by `conditionvariable_notify_all` and
+	// woken by an unlock that woke only us, so take the lock in the state
+	// that makes our unlock wake the next moved thread.
+	uint32_t threadID = 0;
+	if constexpr (DebugLocks)
+	{
+		threadID = thread_id_get();
+	}
+	Timeout unlimited{UnlimitedTimeout};
+	if (int lockRet = internalLock->try_lock(&unlimited, threadID, false, true);
+	    lockRet != 0)
+	{
+		return lockRet;
+	}
+	return ret;
+}
+
+void __cheri_libcall
+conditionvariable_notify_one(ConditionVariableState *conditionVariable)
+{
+	conditionVariable->sequence++;
+	conditionVariable->sequence.notify_one();
+}
+
+void __cheri_libcall
+conditionvariable_notify_all(ConditionVariableState *conditionVariable,
+                             FlagLockState          *lock)
+{
+	conditionVariable->sequence++;
+	while (true)
+	{
+		// If the lock is not held, nothing will wake threads moved to the
+		// lock word, so wake everyone.  Otherwise, the unlock wakes one moved
+		// thread and each one wakes the next when it releases the lock.
+		uint32_t lockWord =
+		  static_cast<InternalFlagLock *>(lock)->mark_requeued_waiters();
+		if (lockWord == 0)
+		{
+			conditionVariable->sequence.notify_all();
+			return;
+		}
+		// The scheduler moves the waiters only if the lock word is unchanged,
+		// and so still locked with the waiters bit set.  If the lock was
+		// released after we marked it then the unlock may already have sent
+		// its wake, so try again.
+		int ret = futex_requeue(
+		  reinterpret_cast<uint32_t *>(&conditionVariable->sequence),
+		  reinterpret_cast<const uint32_t *>(&lock->lockWord),
+		  lockWord,
+		  1,
+		  std::numeric_limits<uint32_t>::max());
+		if (ret != -EAGAIN)
+		{
+			return;
+		}
+	}
+}
@@ -1,5 +1,7 @@
 includes(
+	"allocator_trace",
 	"atomic",
+	"bump_arena",
 	"compartment_helpers",
 	"crt",
 	"cxxrt",
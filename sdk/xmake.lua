@@ -25,6 +25,31 @@ option("scheduler-accounting")
 	set_description("Track per-thread cycle counts in the scheduler");
 	set_showmenu(true)
 
+option("scheduler-tickless")
+	set_default(false)
+	set_description("Program the timer for the next timeout or time slice instead of interrupting on every tick");
+	set_showmenu(true)
+
+option("allocator-quarantine-drain")
+	set_default(4)
+	set_description("Number of chunks the allocator moves out of quarantine on each free or allocation");
+	set_showmenu(true)
+
+option("allocator-deferred-zeroing")
+	set_default(false)
+	set_description("Zero freed memory when it leaves quarantine rather than when it is freed");
+	set_showmenu(true)
+
+option("allocator-quota-statistics")
+	set_default(0)
+	set_description("Number of allocator capabilities to track heap usage for (0 disables tracking)");
+	set_showmenu(true)
+
+option("allocator-trace")
+	set_default(0)
+	set_description("Number of records in the allocator trace buffer (0 disables tracing)");
+	set_showmenu(true)
+
 function debugOption(name)
 	option("debug-" .. name)
 		set_default(false)
@@ -206,6 +231,16 @@ target("cheriot.allocator")
 	on_load(function (target)
 		target:set("cheriot.compartment", "alloc")
 		target:set('cheriot.debug-name', "allocator")
+		target:add('defines', "CHERIOT_ALLOCATOR_QUARANTINE_DRAIN=" .. tostring(get_config("allocator-quarantine-drain")))
+		target:add('defines', "CHERIOT_ALLOCATOR_DEFERRED_ZEROING=" .. tostring(get_config("allocator-deferred-zeroing")))
+		local quotaStatistics = tonumber(get_config("allocator-quota-statistics"))
+		if quotaStatistics and quotaStatistics > 0 then
+			target:add('defines', "CHERIOT_ALLOCATOR_QUOTA_STATISTICS=" .. tostring(quotaStatistics))
+		end
+		local traceRecords = tonumber(get_config("allocator-trace"))
+		if traceRecords and traceRecords > 0 then
+			target:add('defines', "CHERIOT_ALLOCATOR_TRACE=" .. tostring(traceRecords))
+		end
 	end)
 
 target("cheriot.token_library")
@@ -361,6 +396,14 @@ rule("firmware")
 			add_defines("SIMULATION")
 		end
 
+		if board.allocator_size_classes then
+			local size_classes = {}
+			for _, size in ipairs(board.allocator_size_classes) do
+				size_classes[#size_classes+1] = tostring(math.floor(size))
+			end
+			add_defines("CHERIOT_ALLOCATOR_SIZE_CLASSES=" .. table.concat(size_classes, ","))
+		end
+
 		local loader = target:deps()['cheriot.loader'];
 
 		if board.stack_high_water_mark then
@@ -751,6 +794,7 @@ function firmware(name)
 			target:set("cheriot.compartment", "sched")
 			target:set('cheriot.debug-name', "scheduler")
 			target:add('defines', "SCHEDULER_ACCOUNTING=" .. tostring(get_config("scheduler-accounting")))
+			target:add('defines', "SCHEDULER_TICKLESS=" .. tostring(get_config("scheduler-tickless")))
 		end)
 		add_files(path.join(coredir, "scheduler/main.cc"))
 
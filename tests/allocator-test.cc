@@ -22,6 +22,10 @@ using thread_pool::async;
 DECLARE_AND_DEFINE_ALLOCATOR_CAPABILITY(secondHeap, SECOND_HEAP_QUOTA);
 using namespace CHERI;
 #define SECOND_HEAP STATIC_SEALED_VALUE(secondHeap)
+DECLARE_AND_DEFINE_ALLOCATOR_CAPABILITY_WITH_ARENA(arenaHeap, SECOND_HEAP_QUOTA);
+#define ARENA_HEAP STATIC_SEALED_VALUE(arenaHeap)
+DECLARE_AND_DEFINE_ALLOCATOR_MANAGEMENT_CAPABILITY(allocatorManagement);
+#define ALLOCATOR_MANAGEMENT STATIC_SEALED_VALUE(allocatorManagement)
 
 namespace
 {
@@ -294,6 +298,15 @@ namespace
 		     "Claiming twice reduced quota from {} to {}",
 		     quotaLeft,
 		     quotaLeftAfterSecondClaim);
+		// Claiming again through an interior pointer must find the same
+		// object.
+		CHERI::Capability interior{alloc};
+		interior.address() += allocSize / 2;
+		size_t interiorClaimSize = heap_claim(SECOND_HEAP, interior);
+		TEST(interiorClaimSize == allocSize,
+		     "{}-byte allocation claimed as {} bytes via interior pointer",
+		     allocSize,
+		     interiorClaimSize);
 		debug_log("Freeing object on malloc capability: {}", alloc);
 		ret = heap_free(MALLOC_CAPABILITY, alloc);
 		TEST(ret == 0, "Failed to free claimed object, return: {}", ret);
@@ -306,9 +319,11 @@ namespace
 		TEST(ret == 0, "Freeing claimed allocation returned {}", ret);
 		ret = heap_free(SECOND_HEAP, alloc);
 		TEST(ret == 0, "Freeing claimed (twice) allocation returned {}", ret);
+		ret = heap_free(SECOND_HEAP, alloc);
+		TEST(ret == 0, "Freeing claimed (thrice) allocation returned {}", ret);
 		quotaLeft = heap_quota_remaining(SECOND_HEAP);
 		TEST(quotaLeft == 1024,
-		     "After claim and free twice from 1024-byte quota, {} bytes left",
+		     "After claim and free thrice from 1024-byte quota, {} bytes left",
 		     quotaLeft);
 		TEST(!__builtin_launder(&alloc)->is_valid(),
 		     "Heap capability still valid after releasing last claim: {}",
@@ -349,6 +364,571 @@ namespace
 		     quotaLeft);
 	}
 
+	/**
+	 * Test allocating and freeing several objects with a single call.
+	 */
+	void test_allocate_batch()
+	{
+		constexpr size_t BatchCount = 8;
+		constexpr size_t ObjectSize = 32;
+		void            *batch[BatchCount];
+		ssize_t          allocated = heap_allocate_batch(
+		           &noWait, SECOND_HEAP, ObjectSize, BatchCount, batch);
+		TEST(allocated == static_cast<ssize_t>(BatchCount),
+		     "Batch allocation returned {}, expected {}",
+		     allocated,
+		     BatchCount);
+		for (size_t i = 0; i < BatchCount; i++)
+		{
+			Capability object{batch[i]};
+			TEST(object.is_valid(), "Batch entry {} is not valid", i);
+			TEST(object.length() == ObjectSize,
+			     "Batch entry {} has length {}, expected {}",
+			     i,
+			     object.length(),
+			     ObjectSize);
+			for (size_t j = 0; j < i; j++)
+			{
+				TEST(batch[i] != batch[j],
+				     "Batch entries {} and {} are the same object",
+				     i,
+				     j);
+			}
+		}
+		// Free the batch in a single call, with a null entry and an entry that
+		// is not a heap object mixed in.
+		void *skipped  = batch[1];
+		void *replaced = batch[3];
+		batch[1]       = nullptr;
+		batch[3]       = &noWait;
+		ssize_t freed = heap_free_batch(SECOND_HEAP, batch, BatchCount);
+		TEST(freed == static_cast<ssize_t>(BatchCount - 2),
+		     "Batch free returned {}, expected {}",
+		     freed,
+		     BatchCount - 2);
+		TEST(batch[3] == &noWait,
+		     "Batch free modified an entry that it could not free");
+		for (size_t i = 0; i < BatchCount; i++)
+		{
+			TEST((i == 3) || (batch[i] == nullptr),
+			     "Batch free did not clear freed entry {}",
+			     i);
+		}
+		TEST(heap_free(SECOND_HEAP, skipped) == 0,
+		     "Failed to free batch-allocated object");
+		TEST(heap_free(SECOND_HEAP, replaced) == 0,
+		     "Failed to free batch-allocated object");
+		TEST(heap_quota_remaining(SECOND_HEAP) == SECOND_HEAP_QUOTA,
+		     "Quota not restored after freeing batch");
+
+		// A batch that cannot fit in the quota must fail without allocating.
+		void *tooMany[BatchCount];
+		allocated = heap_allocate_batch(&noWait,
+		                                SECOND_HEAP,
+		                                SECOND_HEAP_QUOTA / BatchCount,
+		                                BatchCount,
+		                                tooMany);
+		TEST(allocated == -ENOMEM,
+		     "Over-quota batch allocation returned {}, expected {}",
+		     allocated,
+		     -ENOMEM);
+		TEST(heap_quota_remaining(SECOND_HEAP) == SECOND_HEAP_QUOTA,
+		     "Failed batch allocation consumed quota");
+
+		// A batch free must not free the array that holds the batch.
+		auto **heapBatch = static_cast<void **>(
+		  heap_allocate(&noWait, SECOND_HEAP, 3 * sizeof(void *)));
+		TEST(heapBatch != nullptr, "Failed to allocate batch array");
+		allocated = heap_allocate_batch(
+		  &noWait, SECOND_HEAP, ObjectSize, 2, heapBatch);
+		TEST(allocated == 2, "Batch allocation returned {}", allocated);
+		heapBatch[2] = heapBatch;
+		freed        = heap_free_batch(SECOND_HEAP, heapBatch, 3);
+		TEST(freed == 2,
+		     "Batch free including its own array returned {}, expected 2",
+		     freed);
+		TEST((heapBatch[0] == nullptr) && (heapBatch[1] == nullptr) &&
+		       (heapBatch[2] == heapBatch),
+		     "Batch free updated the wrong entries");
+		TEST(heap_free(SECOND_HEAP, heapBatch) == 0,
+		     "Failed to free batch array");
+		TEST(heap_quota_remaining(SECOND_HEAP) == SECOND_HEAP_QUOTA,
+		     "Quota not restored after freeing batch array");
+	}
+
+	/**
+	 * Test that a batch allocation that blocks does not write into its output
+	 * array if another thread frees the array while the allocator lock is
+	 * dropped.
+	 */
+	void test_allocate_batch_output_freed()
+	{
+		constexpr size_t             BatchCount = 2;
+		static void                 *filler[MaxAllocCount];
+		static cheriot::atomic<int>  state;
+		static void                **out;
+		size_t quotaBefore = heap_quota_remaining(MALLOC_CAPABILITY);
+		state              = 0;
+
+		out = static_cast<void **>(heap_allocate(
+		  &noWait, MALLOC_CAPABILITY, sizeof(void *) * BatchCount));
+		TEST(out != nullptr, "Failed to allocate batch output array");
+		// Create the background worker before we exhaust memory.  It runs
+		// only once the batch allocation below blocks.
+		async([]() {
+			state.wait(0);
+			debug_log("Freeing batch output array {}", out);
+			TEST(heap_free(MALLOC_CAPABILITY, out) == 0,
+			     "Failed to free batch output array");
+			for (auto &allocation : filler)
+			{
+				if (allocation != nullptr)
+				{
+					heap_free(MALLOC_CAPABILITY, allocation);
+					allocation = nullptr;
+				}
+			}
+			state = 2;
+			state.notify_one();
+		});
+		bool memoryExhausted = false;
+		for (auto &allocation : filler)
+		{
+			allocation =
+			  heap_allocate(&noWait, MALLOC_CAPABILITY, BigAllocSize);
+			if (allocation == nullptr)
+			{
+				memoryExhausted = true;
+				break;
+			}
+		}
+		TEST(memoryExhausted, "Failed to exhaust memory");
+		state = 1;
+		state.notify_one();
+		Timeout t{AllocTimeout};
+		ssize_t allocated = heap_allocate_batch(
+		  &t, MALLOC_CAPABILITY, BigAllocSize, BatchCount, out);
+		TEST(allocated == 0,
+		     "Batch allocation into a freed array returned {}, expected 0",
+		     allocated);
+		state.wait(1);
+		TEST(heap_quota_remaining(MALLOC_CAPABILITY) == quotaBefore,
+		     "Batch allocation into a freed array leaked {} bytes",
+		     quotaBefore - heap_quota_remaining(MALLOC_CAPABILITY));
+	}
+
+	/**
+	 * Test that reallocation preserves contents and bounds.
+	 */
+	void test_reallocate()
+	{
+		constexpr size_t InitialSize = 32;
+		constexpr size_t GrownSize   = 128;
+		auto *object = static_cast<uint8_t *>(
+		  heap_allocate(&noWait, SECOND_HEAP, InitialSize));
+		TEST(object != nullptr, "Failed to allocate object to reallocate");
+		for (size_t i = 0; i < InitialSize; i++)
+		{
+			object[i] = i;
+		}
+		TEST(heap_reallocate(&noWait, SECOND_HEAP, object, InitialSize / 2) ==
+		       object,
+		     "Shrinking an object should return the original pointer");
+		TEST(heap_reallocate(&noWait, MALLOC_CAPABILITY, object, GrownSize) ==
+		       nullptr,
+		     "Reallocating with the wrong capability should fail");
+		auto *grown = static_cast<uint8_t *>(
+		  heap_reallocate(&noWait, SECOND_HEAP, object, GrownSize));
+		TEST(grown != nullptr, "Failed to grow object");
+		TEST(Capability{grown}.length() == GrownSize,
+		     "Grown object has length {}, expected {}",
+		     Capability{grown}.length(),
+		     GrownSize);
+		for (size_t i = 0; i < GrownSize; i++)
+		{
+			uint8_t expected = (i < InitialSize) ? i : 0;
+			TEST(grown[i] == expected,
+			     "Byte {} of grown object is {}, expected {}",
+			     i,
+			     grown[i],
+			     expected);
+		}
+		TEST(heap_free(SECOND_HEAP, grown) == 0,
+		     "Failed to free reallocated object");
+		TEST(heap_quota_remaining(SECOND_HEAP) == SECOND_HEAP_QUOTA,
+		     "Quota not restored after freeing reallocated object");
+
+		// Claimed objects cannot grow in place, so this takes the allocate,
+		// copy, and free path.
+		object = static_cast<uint8_t *>(
+		  heap_allocate(&noWait, SECOND_HEAP, InitialSize));
+		TEST(object != nullptr, "Failed to allocate object to reallocate");
+		for (size_t i = 0; i < InitialSize; i++)
+		{
+			object[i] = i;
+		}
+		TEST(heap_claim(MALLOC_CAPABILITY, object) == InitialSize,
+		     "Failed to claim object to reallocate");
+		grown = static_cast<uint8_t *>(
+		  heap_reallocate(&noWait, SECOND_HEAP, object, GrownSize));
+		TEST(grown != nullptr, "Failed to reallocate claimed object");
+		TEST(grown != object, "Claimed object was grown in place");
+		TEST(Capability{grown}.length() == GrownSize,
+		     "Reallocated object has length {}, expected {}",
+		     Capability{grown}.length(),
+		     GrownSize);
+		for (size_t i = 0; i < GrownSize; i++)
+		{
+			uint8_t expected = (i < InitialSize) ? i : 0;
+			TEST(grown[i] == expected,
+			     "Byte {} of reallocated object is {}, expected {}",
+			     i,
+			     grown[i],
+			     expected);
+		}
+		// The claim keeps the original object alive.
+		TEST(Capability{object}.is_valid(),
+		     "Claimed object freed by reallocation");
+		TEST(object[1] == 1, "Claimed object modified by reallocation");
+		TEST(heap_free(MALLOC_CAPABILITY, object) == 0,
+		     "Failed to drop claim on original object");
+		TEST(heap_free(SECOND_HEAP, grown) == 0,
+		     "Failed to free reallocated object");
+		TEST(heap_quota_remaining(SECOND_HEAP) == SECOND_HEAP_QUOTA,
+		     "Quota not restored after reallocating a claimed object");
+	}
+
+	/**
+	 * Test that the quarantine drain budget can be changed only with a
+	 * management capability and that drain times are recorded.
+	 */
+	void test_quarantine_drain()
+	{
+		constexpr size_t BatchCount = 8;
+		constexpr size_t ObjectSize = 32;
+		constexpr size_t Budget     = 8;
+		HeapQuarantineDrainStatistics statistics;
+		TEST(heap_quarantine_drain_statistics(
+		       ALLOCATOR_MANAGEMENT, &statistics, true) == 0,
+		     "Failed to read quarantine drain statistics");
+		size_t defaultBudget = statistics.budget;
+		TEST(heap_quarantine_drain_budget_set(MALLOC_CAPABILITY, Budget) ==
+		       -EPERM,
+		     "Setting the drain budget with a malloc capability should fail");
+		TEST(heap_quarantine_drain_budget_set(ALLOCATOR_MANAGEMENT, 1) ==
+		       -EINVAL,
+		     "Setting a drain budget below the minimum should fail");
+		TEST(heap_quarantine_drain_budget_set(ALLOCATOR_MANAGEMENT, Budget) ==
+		       0,
+		     "Failed to set the drain budget");
+		TEST(heap_quarantine_drain_statistics(
+		       ALLOCATOR_MANAGEMENT, &statistics, false) == 0,
+		     "Failed to read quarantine drain statistics");
+		TEST(statistics.budget == Budget,
+		     "Drain budget is {}, expected {}",
+		     statistics.budget,
+		     Budget);
+		void   *batch[BatchCount];
+		ssize_t allocated = heap_allocate_batch(
+		  &noWait, SECOND_HEAP, ObjectSize, BatchCount, batch);
+		TEST(allocated == static_cast<ssize_t>(BatchCount),
+		     "Batch allocation returned {}, expected {}",
+		     allocated,
+		     BatchCount);
+		TEST(heap_free_batch(SECOND_HEAP, batch, BatchCount) ==
+		       static_cast<ssize_t>(BatchCount),
+		     "Failed to free batch");
+		heap_quarantine_empty();
+		TEST(heap_quarantine_drain_idle() == 0,
+		     "Idle drain found objects in an empty quarantine");
+		TEST(heap_quarantine_drain_statistics(
+		       ALLOCATOR_MANAGEMENT, &statistics, false) == 0,
+		     "Failed to read quarantine drain statistics");
+		uint32_t drains = 0;
+		for (auto bucket : statistics.histogram)
+		{
+			drains += bucket;
+		}
+		TEST(drains > 0, "No quarantine drains were recorded");
+		TEST(statistics.maxCycles > 0, "No worst-case drain time recorded");
+		debug_log("Worst-case quarantine drain took {} cycles ({} drains)",
+		          statistics.maxCycles,
+		          drains);
+		TEST(heap_quarantine_drain_budget_set(ALLOCATOR_MANAGEMENT,
+		                                      defaultBudget) == 0,
+		     "Failed to restore the drain budget");
+	}
+
+	/**
+	 * Test that heap statistics require a management capability and are
+	 * consistent.
+	 */
+	void test_heap_statistics()
+	{
+		static HeapStatistics statistics;
+		TEST(heap_stats_get(MALLOC_CAPABILITY, &statistics) == -EPERM,
+		     "Reading heap statistics with a malloc capability should fail");
+		TEST(heap_stats_get(ALLOCATOR_MANAGEMENT, &statistics) == 0,
+		     "Failed to read heap statistics");
+		TEST(statistics.freeSize + statistics.quarantineSize <=
+		       statistics.totalSize,
+		     "Free ({}) and quarantined ({}) memory exceeds heap size ({})",
+		     statistics.freeSize,
+		     statistics.quarantineSize,
+		     statistics.totalSize);
+		TEST(statistics.largestFreeChunk <= statistics.freeSize,
+		     "Largest free chunk ({}) is larger than free memory ({})",
+		     statistics.largestFreeChunk,
+		     statistics.freeSize);
+		size_t binnedBytes = 0;
+		for (size_t i = 0; i < HEAP_STATISTICS_TREE_BINS; i++)
+		{
+			binnedBytes += statistics.treeBinBytes[i];
+		}
+		TEST(binnedBytes <= statistics.freeSize,
+		     "Tree bins hold {} bytes, but only {} are free",
+		     binnedBytes,
+		     statistics.freeSize);
+		TEST(statistics.allocations > 0, "No allocations were recorded");
+		uint32_t allocations = statistics.allocations;
+		void    *object      = heap_allocate(&noWait, SECOND_HEAP, 32);
+		TEST(object != nullptr, "Failed to allocate object");
+		TEST(heap_free(SECOND_HEAP, object) == 0, "Failed to free object");
+		TEST(heap_stats_get(ALLOCATOR_MANAGEMENT, &statistics) == 0,
+		     "Failed to read heap statistics");
+		TEST(statistics.allocations > allocations,
+		     "Allocation was not counted in heap statistics");
+#ifdef TEMPORAL_SAFETY
+		heap_quarantine_empty();
+		TEST(heap_stats_get(ALLOCATOR_MANAGEMENT, &statistics) == 0,
+		     "Failed to read heap statistics");
+		TEST(statistics.revocationSweeps > 0,
+		     "Emptying quarantine did not record a revocation sweep");
+		TEST(statistics.revocationBytesReclaimed > 0,
+		     "Emptying quarantine did not record any reclaimed memory");
+		TEST(statistics.revocationLastSweepCycles <=
+		       statistics.revocationMaxSweepCycles,
+		     "Last sweep took {} cycles, longer than the maximum {}",
+		     statistics.revocationLastSweepCycles,
+		     statistics.revocationMaxSweepCycles);
+		// Finish any sweep that is still running, then force an idle sweep of
+		// a single freed object and check that the revoker accounted for it.
+		heap_revocation_idle();
+		static HeapStatistics before;
+		TEST(heap_stats_get(ALLOCATOR_MANAGEMENT, &before) == 0,
+		     "Failed to read heap statistics");
+		object = heap_allocate(&noWait, SECOND_HEAP, 32);
+		TEST(object != nullptr, "Failed to allocate object");
+		TEST(heap_free(SECOND_HEAP, object) == 0, "Failed to free object");
+		int kicks = heap_revocation_idle();
+		TEST(kicks > 0, "Idle revocation ignored an object in quarantine");
+		TEST(heap_stats_get(ALLOCATOR_MANAGEMENT, &statistics) == 0,
+		     "Failed to read heap statistics");
+		TEST(statistics.revocationSweeps > before.revocationSweeps,
+		     "Idle revocation did not start a sweep");
+#	ifdef SOFTWARE_REVOKER
+		TEST(statistics.revocationSweepsCompleted >
+		       before.revocationSweepsCompleted,
+		     "Idle revocation did not finish a sweep");
+		// Every kick from the idle sweep is one tick of the same sweep, but
+		// the revoker may also have been ticked from elsewhere.
+		TEST(statistics.revocationLastSweepTicks >=
+		       static_cast<uint32_t>(kicks),
+		     "Sweep took {} ticks, but idle revocation kicked {} times",
+		     statistics.revocationLastSweepTicks,
+		     kicks);
+		TEST(statistics.revocationMaxPauseCycles > 0,
+		     "Software revoker did not time its ticks");
+		TEST((statistics.revocationTickSize >= 256) &&
+		       (statistics.revocationTickSize <= 16384) &&
+		       ((statistics.revocationTickSize &
+		         (statistics.revocationTickSize - 1)) == 0),
+		     "Adaptive tick size {} is not a power of two in [256, 16384]",
+		     statistics.revocationTickSize);
+#	endif
+		// The quarantine is now empty, so there is nothing left to do.
+		TEST(heap_revocation_idle() == 0,
+		     "Idle revocation found work with an empty quarantine");
+#endif
+	}
+
+	/**
+	 * Test the per-quota usage statistics, if the allocator tracks them.
+	 */
+	void test_quota_statistics()
+	{
+		constexpr size_t           Count = 4;
+		static HeapQuotaStatistics statistics[Count];
+		TEST(heap_quota_statistics_get(MALLOC_CAPABILITY, statistics, Count) ==
+		       -EPERM,
+		     "Reading quota statistics with a malloc capability should fail");
+		ssize_t before =
+		  heap_quota_statistics_get(ALLOCATOR_MANAGEMENT, statistics, Count);
+		if (before == -ENOTSUP)
+		{
+			debug_log("Allocator built without per-quota statistics");
+			return;
+		}
+		TEST(before >= 0, "Failed to read quota statistics: {}", before);
+		uint32_t allocations = 0;
+		for (ssize_t i = 0; i < before; i++)
+		{
+			allocations += statistics[i].allocations;
+		}
+		void *object = heap_allocate(&noWait, SECOND_HEAP, 32);
+		TEST(object != nullptr, "Failed to allocate object");
+		ssize_t after =
+		  heap_quota_statistics_get(ALLOCATOR_MANAGEMENT, statistics, Count);
+		TEST(after >= before, "Quota statistics lost entries");
+		uint32_t allocationsAfter = 0;
+		for (ssize_t i = 0; i < after; i++)
+		{
+			auto    &quota   = statistics[i];
+			uint32_t counted = 0;
+			for (auto bucket : quota.histogram)
+			{
+				counted += bucket;
+			}
+			TEST(counted == quota.allocations,
+			     "Histogram for {} counts {} allocations, expected {}",
+			     quota.identifier,
+			     counted,
+			     quota.allocations);
+			TEST((quota.liveBytes <= quota.peakBytes) &&
+			       (quota.peakBytes <= quota.quota),
+			     "Quota {} has {} live and {} peak bytes of {}",
+			     quota.identifier,
+			     quota.liveBytes,
+			     quota.peakBytes,
+			     quota.quota);
+			allocationsAfter += quota.allocations;
+		}
+		// The second heap capability may not be one of the tracked ones.
+		TEST(allocationsAfter >= allocations,
+		     "Allocation counts went down from {} to {}",
+		     allocations,
+		     allocationsAfter);
+		TEST(heap_free(SECOND_HEAP, object) == 0, "Failed to free object");
+	}
+
+	/**
+	 * Test allocating from a capability with a dedicated arena.
+	 */
+	void test_dedicated_arena()
+	{
+		constexpr size_t ObjectSize = 128;
+		TEST(heap_quota_remaining(ARENA_HEAP) == SECOND_HEAP_QUOTA,
+		     "Arena capability has quota {}, expected {}",
+		     heap_quota_remaining(ARENA_HEAP),
+		     SECOND_HEAP_QUOTA);
+		static HeapStatistics before;
+		static HeapStatistics after;
+		TEST(heap_stats_get(ALLOCATOR_MANAGEMENT, &before) == 0,
+		     "Failed to read heap statistics");
+		void *first  = heap_allocate(&noWait, ARENA_HEAP, ObjectSize);
+		void *second = heap_allocate(&noWait, ARENA_HEAP, ObjectSize);
+		TEST(first != nullptr, "Failed to allocate from dedicated arena");
+		TEST(second != nullptr, "Failed to allocate from dedicated arena");
+		// The statistics cover the arena as well as the shared heap.
+		TEST(heap_stats_get(ALLOCATOR_MANAGEMENT, &after) == 0,
+		     "Failed to read heap statistics");
+		TEST(after.allocations >= before.allocations + 2,
+		     "Arena allocations not counted: {} before, {} after",
+		     before.allocations,
+		     after.allocations);
+		TEST(after.freeSize + 2 * ObjectSize <= before.freeSize,
+		     "Arena allocations did not reduce free space: {} before, {} "
+		     "after",
+		     before.freeSize,
+		     after.freeSize);
+		TEST(after.totalSize == before.totalSize,
+		     "Heap total size changed from {} to {}",
+		     before.totalSize,
+		     after.totalSize);
+		TEST(heap_available() == after.freeSize,
+		     "heap_available returned {}, statistics report {} free",
+		     heap_available(),
+		     after.freeSize);
+		TEST(heap_address_is_valid(first),
+		     "Arena object is not reported as a heap address");
+		TEST(heap_free(SECOND_HEAP, first) == -EPERM,
+		     "Freeing an arena object with another capability should fail");
+		// Claims may cross arenas.
+		TEST(heap_claim(SECOND_HEAP, second) == ObjectSize,
+		     "Failed to claim an arena object from the shared heap");
+		TEST(heap_free(ARENA_HEAP, second) == 0,
+		     "Failed to free claimed arena object");
+		TEST(Capability{second}.is_valid(),
+		     "Claimed arena object was freed while still claimed");
+		TEST(heap_free(SECOND_HEAP, second) == 0,
+		     "Failed to drop claim on arena object");
+		// The whole quota should be usable, however fragmented the shared heap
+		// is, once the quarantine has drained.
+		TEST(heap_free(ARENA_HEAP, first) == 0, "Failed to free arena object");
+		heap_quarantine_empty();
+		void *large = heap_allocate(
+		  &noWait, ARENA_HEAP, SECOND_HEAP_QUOTA - sizeof(void *));
+		TEST(large != nullptr, "Failed to allocate entire arena quota");
+		TEST(heap_free_all(ARENA_HEAP) == SECOND_HEAP_QUOTA,
+		     "heap_free_all on arena capability freed the wrong amount");
+		TEST(heap_quota_remaining(ARENA_HEAP) == SECOND_HEAP_QUOTA,
+		     "Arena quota not restored");
+		TEST(heap_quota_remaining(SECOND_HEAP) == SECOND_HEAP_QUOTA,
+		     "Shared heap quota not restored after dropping claim");
+	}
+
+	/**
+	 * Test that a batch free that mixes the capability's own objects with
+	 * claims on objects in another arena releases all of them and kicks the
+	 * revoker at most once.
+	 */
+	void test_free_batch_across_arenas()
+	{
+		constexpr size_t ObjectSize = 64;
+		constexpr size_t BatchCount = 4;
+		void            *batch[BatchCount];
+		for (size_t i = 0; i < BatchCount; i += 2)
+		{
+			batch[i]     = heap_allocate(&noWait, SECOND_HEAP, ObjectSize);
+			batch[i + 1] = heap_allocate(&noWait, ARENA_HEAP, ObjectSize);
+			TEST(batch[i] != nullptr, "Failed to allocate from shared heap");
+			TEST(batch[i + 1] != nullptr,
+			     "Failed to allocate from dedicated arena");
+			TEST(heap_claim(SECOND_HEAP, batch[i + 1]) == ObjectSize,
+			     "Failed to claim arena object");
+			TEST(heap_free(ARENA_HEAP, batch[i + 1]) == 0,
+			     "Failed to free claimed arena object");
+		}
+		// Finish any sweep that is running, so that the count below is not
+		// perturbed by sweeps that other tests started.
+		heap_revocation_idle();
+		static HeapStatistics before;
+		static HeapStatistics after;
+		TEST(heap_stats_get(ALLOCATOR_MANAGEMENT, &before) == 0,
+		     "Failed to read heap statistics");
+		ssize_t freed = heap_free_batch(SECOND_HEAP, batch, BatchCount);
+		TEST(freed == static_cast<ssize_t>(BatchCount),
+		     "Mixed-arena batch free returned {}, expected {}",
+		     freed,
+		     BatchCount);
+		TEST(heap_stats_get(ALLOCATOR_MANAGEMENT, &after) == 0,
+		     "Failed to read heap statistics");
+		uint32_t kicks =
+		  (after.revocationSweeps + after.revocationSweepsDeferred) -
+		  (before.revocationSweeps + before.revocationSweepsDeferred);
+		TEST(kicks <= 1,
+		     "Batch free across arenas kicked the revoker {} times",
+		     kicks);
+		for (size_t i = 0; i < BatchCount; i++)
+		{
+			TEST(batch[i] == nullptr, "Batch free did not clear entry {}", i);
+		}
+		TEST(heap_quota_remaining(SECOND_HEAP) == SECOND_HEAP_QUOTA,
+		     "Shared heap quota not restored after mixed-arena batch free");
+		TEST(heap_quota_remaining(ARENA_HEAP) == SECOND_HEAP_QUOTA,
+		     "Arena quota not restored after mixed-arena batch free");
+	}
+
 	void test_hazards()
 	{
 		debug_log("Before allocating, quota left: {}",
@@ -492,6 +1072,97 @@ namespace
 		     SECOND_HEAP_QUOTA);
 	}
 
+	/**
+	 * Test token pools.  Objects should be allocated from the pool until it
+	 * is exhausted and destroyed objects should be reused only after stale
+	 * handles to them have been revoked.
+	 */
+	__noinline void test_token_pool()
+	{
+		static constexpr size_t PoolSize = 4;
+		auto                    key      = STATIC_SEALING_TYPE(sealingTest);
+		Timeout                 noWait{0};
+		Capability<SObjStruct>  objects[PoolSize];
+		void                   *unsealed;
+
+		SObj pool = token_pool_create(&noWait, SECOND_HEAP, key, 32, PoolSize);
+		TEST(Capability{pool}.is_valid(), "Failed to create token pool");
+		auto wrongKey = STATIC_SEALING_TYPE(wrongSealingKey);
+		TEST(token_pool_sealed_alloc(&noWait, pool, wrongKey) == INVALID_SOBJ,
+		     "Allocated from a token pool with the wrong key");
+		for (size_t i = 0; i < PoolSize; i++)
+		{
+			objects[i] =
+			  token_pool_sealed_unsealed_alloc(&noWait, pool, key, &unsealed);
+			TEST(objects[i].is_valid() && objects[i].is_sealed(),
+			     "Failed to allocate object {} from token pool",
+			     i);
+			TEST(token_obj_unseal(key, objects[i]) == unsealed,
+			     "Pool object {} unsealed to {}, expected {}",
+			     i,
+			     token_obj_unseal(key, objects[i]),
+			     unsealed);
+			TEST(Capability{unsealed}.length() >= 32,
+			     "Pool object {} is too small: {}",
+			     i,
+			     unsealed);
+		}
+		TEST(token_pool_sealed_alloc(&noWait, pool, key) == INVALID_SOBJ,
+		     "Allocated more objects than the pool holds");
+		TEST(token_obj_destroy(SECOND_HEAP, key, objects[0]) != 0,
+		     "Freed a pool object with token_obj_destroy");
+
+		int ret = token_pool_obj_destroy(pool, key, objects[0]);
+		TEST(ret == 0, "Destroying pool object failed: {}", ret);
+		ret = token_pool_obj_destroy(pool, key, objects[0]);
+		TEST(ret == -EINVAL, "Double destroy of pool object returned {}", ret);
+		TEST(token_obj_unseal(key, objects[0]) == nullptr,
+		     "Destroyed pool object can still be unsealed");
+		// Pool objects are not heap allocations.  With an earlier object in
+		// the pool destroyed, the heap APIs must still reject a later one
+		// rather than mistaking part of the pool for a chunk header.
+		void  *later = token_obj_unseal(key, objects[2]);
+		size_t quota = heap_quota_remaining(MALLOC_CAPABILITY);
+		TEST(heap_claim(MALLOC_CAPABILITY, later) == 0,
+		     "Claimed pool object {}",
+		     later);
+		TEST(heap_quota_remaining(MALLOC_CAPABILITY) == quota,
+		     "Claiming a pool object changed the quota from {} to {}",
+		     quota,
+		     heap_quota_remaining(MALLOC_CAPABILITY));
+		TEST(heap_can_free(SECOND_HEAP, later) != 0,
+		     "heap_can_free accepted pool object {}",
+		     later);
+		TEST(heap_free(SECOND_HEAP, later) != 0,
+		     "Freed pool object {} with heap_free",
+		     later);
+		TEST(token_obj_unseal(key, objects[2]) == later,
+		     "Pool object was damaged by the heap APIs");
+		ret = token_pool_obj_destroy(pool, key, objects[2]);
+		TEST(ret == 0, "Destroying later pool object failed: {}", ret);
+		// The only free objects are in quarantine, so this must wait for
+		// revocation.
+		TEST(token_pool_sealed_alloc(&noWait, pool, key) == INVALID_SOBJ,
+		     "Reused a destroyed pool object without waiting for revocation");
+		Timeout t{AllocTimeout};
+		SObj    reused = token_pool_sealed_alloc(&t, pool, key);
+		TEST(Capability{reused}.is_valid(),
+		     "Failed to reuse destroyed pool object");
+		TEST(!__builtin_launder(&objects[0])->is_valid(),
+		     "Stale pool object handle still valid after reuse: {}",
+		     objects[0]);
+
+		TEST(token_pool_destroy(SECOND_HEAP, key, pool) == 0,
+		     "Destroying token pool failed");
+		TEST(!__builtin_launder(&objects[1])->is_valid(),
+		     "Pool object handle still valid after destroying pool: {}",
+		     objects[1]);
+		TEST(heap_quota_remaining(SECOND_HEAP) == SECOND_HEAP_QUOTA,
+		     "Quota left after destroying token pool is {}, expected {}",
+		     heap_quota_remaining(SECOND_HEAP),
+		     SECOND_HEAP_QUOTA);
+	}
+
 } // namespace
 
 /**
@@ -512,11 +1183,20 @@ void test_allocator()
 	debug_log("Heap size is {} bytes", HeapSize);
 
 	test_token();
+	test_token_pool();
 	test_hazards();
 
 	// Make sure that free works only on memory owned by the caller.
 	Timeout t{5};
 	test_free_all();
+	test_allocate_batch();
+	test_allocate_batch_output_freed();
+	test_reallocate();
+	test_quarantine_drain();
+	test_heap_statistics();
+	test_quota_statistics();
+	test_dedicated_arena();
+	test_free_batch_across_arenas();
 	void *ptr = heap_allocate(&t, STATIC_SEALED_VALUE(secondHeap), 32);
 	TEST(ptr, "Failed to allocate 32 bytes");
 	TEST(heap_address_is_valid(ptr) == true,
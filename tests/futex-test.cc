@@ -21,6 +21,238 @@ DECLARE_AND_DEFINE_INTERRUPT_CAPABILITY(interruptCapability,
                                         true);
 #endif
 
+namespace
+{
+	/**
+	 * Returns the index of the scheduler's futex wait queue for `word`.  This
+	 * mirrors `futex_wait_queue` in the scheduler, so that tests can pick
+	 * futex words that share a queue.
+	 */
+	uint32_t futex_queue_index(const uint32_t *word)
+	{
+		constexpr uint32_t Queues     = 16;
+		constexpr uint32_t Multiplier = 0x9e3779b1;
+		constexpr uint32_t Shift      = 32 - __builtin_ctz(Queues);
+		return ((Capability{word}.address() >> 2) * Multiplier) >> Shift;
+	}
+
+	/// Set by the low-priority thread just before it blocks.
+	cheriot::atomic<int> lowPriorityWaiting;
+	/// The number of thread-pool threads that have woken.
+	cheriot::atomic<uint32_t> woken;
+	/// The IDs of the thread-pool threads in the order that they woke.
+	uint16_t wakeOrder[2];
+
+	/**
+	 * Block both thread-pool threads on futexes.  The low-priority thread
+	 * (thread 3) waits on `lowWord` first, and then the medium-priority
+	 * thread (thread 2) waits on `highWord`, so that a FIFO queue would wake
+	 * the low-priority thread first.  Each thread records its ID in
+	 * `wakeOrder` when it wakes.
+	 */
+	void block_thread_pool(uint32_t *highWord, uint32_t *lowWord)
+	{
+		lowPriorityWaiting = 0;
+		woken              = 0;
+		auto waiter        = [=]() {
+            if (thread_id_get() == 2)
+            {
+                while (lowPriorityWaiting == 0)
+                {
+                    sleep(1);
+                }
+                sleep(1);
+                futex_wait(highWord, 0);
+            }
+            else
+            {
+                lowPriorityWaiting = 1;
+                futex_wait(lowWord, 0);
+            }
+            // Only one thread is woken at a time, so this does not race.
+            wakeOrder[woken] = thread_id_get();
+            woken++;
+		};
+		async(waiter);
+		async(waiter);
+		while (lowPriorityWaiting == 0)
+		{
+			sleep(1);
+		}
+		// Let the medium-priority thread block as well.
+		sleep(3);
+	}
+
+	/**
+	 * Wake `word` and wait for the thread that it woke to run.  Returns the
+	 * ID of that thread.
+	 */
+	uint16_t wake_one(uint32_t *word, uint32_t count)
+	{
+		uint32_t before = woken;
+		*word           = 1;
+		int ret         = futex_wake(word, count);
+		TEST(ret == 1, "Waking futex {} woke {} threads", word, ret);
+		while (woken == before)
+		{
+			sleep(1);
+		}
+		return wakeOrder[before];
+	}
+
+	/**
+	 * Test that waking a futex wakes only the threads waiting on that futex
+	 * when many futexes are in use, including futexes that share a wait
+	 * queue, and that threads waiting on one futex are woken in priority
+	 * order.  Also measure the cost of waking a futex that has no waiters
+	 * while other threads are waiting.
+	 */
+	void test_many_futexes()
+	{
+		static constexpr size_t Words = 32;
+		static uint32_t         words[Words];
+		int                     ret;
+		uint16_t                thread;
+
+		debug_log("Testing wake order of threads waiting on one futex");
+		block_thread_pool(&words[0], &words[0]);
+		thread = wake_one(&words[0], 1);
+		TEST(thread == 2,
+		     "Thread {} woke before the higher-priority thread 2",
+		     thread);
+		thread = wake_one(&words[0], 1);
+		TEST(thread == 3, "Expected thread 3 to wake, not {}", thread);
+
+		// Find two futex words that share a wait queue.  There are more
+		// words than queues, so there must be at least one pair.
+		size_t high = 0;
+		size_t low  = 0;
+		for (size_t i = 1; (i < Words) && (low == 0); i++)
+		{
+			for (size_t j = i + 1; j < Words; j++)
+			{
+				if (futex_queue_index(&words[i]) ==
+				    futex_queue_index(&words[j]))
+				{
+					high = i;
+					low  = j;
+					break;
+				}
+			}
+		}
+		TEST(low != 0, "No futex words share a wait queue");
+		debug_log("Testing wakes across {} futexes, with waiters on words {} "
+		          "and {} in queue {}",
+		          Words,
+		          high,
+		          low,
+		          futex_queue_index(&words[high]));
+		block_thread_pool(&words[high], &words[low]);
+		uint64_t cycles      = 0;
+		size_t   sameQueue   = 0;
+		uint32_t waiterQueue = futex_queue_index(&words[high]);
+		for (size_t i = 1; i < Words; i++)
+		{
+			if ((i == high) || (i == low))
+			{
+				continue;
+			}
+			sameQueue += futex_queue_index(&words[i]) == waiterQueue;
+			words[i]       = 1;
+			uint64_t start = rdcycle64();
+			ret            = futex_wake(&words[i], UINT32_MAX);
+			cycles += rdcycle64() - start;
+			TEST(ret == 0, "Waking futex {} woke {} threads", i, ret);
+		}
+		debug_log("futex_wake with no waiters took {} cycles on average, {} "
+		          "of the futexes shared a queue with the waiters",
+		          cycles / (Words - 3),
+		          sameQueue);
+		TEST(woken == 0, "Waking unrelated futexes woke {} threads", woken);
+		// The higher-priority thread is ahead in the shared queue, but is
+		// waiting on a different word, so must not be woken.
+		thread = wake_one(&words[low], UINT32_MAX);
+		TEST(thread == 3,
+		     "Waking the low-priority thread's futex woke thread {}",
+		     thread);
+		thread = wake_one(&words[high], UINT32_MAX);
+		TEST(thread == 2,
+		     "Waking the medium-priority thread's futex woke thread {}",
+		     thread);
+	}
+
+	/**
+	 * Test moving waiters from one futex to another with `futex_requeue`:
+	 * the expected-value check, the limit on the number of threads moved,
+	 * moves between wait queues, and moved threads timing out.
+	 */
+	void test_futex_requeue()
+	{
+		static uint32_t from;
+		static uint32_t targets[4];
+		int             ret;
+		uint16_t        thread;
+
+		// Use a target in a different wait queue, so that requeueing must
+		// move threads between queues.
+		uint32_t *to = nullptr;
+		for (auto &target : targets)
+		{
+			if (futex_queue_index(&target) != futex_queue_index(&from))
+			{
+				to = &target;
+				break;
+			}
+		}
+		TEST(to != nullptr, "No futex word in a different wait queue");
+
+		debug_log("Testing futex_requeue between wait queues {} and {}",
+		          futex_queue_index(&from),
+		          futex_queue_index(to));
+		block_thread_pool(&from, &from);
+		ret = futex_requeue(&from, to, *to + 1, 1, UINT32_MAX);
+		TEST(ret == -EAGAIN,
+		     "futex_requeue with the wrong expected value returned {}",
+		     ret);
+		TEST(woken == 0,
+		     "futex_requeue with the wrong expected value woke {} threads",
+		     woken);
+		// Waiters are in priority order, so this moves only the
+		// medium-priority thread.
+		ret = futex_requeue(&from, to, *to, 0, 1);
+		TEST(ret == 1, "futex_requeue moved {} threads, expected 1", ret);
+		thread = wake_one(&from, UINT32_MAX);
+		TEST(thread == 3,
+		     "Thread {} was still waiting on the original futex",
+		     thread);
+		thread = wake_one(to, UINT32_MAX);
+		TEST(thread == 2, "Thread {} was moved, expected thread 2", thread);
+
+		debug_log("Testing timeout of a requeued futex waiter");
+		static cheriot::atomic<int> timedWaitResult;
+		from            = 0;
+		*to             = 0;
+		timedWaitResult = 1;
+		async([]() {
+			Timeout t{10};
+			timedWaitResult = futex_timed_wait(&t, &from, 0);
+		});
+		sleep(2);
+		ret = futex_requeue(&from, to, *to, 0, UINT32_MAX);
+		TEST(ret == 1, "futex_requeue moved {} threads, expected 1", ret);
+		while (timedWaitResult == 1)
+		{
+			sleep(1);
+		}
+		TEST(timedWaitResult == -ETIMEDOUT,
+		     "Requeued futex_timed_wait returned {}, expected {}",
+		     timedWaitResult.load(),
+		     -ETIMEDOUT);
+		ret = futex_wake(to, UINT32_MAX);
+		TEST(ret == 0, "Requeued waiter was still queued after timing out");
+	}
+} // namespace
+
 void test_futex()
 {
 	static uint32_t futex;
@@ -55,6 +287,27 @@ void test_futex()
 		     "futex_timed_wait timed out but elapsed ticks {} too small",
 		     t.elapsed);
 	}
+	debug_log("Calling futex with a deadline shorter than a tick");
+	{
+		uint64_t deadline = thread_timer_get() + TIMERCYCLES_PER_TICK / 2;
+		Timeout  t        = Timeout::until(deadline);
+		auto     err      = futex_timed_wait(&t, &futex, 1);
+		TEST(err == -ETIMEDOUT,
+		     "futex_timed_wait with a deadline returned {}, expected {}",
+		     err,
+		     -ETIMEDOUT);
+		TEST(thread_timer_get() >= deadline,
+		     "futex_timed_wait returned before its deadline");
+		TEST(t.remaining == 0,
+		     "futex_timed_wait timed out with {} ticks remaining",
+		     t.remaining);
+		deadline = thread_timer_get() + TIMERCYCLES_PER_TICK / 2;
+		TEST(thread_sleep_until(deadline) == 0, "thread_sleep_until failed");
+		TEST(thread_timer_get() >= deadline,
+		     "thread_sleep_until returned before its deadline");
+	}
+	test_many_futexes();
+	test_futex_requeue();
 	Timeout t{3};
 	auto    err = futex_timed_wait(&t, &futex, 0);
 	TEST(err == 0, "futex_timed_wait returned {}, expected {}", err, 0);
@@ -0,0 +1,338 @@
+// Copyright CHERIoT Contributors.
+// SPDX-License-Identifier: MIT
+
+#include "host_heap.h"
+#include <cstdio>
+#include <cstring>
+#include <sys/mman.h>
+
+using namespace CHERI;
+
+Revocation::Revoker revoker;
+Revocation::Policy  revocationPolicy;
+
+namespace
+{
+	/// The granule of the host mapping.
+	constexpr size_t PageSize = 4096;
+
+	/// The size of the shadow bitmap: one bit per allocation granule.
+	constexpr size_t ShadowSize =
+	  HostHeap::HeapSize / utils::bytes2bits(MallocAlignment);
+
+	/// The number of hazard pointer slots: two for each of eight threads.
+	constexpr size_t HazardPointerSlots = 16;
+
+	/**
+	 * The MMIO regions that the allocator uses, other than the shadow
+	 * bitmap.
+	 */
+	struct HostMMIO
+	{
+		/// The hazard epoch, high 16 bits, and the owning thread.
+		uint32_t epoch;
+		/// The hazard pointer slots.  All are empty on the host.
+		void *hazardPointers[HazardPointerSlots];
+	};
+
+	static_assert(ShadowSize % PageSize == 0);
+	static_assert(sizeof(HostMMIO) <= PageSize);
+
+	/// The size of the host mapping: heap, shadow bitmap and MMIO page.
+	constexpr size_t MappingSize = HostHeap::HeapSize + ShadowSize + PageSize;
+
+	/// The start of the host mapping, or nullptr if there is no heap.
+	char *mapping;
+
+	HostMMIO *mmio()
+	{
+		return reinterpret_cast<HostMMIO *>(mapping + HostHeap::HeapSize +
+		                                    ShadowSize);
+	}
+
+	/**
+	 * Returns the size of the hazard quarantine, which is the same as the
+	 * size of the hazard pointer region.
+	 */
+	size_t hazard_quarantine_size()
+	{
+		return sizeof(HostMMIO::hazardPointers);
+	}
+
+	/**
+	 * Initialise a memory space in `tbase`, as `mstate_init` in the allocator
+	 * compartment does.
+	 */
+	MState *mstate_init(Capability<void> tbase, size_t tsize)
+	{
+		size_t msize = pad_request(sizeof(MState));
+		if (tsize < msize + MinChunkSize + sizeof(MChunkHeader) ||
+		    tsize > MaxChunkSize)
+		{
+			return nullptr;
+		}
+
+		Capability m{tbase.cast<MState>()};
+
+		size_t hazardQuarantineSize = hazard_quarantine_size();
+		size_t hazardRegionSize     = 2 * hazardQuarantineSize;
+
+		m.bounds()            = sizeof(*m);
+		m->heapStart          = tbase;
+		m->heapStart.bounds() = tsize;
+		m->heapStart.address() += msize + hazardRegionSize;
+		m->init_bins();
+
+		Capability hazardQuarantine = tbase;
+		hazardQuarantine.address() += msize;
+		hazardQuarantine.bounds() = hazardQuarantineSize;
+		m->hazardQuarantine       = hazardQuarantine.cast<void *>();
+		Capability hazardSnapshot = tbase;
+		hazardSnapshot.address() += msize + hazardQuarantineSize;
+		hazardSnapshot.bounds() = hazardQuarantineSize;
+		m->hazardSnapshot       = hazardSnapshot.cast<void *>();
+
+		m->mspace_firstchunk_add(
+		  ds::pointer::offset<void>(tbase.get(), msize + hazardRegionSize),
+		  tsize - msize - hazardRegionSize);
+
+		return m;
+	}
+
+	/**
+	 * Returns the header of the chunk that `allocation` covers exactly, and
+	 * its body size in `bodySize`, or nullptr if `allocation` is not a
+	 * capability to a whole live allocation.
+	 */
+	MChunkHeader *
+	chunk_for(MState &state, Capability<void> allocation, size_t &bodySize)
+	{
+		if (!allocation.is_valid())
+		{
+			return nullptr;
+		}
+		MChunkHeader *chunk = state.allocation_start(allocation.address());
+		if (chunk == nullptr)
+		{
+			return nullptr;
+		}
+		bodySize = state.chunk_body_size(*chunk);
+		if ((allocation.base() != chunk->body().address()) ||
+		    (allocation.length() != bodySize))
+		{
+			return nullptr;
+		}
+		return chunk;
+	}
+} // namespace
+
+void *host_mmio_allocator_epoch()
+{
+	return &mmio()->epoch;
+}
+
+void *host_mmio_hazard_pointers()
+{
+	return mmio()->hazardPointers;
+}
+
+void *host_mmio_shadow()
+{
+	return mapping + HostHeap::HeapSize;
+}
+
+HostHeap::HostHeap()
+{
+	void *requested = reinterpret_cast<void *>(REVOKABLE_MEMORY_START);
+	void *mapped    = mmap(requested,
+	                       MappingSize,
+	                       PROT_READ | PROT_WRITE,
+	                       MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED_NOREPLACE,
+	                       -1,
+	                       0);
+	if (mapped != requested)
+	{
+		fprintf(stderr,
+		        "Unable to map the heap at %p: %s\n",
+		        requested,
+		        strerror(errno));
+		abort();
+	}
+	mapping     = static_cast<char *>(mapped);
+	hostRegions = {};
+	host_region_register(mapping, HeapSize);
+	host_region_register(mmio()->hazardPointers,
+	                     sizeof(HostMMIO::hazardPointers));
+	revoker.init();
+	revocationPolicy = {};
+	quota            = HeapSize;
+	state            = mstate_init(mapping, HeapSize);
+	if (state == nullptr)
+	{
+		fprintf(stderr, "Unable to initialise a %zu-byte heap\n", HeapSize);
+		abort();
+	}
+}
+
+HostHeap::~HostHeap()
+{
+	munmap(mapping, MappingSize);
+	mapping = nullptr;
+}
+
+Capability<void> HostHeap::allocate(size_t bytes)
+{
+	while (true)
+	{
+		auto ret = state->mspace_dispatch(bytes, quota, Owner);
+		if (auto *allocation = std::get_if<Capability<void>>(&ret))
+		{
+			return *allocation;
+		}
+		if (!std::holds_alternative<MState::AllocationFailureRevocationNeeded>(
+		      ret))
+		{
+			revocationPolicy.kick_deferred(revoker);
+			return nullptr;
+		}
+		// The fake revoker finishes a sweep as soon as it is kicked, so if
+		// dequeuing fails after a kick then it will never succeed.
+		if (!state->quarantine_dequeue())
+		{
+			revocationPolicy.kick(revoker,
+			                      Revocation::SweepUrgency::AllocationBlocked);
+			if (!state->quarantine_dequeue())
+			{
+				return nullptr;
+			}
+		}
+	}
+}
+
+int HostHeap::free(Capability<void> allocation)
+{
+	size_t        bodySize;
+	MChunkHeader *chunk = chunk_for(*state, allocation, bodySize);
+	if ((chunk == nullptr) || (chunk->owner() != Owner))
+	{
+		return -EINVAL;
+	}
+	size_t chunkSize = chunk->size_get();
+	chunk->ownerID   = 0;
+	if (chunk->claims == 0)
+	{
+		int ret = state->mspace_free(*chunk, bodySize);
+		if (ret == 0)
+		{
+			quota += chunkSize;
+		}
+		return ret;
+	}
+	quota += chunkSize;
+	return 0;
+}
+
+int HostHeap::claim(Capability<void> allocation)
+{
+	size_t        bodySize;
+	MChunkHeader *chunk = chunk_for(*state, allocation, bodySize);
+	if (chunk == nullptr)
+	{
+		return -EINVAL;
+	}
+	chunk->claims++;
+	return 0;
+}
+
+int HostHeap::release(Capability<void> allocation)
+{
+	size_t        bodySize;
+	MChunkHeader *chunk = chunk_for(*state, allocation, bodySize);
+	if ((chunk == nullptr) || (chunk->claims == 0))
+	{
+		return -EINVAL;
+	}
+	chunk->claims--;
+	if ((chunk->claims == 0) && (chunk->ownerID == 0))
+	{
+		return state->mspace_free(*chunk, bodySize);
+	}
+	return 0;
+}
+
+Capability<void> HostHeap::reallocate(Capability<void> allocation,
+                                      size_t           bytes)
+{
+	size_t        bodySize;
+	MChunkHeader *chunk = chunk_for(*state, allocation, bodySize);
+	if ((chunk == nullptr) || (chunk->owner() != Owner) || (bytes == 0))
+	{
+		return nullptr;
+	}
+	if (bytes <= bodySize)
+	{
+		return allocation;
+	}
+	if (chunk->claims == 0)
+	{
+		Capability<void> grown =
+		  state->mspace_grow_in_place(*chunk, bytes, quota);
+		if (grown != nullptr)
+		{
+			return grown;
+		}
+	}
+	Capability<void> newObject = allocate(bytes);
+	if (newObject == nullptr)
+	{
+		return nullptr;
+	}
+	memcpy(newObject.get(), allocation.get(), bodySize);
+	free(allocation);
+	return newObject;
+}
+
+void HostHeap::free_batch_begin()
+{
+	batchEpoch = MState::hazard_epoch_acquire();
+	state->free_batch_begin();
+}
+
+std::optional<Revocation::SweepUrgency> HostHeap::free_batch_end()
+{
+	auto urgency = state->free_batch_end();
+	MState::hazard_epoch_release(batchEpoch);
+	if (urgency)
+	{
+		revocationPolicy.kick(revoker, *urgency);
+	}
+	return urgency;
+}
+
+void HostHeap::quarantine_empty()
+{
+	revocationPolicy.kick_deferred(revoker);
+	while (state->heapQuarantineSize != 0)
+	{
+		if (!state->quarantine_dequeue())
+		{
+			revocationPolicy.kick(revoker,
+			                      Revocation::SweepUrgency::AllocationBlocked);
+			if (!state->quarantine_dequeue())
+			{
+				return;
+			}
+		}
+	}
+}
+
+HeapStatistics HostHeap::statistics()
+{
+	HeapStatistics statistics{};
+	state->statistics_add(statistics);
+	statistics.totalSize                = state->heapTotalSize;
+	statistics.revocationSweeps         = revocationPolicy.sweeps_started();
+	statistics.revocationSweepsDeferred = revocationPolicy.sweeps_deferred();
+	statistics.revocationBytesReclaimed = revocationPolicy.bytes_reclaimed();
+	return statistics;
+}
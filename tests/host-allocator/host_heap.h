@@ -0,0 +1,116 @@
+// Copyright CHERIoT Contributors.
+// SPDX-License-Identifier: MIT
+
+#pragma once
+#include "../../sdk/core/allocator/alloc.h"
+#include <optional>
+
+/**
+ * A heap for running `MState` on the host.
+ *
+ * The heap, its revocation shadow bitmap, the hazard pointer slots and the
+ * hazard epoch word are all carved out of a single mapping at
+ * `REVOKABLE_MEMORY_START`, which must be below 4 GiB because CHERIoT
+ * addresses are 32 bits.  The memory space is initialised in the same way as
+ * `mstate_init` in the allocator compartment.
+ *
+ * Only one `HostHeap` may exist at a time, because the revoker and the MMIO
+ * regions are globals, as they are on CHERIoT.
+ */
+class HostHeap
+{
+	/// The memory space for the heap.
+	MState *state = nullptr;
+
+	/// The quota that allocations are charged to.
+	size_t quota;
+
+	/// The hazard epoch held for the duration of a free batch.
+	uint32_t batchEpoch;
+
+	public:
+	/// The size of the heap, including the `MState` and hazard quarantine.
+	static constexpr size_t HeapSize = 256 * 1024;
+
+	/// The identifier that allocations are owned by.
+	static constexpr uint16_t Owner = 1;
+
+	/**
+	 * Map the heap and initialise a memory space in it.  Aborts if the
+	 * memory cannot be mapped at `REVOKABLE_MEMORY_START`.
+	 */
+	HostHeap();
+
+	/// Unmap the heap.
+	~HostHeap();
+
+	HostHeap(const HostHeap &)            = delete;
+	HostHeap &operator=(const HostHeap &) = delete;
+
+	/// Returns the memory space.
+	MState &mstate()
+	{
+		return *state;
+	}
+
+	/// Returns the quota that remains for allocations.
+	[[nodiscard]] size_t quota_remaining() const
+	{
+		return quota;
+	}
+
+	/**
+	 * Allocate `bytes` bytes.  If memory is in quarantine, this dequeues it
+	 * and kicks the revoker, as the allocator compartment does, but it never
+	 * blocks.  Returns nullptr on failure.
+	 */
+	CHERI::Capability<void> allocate(size_t bytes);
+
+	/**
+	 * Free the allocation `allocation`, as `heap_free` does for its owner.
+	 * Returns 0 on success or a negative error code.
+	 */
+	int free(CHERI::Capability<void> allocation);
+
+	/**
+	 * Add a claim to `allocation`, which keeps it live after it is freed
+	 * until the claim is released.  Returns 0 on success or a negative error
+	 * code.
+	 */
+	int claim(CHERI::Capability<void> allocation);
+
+	/**
+	 * Release a claim made with `claim`, freeing the allocation if it was
+	 * the last reference.  Returns 0 on success or a negative error code.
+	 */
+	int release(CHERI::Capability<void> allocation);
+
+	/**
+	 * Grow or shrink `allocation` to `bytes` bytes, in place if possible and
+	 * by copying otherwise.  Returns nullptr and leaves `allocation` valid
+	 * on failure.
+	 */
+	CHERI::Capability<void> reallocate(CHERI::Capability<void> allocation,
+	                                   size_t                  bytes);
+
+	/**
+	 * Begin a batch of frees.  Frees until the matching `free_batch_end`
+	 * defer their quarantine maintenance to the end of the batch.
+	 */
+	void free_batch_begin();
+
+	/**
+	 * End a batch of frees and kick the revoker if the memory space asks for
+	 * it.  Returns the urgency of the kick, if there was one.
+	 */
+	std::optional<Revocation::SweepUrgency> free_batch_end();
+
+	/**
+	 * Kick the revoker and drain quarantine until it is empty, as
+	 * `heap_quarantine_empty` does.
+	 */
+	void quarantine_empty();
+
+	/// Returns the current heap statistics.
+	HeapStatistics statistics();
+};
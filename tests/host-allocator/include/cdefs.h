@@ -0,0 +1,38 @@
+// Copyright CHERIoT Contributors.
+// SPDX-License-Identifier: MIT
+
+#pragma once
+/*
+ * Include the host C library's definitions first and drop the ones that the
+ * CHERIoT `cdefs.h` defines differently, so that the CHERIoT versions win
+ * without redefinition warnings.
+ */
+#include <sys/cdefs.h>
+#undef __always_inline
+#undef __BEGIN_DECLS
+#undef __END_DECLS
+#include_next <cdefs.h>
+#include <stdint.h>
+
+/*
+ * The host C library's inline definitions use `__always_inline` and expect it
+ * to include `inline`, which the CHERIoT version does not.
+ */
+#undef __extern_always_inline
+#define __extern_always_inline                                                 \
+	extern inline __attribute__((always_inline, gnu_inline))
+
+/**
+ * GCC refuses to bind references to fields of packed structures, which the
+ * allocator's chunk headers do.  The packed structures in the allocator have
+ * no padding on the host either (their sizes are checked by static
+ * assertions), so drop the attribute.
+ */
+#undef __packed
+#define __packed
+
+/**
+ * Addresses are 32 bits on CHERIoT and the allocator's chunk metadata relies
+ * on that, so the host build uses 32-bit addresses too.
+ */
+typedef uint32_t ptraddr_t;
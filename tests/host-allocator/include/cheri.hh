@@ -0,0 +1,396 @@
+// Copyright CHERIoT Contributors.
+// SPDX-License-Identifier: MIT
+
+#pragma once
+#include <array>
+#include <cdefs.h>
+#include <compare>
+#include <concepts>
+#include <cstddef>
+#include <cstdint>
+
+/**
+ * Host replacement for the CHERI capability wrapper, sufficient to run the
+ * allocator's `MState` on an ordinary (non-CHERI) machine.
+ *
+ * A `Capability` here is a pointer together with a tag bit and a base and
+ * length that are tracked in software.  The metadata lives only in the
+ * `Capability` object: storing a capability to memory as a raw pointer and
+ * loading it again gives the bounds of the enclosing registered region (see
+ * `host_region_register`) or, failing that, of the whole 32-bit address space.
+ * This is enough for the allocator, which rederives every pointer that it
+ * stores from `heapStart`, but it means that the host build cannot model
+ * anything that depends on the bounds of pointers held in memory, such as
+ * hazard pointers.
+ *
+ * Addresses are 32 bits, as on CHERIoT, so all memory that the allocator
+ * touches must be mapped below 4 GiB.
+ */
+namespace CHERI
+{
+	/**
+	 * A region of memory whose bounds are known to the host shim.
+	 */
+	struct HostRegion
+	{
+		ptraddr_t base;
+		size_t    length;
+	};
+
+	/**
+	 * The regions that raw pointers are assumed to have been derived from.
+	 */
+	inline std::array<HostRegion, 8> hostRegions;
+
+	/**
+	 * Record that pointers to the start of `[base, base + length)` should be
+	 * treated as if they had exactly those bounds.  Returns false if there is
+	 * no space to record another region.
+	 */
+	inline bool host_region_register(const void *base, size_t length)
+	{
+		for (auto &region : hostRegions)
+		{
+			if (region.length == 0)
+			{
+				region = {static_cast<ptraddr_t>(
+				            reinterpret_cast<uintptr_t>(base)),
+				          length};
+				return true;
+			}
+		}
+		return false;
+	}
+
+	inline bool is_precise_range(ptraddr_t base, size_t size);
+
+	template<typename T>
+	class Capability
+	{
+		/// The pointer that this wraps.
+		T *ptr;
+		/// The base of the bounds.
+		ptraddr_t baseAddress;
+		/// The length of the bounds.
+		size_t boundsLength;
+		/// The tag bit.
+		bool tag;
+
+		template<typename U>
+		friend class Capability;
+
+		/// Bounds for a capability that was loaded from a raw pointer.
+		void bounds_from_pointer()
+		{
+			ptraddr_t a = address();
+			for (auto &region : hostRegions)
+			{
+				if ((region.length != 0) && (a == region.base))
+				{
+					baseAddress  = region.base;
+					boundsLength = region.length;
+					return;
+				}
+			}
+			baseAddress  = 0;
+			boundsLength = size_t(1) << 32;
+		}
+
+		/// Replace the pointer, keeping the bounds and tag.
+		void pointer_set(uintptr_t raw)
+		{
+			ptr = reinterpret_cast<T *>(raw);
+		}
+
+		/// Returns the pointer as an integer.
+		[[nodiscard]] uintptr_t raw() const
+		{
+			return reinterpret_cast<uintptr_t>(ptr);
+		}
+
+		public:
+		/**
+		 * Proxy for accessing a capability's address.
+		 */
+		class AddressProxy
+		{
+			Capability &cap;
+
+			public:
+			AddressProxy(Capability &c) : cap(c) {}
+
+			operator ptraddr_t() const
+			{
+				return static_cast<const Capability &>(cap).address();
+			}
+
+			AddressProxy &operator=(ptraddr_t addr)
+			{
+				cap.pointer_set((cap.raw() & ~uintptr_t(0xffffffff)) | addr);
+				return *this;
+			}
+
+			AddressProxy &operator=(AddressProxy addr)
+			{
+				return *this = static_cast<ptraddr_t>(addr);
+			}
+
+			AddressProxy &operator+=(ptrdiff_t displacement)
+			{
+				cap.pointer_set(cap.raw() + displacement);
+				return *this;
+			}
+
+			AddressProxy &operator-=(ptrdiff_t displacement)
+			{
+				cap.pointer_set(cap.raw() - displacement);
+				return *this;
+			}
+
+			[[nodiscard]] T *ptr() const
+			{
+				return cap.ptr;
+			}
+		};
+
+		/**
+		 * Proxy for accessing a capability's bounds.
+		 */
+		class BoundsProxy
+		{
+			Capability &cap;
+
+			public:
+			BoundsProxy(Capability &c) : cap(c) {}
+
+			operator ptrdiff_t() const
+			{
+				return static_cast<const Capability &>(cap).bounds();
+			}
+
+			/**
+			 * Set the bounds to start at the current address.  As on CHERIoT,
+			 * this clears the tag if the new bounds are not a subset of the
+			 * old ones or cannot be represented exactly.
+			 */
+			BoundsProxy &operator=(size_t bounds)
+			{
+				ptraddr_t base = cap.address();
+				if ((base < cap.baseAddress) ||
+				    (uint64_t(base) + bounds >
+				     uint64_t(cap.baseAddress) + cap.boundsLength) ||
+				    !is_precise_range(base, bounds))
+				{
+					cap.tag = false;
+				}
+				cap.baseAddress  = base;
+				cap.boundsLength = bounds;
+				return *this;
+			}
+		};
+
+		constexpr Capability(std::nullptr_t)
+		  : ptr(nullptr), baseAddress(0), boundsLength(0), tag(false)
+		{
+		}
+
+		constexpr Capability() : Capability(nullptr) {}
+
+		Capability(T *p) : ptr(p), tag(p != nullptr)
+		{
+			bounds_from_pointer();
+		}
+
+		/**
+		 * Conversion between capabilities to different types, which keeps the
+		 * bounds.  This is `cast` on CHERIoT, but is also used implicitly by
+		 * `ds::pointer` helpers.
+		 */
+		template<typename U>
+		Capability(Capability<U> other)
+		  : ptr(static_cast<T *>(other.ptr)),
+		    baseAddress(other.baseAddress),
+		    boundsLength(other.boundsLength),
+		    tag(other.tag)
+		{
+		}
+
+		AddressProxy address()
+		{
+			return {*this};
+		}
+
+		[[nodiscard]] ptraddr_t address() const
+		{
+			return static_cast<ptraddr_t>(raw());
+		}
+
+		BoundsProxy bounds()
+		{
+			return {*this};
+		}
+
+		[[nodiscard]] ptrdiff_t bounds() const
+		{
+			return boundsLength - (address() - baseAddress);
+		}
+
+		Capability operator-(ptrdiff_t diff)
+		{
+			Capability ret = *this;
+			ret.ptr -= diff;
+			return ret;
+		}
+
+		Capability &operator-=(ptrdiff_t diff)
+		{
+			ptr -= diff;
+			return *this;
+		}
+
+		Capability operator+(ptrdiff_t diff)
+		{
+			Capability ret = *this;
+			ret.ptr += diff;
+			return ret;
+		}
+
+		Capability &operator+=(ptrdiff_t diff)
+		{
+			ptr += diff;
+			return *this;
+		}
+
+		[[nodiscard]] bool is_valid() const
+		{
+			return tag;
+		}
+
+		[[nodiscard]] bool is_sealed() const
+		{
+			return false;
+		}
+
+		[[nodiscard]] ptraddr_t base() const
+		{
+			return baseAddress;
+		}
+
+		[[nodiscard]] size_t length() const
+		{
+			return boundsLength;
+		}
+
+		[[nodiscard]] ptraddr_t top() const
+		{
+			return base() + length();
+		}
+
+		bool operator==(const Capability &other) const
+		{
+			return (ptr == other.ptr) && (tag == other.tag) &&
+			       (baseAddress == other.baseAddress) &&
+			       (boundsLength == other.boundsLength);
+		}
+
+		bool operator==(std::nullptr_t) const
+		{
+			return ptr == nullptr;
+		}
+
+		template<typename U = T>
+		requires(!std::same_as<U, void>) operator U *()
+		{
+			return ptr;
+		}
+
+		operator void *()
+		{
+			return ptr;
+		}
+
+		T *operator->()
+		{
+			return ptr;
+		}
+
+		T *get()
+		{
+			return ptr;
+		}
+
+		template<typename U = T>
+		requires(!std::same_as<U, void>) U &operator*()
+		{
+			return *ptr;
+		}
+
+		template<typename U>
+		Capability<U> cast()
+		{
+			return Capability<U>{*this};
+		}
+
+		/**
+		 * Returns true if both capabilities are tagged and the bounds of this
+		 * one are within those of `other`.
+		 */
+		template<typename U>
+		bool is_subset_of(Capability<U> other)
+		{
+			return tag && other.tag && (baseAddress >= other.baseAddress) &&
+			       (uint64_t(baseAddress) + boundsLength <=
+			        uint64_t(other.baseAddress) + other.boundsLength);
+		}
+
+		template<typename U = T>
+		requires(!std::same_as<U, void>) U &operator[](size_t index)
+		{
+			return ptr[index];
+		}
+	};
+
+	/**
+	 * The exponent that CHERIoT uses to encode bounds of `length` bytes.
+	 * CHERIoT capabilities have a 9-bit mantissa, so lengths up to 511 bytes
+	 * are exact and larger ones are rounded to a multiple of 2^exponent.
+	 */
+	inline size_t representable_exponent(size_t length)
+	{
+		size_t exponent = 0;
+		while ((length >> exponent) > 511)
+		{
+			exponent++;
+		}
+		size_t mask = (size_t(1) << exponent) - 1;
+		if ((((length + mask) & ~mask) >> exponent) > 511)
+		{
+			exponent++;
+		}
+		return exponent;
+	}
+
+	/**
+	 * Rounds `length` up to a length that CHERIoT can represent.
+	 */
+	inline size_t representable_length(size_t length)
+	{
+		size_t mask = (size_t(1) << representable_exponent(length)) - 1;
+		return (length + mask) & ~mask;
+	}
+
+	/**
+	 * Returns the alignment mask required for a given length.
+	 */
+	inline size_t representable_alignment_mask(size_t length)
+	{
+		return ~((size_t(1) << representable_exponent(length)) - 1);
+	}
+
+	/// Can the range [base, base + size) be precisely covered by a capability?
+	inline bool is_precise_range(ptraddr_t base, size_t size)
+	{
+		return (base & ~representable_alignment_mask(size)) == 0 &&
+		       representable_length(size) == size;
+	}
+} // namespace CHERI
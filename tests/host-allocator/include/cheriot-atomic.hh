@@ -0,0 +1,16 @@
+// Copyright CHERIoT Contributors.
+// SPDX-License-Identifier: MIT
+
+#pragma once
+#include <atomic>
+
+/**
+ * Host replacement for the CHERIoT atomics header.  The host's atomics have
+ * the same interface for everything that the allocator uses and the host
+ * harness is single threaded, so no futex-based waiting is needed.
+ */
+namespace cheriot
+{
+	template<typename T>
+	using atomic = std::atomic<T>;
+} // namespace cheriot
@@ -0,0 +1,29 @@
+// Copyright CHERIoT Contributors.
+// SPDX-License-Identifier: MIT
+
+#pragma once
+#include <cdefs.h>
+#include <stdbool.h>
+
+/**
+ * Host replacement for the compartment macros.  On CHERIoT, MMIO capabilities
+ * are imports that the loader fills in.  On the host, each one is a function,
+ * defined by the harness, that returns a pointer to plain memory.
+ */
+#define MMIO_CAPABILITY_WITH_PERMISSIONS(type,                                 \
+                                         name,                                 \
+                                         permitLoad,                           \
+                                         permitStore,                          \
+                                         permitLoadStoreCapabilities,          \
+                                         permitLoadMutable)                    \
+	(static_cast<volatile type *>(host_mmio_##name()))
+
+#define MMIO_CAPABILITY(type, name)                                            \
+	MMIO_CAPABILITY_WITH_PERMISSIONS(type, name, true, true, false, false)
+
+/// The allocator's hazard epoch word.
+void *host_mmio_allocator_epoch();
+/// The hazard pointer slots.
+void *host_mmio_hazard_pointers();
+/// The revocation shadow bitmap that covers the heap.
+void *host_mmio_shadow();
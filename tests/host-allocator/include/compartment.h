@@ -0,0 +1,9 @@
+// Copyright CHERIoT Contributors.
+// SPDX-License-Identifier: MIT
+
+#pragma once
+#include <compartment-macros.h>
+#ifdef __cplusplus
+#	include <cheri.hh>
+#endif
+#include <timeout.h>
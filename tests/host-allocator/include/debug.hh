@@ -0,0 +1,163 @@
+// Copyright CHERIoT Contributors.
+// SPDX-License-Identifier: MIT
+
+#pragma once
+#include <cdefs.h>
+#include <cheri.hh>
+#include <cstddef>
+#include <cstdio>
+#include <cstdlib>
+#include <source_location>
+#include <type_traits>
+#include <variant>
+
+/**
+ * Host replacement for the CHERIoT debug helpers.  Messages are written to
+ * standard error, with the arguments printed after the format string rather
+ * than substituted into it.
+ *
+ * Unlike on CHERIoT, assertions are always checked: the host harness exists
+ * to find allocator bugs and has no code size constraints.
+ */
+template<size_t N>
+struct DebugContext
+{
+	char str[N];
+
+	constexpr DebugContext(const char (&s)[N])
+	{
+		for (size_t i = 0; i < N; i++)
+		{
+			str[i] = s[i];
+		}
+	}
+};
+
+namespace HostDebug
+{
+	template<typename T>
+	void print(T value)
+	{
+		if constexpr (std::is_pointer_v<T> &&
+		              !std::is_same_v<std::decay_t<T>, const char *>)
+		{
+			fprintf(stderr, " %p", static_cast<const volatile void *>(value));
+		}
+		else if constexpr (std::is_same_v<std::decay_t<T>, const char *>)
+		{
+			fprintf(stderr, " %s", value);
+		}
+		else if constexpr (std::is_enum_v<T>)
+		{
+			fprintf(stderr, " %lld", static_cast<long long>(value));
+		}
+		else if constexpr (std::is_convertible_v<T, unsigned long long>)
+		{
+			fprintf(stderr, " %llu", static_cast<unsigned long long>(value));
+		}
+		else if constexpr (std::is_convertible_v<T, void *>)
+		{
+			fprintf(stderr, " %p", static_cast<void *>(value));
+		}
+		else
+		{
+			fprintf(stderr, " <?>");
+		}
+	}
+
+	template<typename... Args>
+	void message(const char     *context,
+	             const char     *kind,
+	             const char     *fmt,
+	             Args... args)
+	{
+		fprintf(stderr, "%s: %s%s", context, kind, fmt);
+		(print(args), ...);
+		fprintf(stderr, "\n");
+	}
+
+	template<typename... Args>
+	[[noreturn]] void failure(const char          *context,
+	                          const char          *kind,
+	                          std::source_location loc,
+	                          const char          *fmt,
+	                          Args... args)
+	{
+		fprintf(stderr,
+		        "%s:%u: %s failure in %s\n",
+		        loc.file_name(),
+		        static_cast<unsigned>(loc.line()),
+		        kind,
+		        loc.function_name());
+		message(context, "", fmt, args...);
+		abort();
+	}
+} // namespace HostDebug
+
+template<bool Enabled, DebugContext Context>
+class ConditionalDebug
+{
+	public:
+	template<typename... Args>
+	static void log(const char *fmt, Args... args)
+	{
+		if constexpr (Enabled)
+		{
+			HostDebug::message(Context.str, "", fmt, args...);
+		}
+	}
+
+	template<typename... Args>
+	struct Invariant
+	{
+		Invariant(bool                 condition,
+		          const char          *fmt,
+		          Args... args,
+		          std::source_location loc = std::source_location::current())
+		{
+			if (!condition)
+			{
+				HostDebug::failure(Context.str, "Invariant", loc, fmt, args...);
+			}
+		}
+	};
+
+	template<typename... Args>
+	struct Assert
+	{
+		template<typename T>
+		requires std::is_same_v<T, bool>
+		Assert(T                    condition,
+		       const char          *fmt,
+		       Args... args,
+		       std::source_location loc = std::source_location::current())
+		{
+			if (!condition)
+			{
+				HostDebug::failure(Context.str, "Assertion", loc, fmt, args...);
+			}
+		}
+
+		template<typename T>
+		requires std::is_invocable_r_v<bool, T>
+		Assert(T                  &&condition,
+		       const char          *fmt,
+		       Args... args,
+		       std::source_location loc = std::source_location::current())
+		{
+			if (!condition())
+			{
+				HostDebug::failure(Context.str, "Assertion", loc, fmt, args...);
+			}
+		}
+	};
+
+	template<typename T, typename... Ts>
+	Invariant(T, const char *, Ts &&...) -> Invariant<Ts...>;
+
+	template<typename... Ts>
+	Assert(bool, const char *, Ts &&...) -> Assert<Ts...>;
+
+	template<typename... Ts>
+	Assert(auto, const char *, Ts &&...) -> Assert<Ts...>;
+};
@@ -0,0 +1,24 @@
+// Copyright CHERIoT Contributors.
+// SPDX-License-Identifier: MIT
+
+#pragma once
+#include <stdint.h>
+#include <time.h>
+
+/**
+ * Host replacement for the RISC-V cycle counter.  This returns nanoseconds
+ * from a monotonic clock, which is what the allocator's drain timing and the
+ * host benchmarks need: a cheap, increasing count.
+ */
+static inline uint64_t rdcycle64()
+{
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return static_cast<uint64_t>(now.tv_sec) * 1000000000 + now.tv_nsec;
+}
+
+/// Low 32 bits of `rdcycle64`.
+static inline uint32_t rdcycle()
+{
+	return static_cast<uint32_t>(rdcycle64());
+}
@@ -0,0 +1,12 @@
+// Copyright CHERIoT Contributors.
+// SPDX-License-Identifier: MIT
+
+#pragma once
+
+/**
+ * Host replacement for the CHERIoT `stdlib.h`.  This is the host C library's
+ * `stdlib.h` plus the allocator's statistics structures, which are all that
+ * the allocator uses from the CHERIoT version.
+ */
+#include_next <stdlib.h>
+#include <heap_statistics.h>
@@ -0,0 +1,22 @@
+// Copyright CHERIoT Contributors.
+// SPDX-License-Identifier: MIT
+
+#pragma once
+#include_next <strings.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * Host replacements for the CHERIoT bit-counting library calls.  Both return
+ * 32 for 0.
+ */
+static inline size_t clz(uint32_t x)
+{
+	return x == 0 ? 32 : __builtin_clz(x);
+}
+
+/// Count trailing zeroes, see `clz`.
+static inline size_t ctz(uint32_t x)
+{
+	return x == 0 ? 32 : __builtin_ctz(x);
+}
@@ -0,0 +1,15 @@
+// Copyright CHERIoT Contributors.
+// SPDX-License-Identifier: MIT
+
+#pragma once
+#include <stdint.h>
+
+/**
+ * Host replacement for the CHERIoT thread API.  The host harness runs the
+ * allocator on a single thread, which is given the ID of the first CHERIoT
+ * thread.
+ */
+static inline uint16_t thread_id_get()
+{
+	return 1;
+}
@@ -0,0 +1,251 @@
+// Copyright CHERIoT Contributors.
+// SPDX-License-Identifier: MIT
+
+#include "host_heap.h"
+#include <cstdio>
+#include <cstring>
+#include <source_location>
+#include <vector>
+
+using namespace CHERI;
+
+namespace
+{
+	/**
+	 * Fail the test with `message` if `condition` is false.
+	 */
+	void check(bool                 condition,
+	           const char          *message,
+	           std::source_location loc = std::source_location::current())
+	{
+		if (!condition)
+		{
+			fprintf(stderr,
+			        "%s:%u: test failure: %s\n",
+			        loc.file_name(),
+			        static_cast<unsigned>(loc.line()),
+			        message);
+			exit(EXIT_FAILURE);
+		}
+	}
+
+	/**
+	 * Returns true if every byte of `allocation` is zero.
+	 */
+	bool is_zero(Capability<void> allocation)
+	{
+		auto *bytes = static_cast<unsigned char *>(allocation.get());
+		for (size_t i = 0; i < allocation.length(); i++)
+		{
+			if (bytes[i] != 0)
+			{
+				return false;
+			}
+		}
+		return true;
+	}
+
+	/**
+	 * Allocations are zeroed, precisely bounded, disjoint and charged to the
+	 * quota, and freeing them returns the quota.
+	 */
+	void test_allocate_free()
+	{
+		HostHeap heap;
+		size_t   quota = heap.quota_remaining();
+
+		std::vector<Capability<void>> allocations;
+		for (size_t size : {1, 8, 24, 100, 513, 1000, 4097, 10000})
+		{
+			Capability<void> allocation = heap.allocate(size);
+			check(allocation.is_valid(), "Allocation failed");
+			check(allocation.length() >= size, "Allocation is too small");
+			check(is_precise_range(allocation.base(), allocation.length()),
+			      "Allocation bounds are not representable");
+			check(is_zero(allocation), "Allocation is not zeroed");
+			memset(allocation.get(), 0xa5, allocation.length());
+			for (auto &other : allocations)
+			{
+				check((allocation.top() <= other.base()) ||
+				        (other.top() <= allocation.base()),
+				      "Allocations overlap");
+			}
+			allocations.push_back(allocation);
+		}
+		check(heap.quota_remaining() < quota, "Allocations were not charged");
+
+		Capability<void> interior = allocations[3];
+		interior.address() += 8;
+		interior.bounds() = 8;
+		check(heap.free(interior) == -EINVAL,
+		      "Freeing part of an allocation succeeded");
+
+		for (auto &allocation : allocations)
+		{
+			check(heap.free(allocation) == 0, "Free failed");
+		}
+		check(heap.quota_remaining() == quota, "Quota was not returned");
+		check(heap.free(allocations[0]) == -EINVAL, "Double free succeeded");
+	}
+
+	/**
+	 * Freed memory goes into quarantine and comes back, zeroed, once it has
+	 * been through a revocation sweep.
+	 */
+	void test_quarantine()
+	{
+		HostHeap heap;
+		size_t   freeSize = heap.statistics().freeSize;
+
+		Capability<void> allocation = heap.allocate(256);
+		memset(allocation.get(), 0xa5, allocation.length());
+		check(heap.free(allocation) == 0, "Free failed");
+		HeapStatistics statistics = heap.statistics();
+		check(statistics.quarantineSize > 0, "Freed memory not in quarantine");
+		check(revoker.shadow_bit_get(allocation.base()),
+		      "Quarantined memory is not painted in the shadow bitmap");
+
+		heap.quarantine_empty();
+		statistics = heap.statistics();
+		check(statistics.quarantineSize == 0, "Quarantine did not drain");
+		check(statistics.freeSize == freeSize, "Free space was not recovered");
+		check(!revoker.shadow_bit_get(allocation.base()),
+		      "Shadow bits were not cleared on leaving quarantine");
+
+		Capability<void> again = heap.allocate(256);
+		check(again.is_valid(), "Allocation after quarantine failed");
+		check(is_zero(again), "Reused memory is not zeroed");
+	}
+
+	/**
+	 * Filling the heap and freeing everything kicks the revoker and, once
+	 * quarantine drains, leaves a single free chunk.
+	 */
+	void test_exhaustion()
+	{
+		HostHeap heap;
+		size_t   freeSize = heap.statistics().freeSize;
+
+		std::vector<Capability<void>> allocations;
+		while (true)
+		{
+			Capability<void> allocation =
+			  heap.allocate(64 + 32 * (allocations.size() % 7));
+			if (allocation == nullptr)
+			{
+				break;
+			}
+			allocations.push_back(allocation);
+		}
+		check(allocations.size() > 100, "Heap exhausted too early");
+		HeapStatistics statistics = heap.statistics();
+		check(statistics.failuresDeallocationNeeded > 0,
+		      "Exhaustion was not recorded");
+
+		for (auto &allocation : allocations)
+		{
+			check(heap.free(allocation) == 0, "Free failed");
+		}
+		statistics = heap.statistics();
+		check(statistics.revocationSweeps > 0, "The revoker was never kicked");
+		check(revoker.system_epoch_get() > 0, "The revocation epoch is 0");
+
+		heap.quarantine_empty();
+		statistics = heap.statistics();
+		check(statistics.freeSize == freeSize, "Free space was not recovered");
+		check(statistics.largestFreeChunk == statistics.freeSize,
+		      "Free memory did not coalesce");
+	}
+
+	/**
+	 * A batch of frees does its quarantine maintenance once and kicks the
+	 * revoker at most once.
+	 */
+	void test_free_batch()
+	{
+		HostHeap heap;
+
+		std::vector<Capability<void>> allocations;
+		for (int i = 0; i < 32; i++)
+		{
+			allocations.push_back(heap.allocate(128));
+		}
+		uint32_t sweeps = heap.statistics().revocationSweeps;
+		heap.free_batch_begin();
+		for (auto &allocation : allocations)
+		{
+			check(heap.free(allocation) == 0, "Batched free failed");
+		}
+		check(heap.statistics().quarantineSize >= 32 * 128,
+		      "Batched frees did not go to quarantine");
+		heap.free_batch_end();
+		HeapStatistics statistics = heap.statistics();
+		check(statistics.revocationSweeps <= sweeps + 1,
+		      "A batch kicked the revoker more than once");
+		check((*MMIO_CAPABILITY(uint32_t, allocator_epoch) >> 16) % 2 == 0,
+		      "The hazard epoch was not released");
+	}
+
+	/**
+	 * A claimed allocation outlives its owner's free and is freed when the
+	 * last claim is released.
+	 */
+	void test_claims()
+	{
+		HostHeap heap;
+
+		Capability<void> allocation = heap.allocate(64);
+		check(heap.claim(allocation) == 0, "Claim failed");
+		check(heap.free(allocation) == 0, "Free of claimed object failed");
+		check(heap.statistics().quarantineSize == 0,
+		      "Claimed object was freed");
+		check(heap.release(allocation) == 0, "Release failed");
+		check(heap.statistics().quarantineSize > 0,
+		      "Object was not freed when its last claim was released");
+		check(heap.release(allocation) == -EINVAL,
+		      "Releasing an unclaimed object succeeded");
+	}
+
+	/**
+	 * Reallocation keeps the contents and grows in place when the next chunk
+	 * is free.
+	 */
+	void test_reallocate()
+	{
+		HostHeap heap;
+
+		Capability<void> allocation = heap.allocate(32);
+		memset(allocation.get(), 0xa5, allocation.length());
+		Capability<void> grown = heap.reallocate(allocation, 64);
+		check(grown.is_valid(), "Reallocation failed");
+		check(grown.base() == allocation.base(), "Did not grow in place");
+		check(grown.length() >= 64, "Reallocation is too small");
+		auto *bytes = static_cast<unsigned char *>(grown.get());
+		for (size_t i = 0; i < 32; i++)
+		{
+			check(bytes[i] == 0xa5, "Reallocation lost the contents");
+		}
+		check(bytes[32] == 0, "Grown space is not zeroed");
+
+		Capability<void> blocker = heap.allocate(32);
+		Capability<void> moved   = heap.reallocate(grown, 4096);
+		check(moved.is_valid(), "Reallocation by copying failed");
+		check(moved.base() != grown.base(), "Grew over a live allocation");
+		bytes = static_cast<unsigned char *>(moved.get());
+		check(bytes[0] == 0xa5, "Copying reallocation lost the contents");
+		check(heap.free(blocker) == 0, "Free failed");
+		check(heap.free(moved) == 0, "Free failed");
+	}
+} // namespace
+
+int main()
+{
+	test_allocate_free();
+	test_quarantine();
+	test_exhaustion();
+	test_free_batch();
+	test_claims();
+	test_reallocate();
+	fprintf(stderr, "MState host tests passed\n");
+	return 0;
+}
@@ -0,0 +1,173 @@
+// Copyright CHERIoT Contributors.
+// SPDX-License-Identifier: MIT
+
+#include "host_heap.h"
+#include <algorithm>
+#include <cstdio>
+#include <iterator>
+#include <time.h>
+
+using namespace CHERI;
+
+namespace
+{
+	/**
+	 * The kinds of operation in a trace.  This matches the allocation trace
+	 * benchmark, so that the host can replay the same traces.
+	 */
+	enum TraceKind : uint8_t
+	{
+		/// Allocate an object into a slot.
+		TraceAllocate,
+		/// Free the object in a slot.
+		TraceFree,
+		/// Claim the object in a slot.
+		TraceClaim,
+		/// Drop a claim made with `TraceClaim`.
+		TraceRelease,
+		/// Grow the object in a slot.
+		TraceReallocate,
+	};
+
+	/**
+	 * A single operation in a trace.
+	 */
+	struct TraceOperation
+	{
+		/// The kind of operation.
+		TraceKind kind;
+		/// The slot that holds the object that this operation refers to.
+		uint8_t slot;
+		/// The size of the allocation, for `TraceAllocate` and
+		/// `TraceReallocate`.
+		uint32_t size;
+	};
+
+	/// The number of slots that a trace may refer to.
+	constexpr size_t MaxSlots = 64;
+
+	/**
+	 * The trace to replay, shared with the allocation trace benchmark.
+	 */
+	constexpr TraceOperation Trace[] = {
+#include "../../benchmarks/allocation-trace/trace.inc"
+	};
+
+	/// The number of times that the trace is replayed for timing.
+	constexpr int TimedPasses = 100;
+
+	/**
+	 * Replay a single operation.  Exits with a failure if the operation
+	 * fails, so that the replay also works as a test.
+	 */
+	void replay(HostHeap             &heap,
+	            Capability<void>     *slots,
+	            const TraceOperation &operation)
+	{
+		Capability<void> &object = slots[operation.slot];
+		int               ret    = 0;
+		switch (operation.kind)
+		{
+			case TraceAllocate:
+				object = heap.allocate(operation.size);
+				ret    = object.is_valid() ? 0 : -ENOMEM;
+				break;
+			case TraceFree:
+				ret = heap.free(object);
+				break;
+			case TraceClaim:
+				ret = heap.claim(object);
+				break;
+			case TraceRelease:
+				ret = heap.release(object);
+				break;
+			case TraceReallocate:
+				object = heap.reallocate(object, operation.size);
+				ret    = object.is_valid() ? 0 : -ENOMEM;
+				break;
+		}
+		if (ret != 0)
+		{
+			fprintf(stderr,
+			        "Trace operation %d on slot %d (size %u) failed: %d\n",
+			        operation.kind,
+			        operation.slot,
+			        operation.size,
+			        ret);
+			exit(EXIT_FAILURE);
+		}
+	}
+
+	/**
+	 * Returns the percentage of free memory that is not in the largest free
+	 * chunk.
+	 */
+	size_t fragmentation(const HeapStatistics &statistics)
+	{
+		if (statistics.freeSize == 0)
+		{
+			return 0;
+		}
+		return 100 - (statistics.largestFreeChunk * 100 / statistics.freeSize);
+	}
+
+	/// Returns the time from a monotonic clock in nanoseconds.
+	uint64_t now()
+	{
+		struct timespec time;
+		clock_gettime(CLOCK_MONOTONIC, &time);
+		return static_cast<uint64_t>(time.tv_sec) * 1000000000 + time.tv_nsec;
+	}
+} // namespace
+
+/**
+ * Replay the allocation trace against a host `MState`.  The timed passes
+ * report throughput.  A final pass takes a snapshot of the heap after every
+ * operation, to report the peak quarantine size and the worst fragmentation
+ * seen.
+ */
+int main()
+{
+	constexpr size_t Operations = std::size(Trace);
+
+	uint64_t elapsed = 0;
+	for (int pass = 0; pass < TimedPasses; pass++)
+	{
+		HostHeap         heap;
+		Capability<void> slots[MaxSlots];
+		uint64_t         start = now();
+		for (const auto &operation : Trace)
+		{
+			replay(heap, slots, operation);
+		}
+		elapsed += now() - start;
+	}
+	printf("#operations\tns\tns per operation\n");
+	printf("%zu\t%llu\t%llu\n",
+	       Operations * TimedPasses,
+	       static_cast<unsigned long long>(elapsed),
+	       static_cast<unsigned long long>(elapsed /
+	                                       (Operations * TimedPasses)));
+
+	HostHeap         heap;
+	Capability<void> slots[MaxSlots];
+	size_t           peakQuarantine     = 0;
+	size_t           worstFragmentation = 0;
+	HeapStatistics   statistics;
+	for (const auto &operation : Trace)
+	{
+		replay(heap, slots, operation);
+		statistics     = heap.statistics();
+		peakQuarantine = std::max(peakQuarantine, statistics.quarantineSize);
+		worstFragmentation =
+		  std::max(worstFragmentation, fragmentation(statistics));
+	}
+	printf("#peak quarantine\tworst fragmentation %%\tfinal fragmentation "
+	       "%%\trevocation sweeps\n");
+	printf("%zu\t%zu\t%zu\t%u\n",
+	       peakQuarantine,
+	       worstFragmentation,
+	       fragmentation(statistics),
+	       statistics.revocationSweeps);
+	return 0;
+}
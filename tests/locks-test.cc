@@ -5,6 +5,7 @@
 #include "tests.hh"
 #include <cheri.hh>
 #include <errno.h>
+#include <futex.h>
 #include <locks.hh>
 #include <thread.h>
 #include <thread_pool.h>
@@ -18,6 +19,7 @@ namespace
 	FlagLock                  flagLock;
 	FlagLockPriorityInherited flagLockPriorityInherited;
 	TicketLock                ticketLock;
+	ConditionVariable         conditionVariable;
 
 	cheriot::atomic<bool> modified;
 	cheriot::atomic<int>  counter;
@@ -304,6 +306,116 @@ namespace
 		     counter.load());
 	}
 
+	/**
+	 * Test that condition variables time out with the lock held and that
+	 * `notify_all` wakes every waiter, including those that it moves to wait
+	 * on the lock.
+	 */
+	void test_condition_variable()
+	{
+		debug_log("Starting condition variable tests");
+		{
+			LockGuard g{flagLock};
+			Timeout   t{1};
+			int       ret = conditionVariable.wait(&t, flagLock);
+			TEST(ret == -ETIMEDOUT,
+			     "Condition variable wait returned {}, expected -ETIMEDOUT",
+			     ret);
+			TEST(flagLock.try_lock() == false,
+			     "Lock not reacquired after condition variable timeout");
+		}
+
+		counter  = 0;
+		modified = false;
+		for (int i = 0; i < 2; i++)
+		{
+			async([&]() {
+				LockGuard g{flagLock};
+				Timeout   t{UnlimitedTimeout};
+				int       ret = conditionVariable.wait(
+				  &t, flagLock, [&]() { return modified.load(); });
+				TEST(ret == 0, "Condition variable wait failed: {}", ret);
+				counter++;
+			});
+		}
+		// Make sure both other threads are waiting on the condition variable.
+		sleep(10);
+		TEST(counter == 0,
+		     "Condition variable waiter ran before notification, counter is {}",
+		     counter.load());
+		{
+			LockGuard g{flagLock};
+			modified = true;
+			conditionVariable.notify_all(flagLock);
+			sleep(5);
+			TEST(counter == 0,
+			     "Condition variable waiter ran while the lock was held, "
+			     "counter is {}",
+			     counter.load());
+		}
+		// Both waiters should now acquire the lock in turn.
+		sleep(10);
+		TEST(counter == 2,
+		     "Condition variable notify_all woke {} threads, expected 2",
+		     counter.load());
+	}
+
+	/**
+	 * Test that the threads that `notify_all` moves to wait on the lock are
+	 * woken one per unlock, rather than all at once.  This uses the C API so
+	 * that the test can see the lock word.
+	 */
+	void test_condition_variable_hand_off()
+	{
+		static FlagLockState          lock;
+		static ConditionVariableState condition;
+		static int                    stillSleeping;
+		debug_log("Testing condition variable hand-off");
+		counter       = 0;
+		modified      = false;
+		stillSleeping = -1;
+		for (int i = 0; i < 2; i++)
+		{
+			async([&]() {
+				Timeout t{UnlimitedTimeout};
+				TEST(flaglock_trylock(&t, &lock) == 0, "Failed to lock");
+				while (!modified)
+				{
+					int ret = conditionvariable_wait(&t, &condition, &lock);
+					TEST(ret == 0, "Condition variable wait failed: {}", ret);
+				}
+				// The first thread to get the lock is the higher-priority
+				// one.  If the unlock that let it in had woken every moved
+				// thread, the other would now be runnable rather than asleep
+				// on the lock word.  Waking it here is harmless: it will find
+				// the lock held and sleep again.
+				if (counter++ == 0)
+				{
+					stillSleeping = futex_wake(
+					  reinterpret_cast<uint32_t *>(&lock.lockWord), 2);
+				}
+				flaglock_unlock(&lock);
+			});
+		}
+		// Make sure both other threads are waiting on the condition variable.
+		sleep(10);
+		Timeout t{UnlimitedTimeout};
+		TEST(flaglock_trylock(&t, &lock) == 0, "Failed to lock");
+		modified = true;
+		conditionvariable_notify_all(&condition, &lock);
+		// Let the waiter that the requeue woke find the lock held and sleep
+		// on the lock word alongside the moved one.
+		sleep(5);
+		flaglock_unlock(&lock);
+		sleep(10);
+		TEST(counter == 2,
+		     "Condition variable notify_all woke {} threads, expected 2",
+		     counter.load());
+		TEST(stillSleeping == 1,
+		     "Unlock woke more than one moved waiter ({} still asleep)",
+		     stillSleeping);
+	}
+
 } // namespace
 
 void test_locks()
@@ -319,4 +431,6 @@ void test_locks()
 	test_ticket_lock_ordering();
 	test_ticket_lock_overflow();
 	test_recursive_mutex();
+	test_condition_variable();
+	test_condition_variable_hand_off();
 }
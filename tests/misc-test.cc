@@ -3,6 +3,8 @@
 
 #define TEST_NAME "Test misc APIs"
 #include "tests.hh"
+#include <bump_arena.h>
+#include <cheri.hh>
 #include <string.h>
 #include <timeout.h>
 
@@ -17,6 +19,7 @@
  *   would still be `UINT32_MAX` after a call to `elapse`.
  * - An unlimited timeout is really unlimited, i.e., a call to `elapse` does
  *   not modify its `remaining` value, which blocks.
+ * - A timeout whose deadline has passed does not block.
  */
 void check_timeouts()
 {
@@ -46,6 +49,15 @@ void check_timeouts()
 	     "`elapse` alters the remaining value of an unlimited timeout.");
 	// Ensure that an unlimited timeout blocks.
 	TEST(t.may_block(), "An unlimited timeout should block.");
+
+	// Ensure that a deadline that has passed stops a timeout from blocking,
+	// even if it has ticks remaining, and that one in the future does not.
+	t.deadline = 1;
+	TEST(!t.may_block(), "A timeout with a past deadline should not block.");
+	TEST(t.remaining == 0,
+	     "`may_block` did not clear the remaining time after the deadline.");
+	t = Timeout::until(UINT64_MAX);
+	TEST(t.may_block(), "A timeout with a future deadline should block.");
 }
 
 /**
@@ -85,8 +97,59 @@ void check_memchr()
 	     "memchr must return NULL for zero-size pointers.");
 }
 
+/**
+ * Test bump arenas.
+ *
+ * This test checks that allocations from an arena are bounded to their size,
+ * do not overlap, and are all invalidated when the arena is destroyed.
+ */
+void check_bump_arena()
+{
+	debug_log("Test bump arenas.");
+
+	Timeout         t{5};
+	ScopedBumpArena scoped{&t, MALLOC_CAPABILITY, 256};
+	TEST(scoped.is_valid(), "Failed to create a scoped arena");
+	TEST(scoped.allocate<uint64_t>() != nullptr,
+	     "Failed to allocate from a scoped arena");
+
+	BumpArena arena;
+	TEST(bump_arena_create(&t, MALLOC_CAPABILITY, &arena, 128) == 0,
+	     "Failed to create arena");
+	CHERI::Capability<void> first{bump_arena_allocate(&arena, 20)};
+	CHERI::Capability<void> second{bump_arena_allocate(&arena, 40)};
+	TEST(first.is_valid() && second.is_valid(),
+	     "Failed to allocate from arena");
+	TEST(first.length() == 20, "First allocation has length {}", first.length());
+	TEST(second.length() == 40,
+	     "Second allocation has length {}",
+	     second.length());
+	TEST(second.base() >= first.top(),
+	     "Allocations {} and {} overlap",
+	     first,
+	     second);
+	TEST(bump_arena_allocate(&arena, 256) == nullptr,
+	     "Allocation larger than the arena succeeded");
+	size_t remaining = bump_arena_remaining(&arena);
+	TEST(bump_arena_destroy(nullptr, &arena) != 0,
+	     "Destroyed an arena with an invalid heap capability");
+	TEST(bump_arena_remaining(&arena) == remaining,
+	     "Failed destroy changed the arena: {} bytes remaining, expected {}",
+	     bump_arena_remaining(&arena),
+	     remaining);
+	TEST(bump_arena_destroy(MALLOC_CAPABILITY, &arena) == 0,
+	     "Failed to destroy arena");
+#ifdef TEMPORAL_SAFETY
+	// Reload the capabilities from memory so that the load barrier sees them.
+	TEST(!__builtin_launder(&first)->is_valid() &&
+	       !__builtin_launder(&second)->is_valid(),
+	     "Allocations from a destroyed arena are still valid");
+#endif
+}
+
 void test_misc()
 {
 	check_timeouts();
 	check_memchr();
+	check_bump_arena();
 }
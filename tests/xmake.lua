@@ -91,7 +91,7 @@ firmware("test-suite")
     add_deps("test_runner", "thread_pool")
     -- Helper libraries
     add_deps("freestanding", "string", "crt", "cxxrt", "atomic_fixed", "compartment_helpers", "debug")
-    add_deps("message_queue", "locks", "event_group")
+    add_deps("message_queue", "locks", "event_group", "bump_arena")
     -- Tests
     add_deps("mmio_test")
     add_deps("eventgroup_test")